@@ -1,16 +1,35 @@
+#include <cache.hpp>
+#include <calibrate.hpp>
+#include <errors.hpp>
 #include <lex.hpp>
+#include <perf.hpp>
+#include <simd.hpp>
 #include <stream.hpp>
+#include <thread_pool.hpp>
 
+#include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <filesystem>
 #include <iostream>
 #include <fstream>
+#include <iomanip>
+#include <limits>
 #include <memory>
+#include <memory_resource>
 #include <sstream>
 #include <string>
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #define FOR_LEXERS(DO) \
+  DO(AUTO, "auto") \
   DO(HAND, "hand") \
+  DO(HAND_SIMD, "hand-simd") \
   DO(FSM,  "fsm") \
+  DO(FSM_GEN, "fsm-gen") \
+  DO(FSM_ENUM, "fsm-enum") \
   DO(RE2C, "re2c")
 
 enum Opts {
@@ -20,8 +39,13 @@ FOR_LEXERS(LEXER_TOK)
 };
 
 void print_usage(char* argv[]) {
-  std::cerr << "Usage: " << argv[0] << " <input_file> <lexer_type: fsm|hand|re2c> ";
-  std::cerr << "[--output <file>] [--iters 5]\n";
+  std::cerr << "Usage: " << argv[0] << " <input_file|dir|@list|-> [more inputs] ";
+  std::cerr << "<lexer_type: auto|fsm|fsm-gen|fsm-enum|hand|hand-simd|re2c> ";
+  std::cerr << "[--output <file>] [--format table|jsonl|csv|tsv] [--iters 5] ";
+  std::cerr << "[--mmap] [--threads N] [--intern] ";
+  std::cerr << "[--stream] [--window <bytes>] [--perf] [--cache <dir>] ";
+  std::cerr << "[--max-errors N] [--decode] [--compact] [--count-only] ";
+  std::cerr << "[--calibrate] [--calibration <file>]\n";
 }
 
 bool valid_lexer(const std::string & ty)
@@ -34,17 +58,422 @@ bool valid_lexer(const std::string & ty)
 
 using namespace lex;
 
+range_lexer_t range_lexer(const std::string & ty)
+{
+  if (ty == "hand")
+    return [](auto & is, auto & lx, auto first, auto last, auto & stop)
+      { return hand_lex(is, lx, first, last, stop); };
+  else if (ty == "hand-simd")
+    return [](auto & is, auto & lx, auto first, auto last, auto & stop)
+      { return hand_simd_lex(is, lx, first, last, stop); };
+  else if (ty == "fsm")
+    return [](auto & is, auto & lx, auto first, auto last, auto & stop)
+      { return fsm_lex(is, lx, first, last, stop); };
+  else if (ty == "fsm-gen")
+    return [](auto & is, auto & lx, auto first, auto last, auto & stop)
+      { return fsm_gen_lex(is, lx, first, last, stop); };
+  else if (ty == "fsm-enum")
+    return [](auto & is, auto & lx, auto first, auto last, auto & stop)
+      { return fsm_enum_lex(is, lx, first, last, stop); };
+#ifdef HAVE_RE2C
+  else if (ty == "re2c")
+    return [](auto & is, auto & lx, auto first, auto last, auto & stop)
+      { return re2c_lex(is, lx, first, last, stop); };
+#endif
+  return {};
+}
+
+//==============================================================================
+/// The engines auto picks from, each of which lexes on one thread
+//==============================================================================
+std::vector<std::string> auto_candidates()
+{
+  return {"hand", "hand-simd", "fsm", "fsm-gen",
+#ifdef HAVE_RE2C
+    "re2c",
+#endif
+  };
+}
+
+/// Profile each file once and hand all of it to the engine the table picks
+file_lexer_t auto_lexer(std::shared_ptr<const calibration_t> table)
+{
+  return [table](stream_t & is)
+    { return range_lexer(table->pick(profile_input(is), "fsm")); };
+}
+
+//==============================================================================
+/// The number tokens whose values were decoded, and how many did not fit
+//==============================================================================
+void print_numbers(const lexed_t & res)
+{
+  size_t nnumbers = 0, noverflow = 0;
+  for (size_t i=0; i<res.numIdentifiers(); ++i)
+    if (is_number(res.tokens[res.identifier_tokens[i]])) {
+      nnumbers++;
+      noverflow += res.identifier_overflow[i];
+    }
+  std::cout << "Numbers: " << nnumbers << " (" << noverflow << " overflowed)" << std::endl;
+}
+
+//==============================================================================
+/// Lex the input through a fixed size window.  The tokens are only kept when
+/// they are needed for the output or the symbol count.
+//==============================================================================
+int stream_main(
+  const std::string & filename,
+  const std::string & lexer_type,
+  const range_lexer_t & lexer,
+  size_t window_size,
+  size_t error_limit,
+  int niter,
+  bool keep,
+  bool intern,
+  bool decode,
+  lexed_t & res)
+{
+  int err = 0;
+  size_t ntoks = 0, nlines = 0;
+  auto count = [&](auto & window, auto & lx) {
+    ntoks += lx.numTokens();
+    nlines = window.first_line + window.newlines.size();
+    if (keep) res.append(lx);
+  };
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  for (int i=0; i<niter; ++i) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    res.reset();
+    res.intern = intern;
+    res.decode = decode;
+    ntoks = nlines = 0;
+
+    std::cout << "... Streaming via " << lexer_type << " ... ";
+    if (filename == "-") {
+      err += stream_lex(std::cin, "", lexer, count, window_size, error_limit);
+    }
+    else {
+      std::ifstream infile(filename);
+      err += stream_lex(infile, filename, lexer, count, window_size, error_limit);
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> duration = end - start;
+    std::cout << duration.count() << " ms" << std::endl;
+  }
+
+  auto end = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double, std::milli> duration = end - start;
+
+  std::cout << "Avg Elapsed: " << duration.count()/niter << " ms" << std::endl;
+  std::cout << "Tokens: " << ntoks << std::endl;
+  std::cout << "Lines: " << nlines << std::endl;
+  if (intern)
+    std::cout << "Symbols: " << res.numSymbols() << std::endl;
+  if (decode)
+    print_numbers(res);
+
+  return err;
+}
+
+//==============================================================================
+/// Only count the tokens, which is as fast as each lexer can scan without
+/// keeping anything
+//==============================================================================
+int count_main(
+  stream_t & is,
+  const std::string & lexer_type,
+  int niter,
+  size_t error_limit)
+{
+  count_sink_t counts;
+  int err = 0;
+  double elapsed = 0;
+
+  for (int i=0; i<niter; ++i) {
+    auto start = std::chrono::high_resolution_clock::now();
+
+    counts = count_sink_t();
+    counts.diagnostics.limit = error_limit;
+
+    std::cout << "... Counting via " << lexer_type << " ... ";
+    if (lexer_type == "hand")
+      err += hand_lex(is, counts);
+    else if (lexer_type == "hand-simd")
+      err += hand_simd_lex(is, counts);
+    else if (lexer_type == "fsm")
+      err += fsm_lex(is, counts);
+    else if (lexer_type == "fsm-gen")
+      err += fsm_gen_lex(is, counts);
+#ifdef HAVE_RE2C
+    else if (lexer_type == "re2c")
+      err += re2c_lex(is, counts);
+#endif
+    else {
+      std::cerr << "The " << lexer_type << " lexer can not count" << std::endl;
+      return 1;
+    }
+
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> duration = end - start;
+    elapsed += duration.count();
+    std::cout << duration.count() << " ms" << std::endl;
+  }
+
+  auto seconds = elapsed / niter / 1000;
+  std::cout << "Avg Elapsed: " << elapsed/niter << " ms" << std::endl;
+  std::cout << "Tokens: " << counts.tokens << std::endl;
+  std::cout << "Lines: " << is.newlines.size() << std::endl;
+  std::cout << "MB/s: " << is.buffer.size() / seconds / 1e6 << std::endl;
+  std::cout << "Tokens/s: " << counts.tokens / seconds << std::endl;
+  return err;
+}
+
+//==============================================================================
+/// Time each engine on each input, best of niter, and write the table auto
+/// picks from.  Every input is a row, so they should be like the inputs the
+/// machine will lex.
+//==============================================================================
+int calibrate_main(
+  const std::vector<std::string> & inputs,
+  int niter,
+  const std::string & calibration_file)
+{
+  std::vector<batch_file_t> files;
+  if (list_inputs(inputs, files)) return 1;
+
+  std::cout << "Calibrating: " << files.size() << " files" << std::endl;
+
+  calibration_t table;
+  table.engines = auto_candidates();
+
+  std::cout << std::right;
+#define PROFILE_HEADER(name, str) std::cout << std::setw(9) << str;
+  FOR_PROFILE_DENSITIES(PROFILE_HEADER)
+#undef PROFILE_HEADER
+  std::cout << std::setw(9) << "length";
+  for (auto & engine : table.engines) std::cout << std::setw(11) << engine;
+  std::cout << "  " << "file" << std::endl;
+
+  // the arena never frees, so it is reserved once, for the largest file
+  size_t largest = 0;
+  for (auto & f : files) largest = std::max(largest, f.bytes);
+  std::pmr::monotonic_buffer_resource arena;
+  lexed_t res(&arena);
+  res.diagnostics.hold = true;
+  res.diagnostics.limit = 1;
+  res.reserve(largest);
+
+  for (auto & f : files) {
+    std::ifstream infile(f.name);
+    auto is = make_stream(infile, f.name);
+    if (is.buffer.empty()) continue;
+
+    calibration_t::row_t row;
+    row.profile = profile_input(is);
+    for (auto & engine : table.engines) {
+      auto lexer = range_lexer(engine);
+      double best = std::numeric_limits<double>::max();
+      for (int i=0; i<niter; ++i) {
+        res.reset();
+        size_t stop = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        lexer(is, res, 0, is.buffer.size(), stop);
+        auto end = std::chrono::high_resolution_clock::now();
+        best = std::min(best, std::chrono::duration<double>(end - start).count());
+      }
+      row.mbps.push_back(is.buffer.size() / std::max(best, 1e-9) / 1e6);
+    }
+
+    std::cout << std::fixed << std::setprecision(3);
+#define PROFILE_VALUE(name, str) std::cout << std::setw(9) << row.profile.name;
+    FOR_PROFILE_DENSITIES(PROFILE_VALUE)
+#undef PROFILE_VALUE
+    std::cout << std::setw(9) << row.profile.token_length << std::setprecision(1);
+    for (auto mbps : row.mbps) std::cout << std::setw(11) << mbps;
+    std::cout << "  " << f.name << std::endl;
+    std::cout.unsetf(std::ios::fixed);
+
+    table.rows.emplace_back(std::move(row));
+  }
+
+  if (!table.save(calibration_file)) {
+    std::cerr << "Could not write '" << calibration_file << "'" << std::endl;
+    return 1;
+  }
+  std::cout << "Calibration: " << calibration_file << " (" << table.rows.size()
+    << " rows)" << std::endl;
+  return 0;
+}
+
+//==============================================================================
+/// Print the hardware counters per iteration, byte and token
+//==============================================================================
+void print_perf(
+  const perf_counters_t & perf,
+  int niter,
+  size_t nbytes,
+  size_t ntoks)
+{
+  std::cout << std::left << std::setw(16) << "Counter" << std::right
+    << std::setw(16) << "per iter" << std::setw(12) << "per byte"
+    << std::setw(12) << "per token" << std::endl;
+
+  for (int c=0; c<PERF_NUM_COUNTERS; ++c) {
+    std::cout << std::left << std::setw(16) << perf_to_str(c) << std::right;
+    if (!perf.has(c)) {
+      std::cout << std::setw(16) << "n/a" << std::endl;
+      continue;
+    }
+    auto count = double(perf.counts[c]) / niter;
+    std::cout << std::fixed << std::setprecision(0) << std::setw(16) << count
+      << std::setprecision(3) << std::setw(12) << count / std::max<size_t>(nbytes, 1)
+      << std::setw(12) << count / std::max<size_t>(ntoks, 1) << std::endl;
+    std::cout.unsetf(std::ios::fixed);
+  }
+}
+
+//==============================================================================
+/// Write the tokens to a file with large writes, formatting them on the pool
+/// if there is one
+//==============================================================================
+template<typename Lexed>
+bool write_output(
+  const std::string & filename,
+  const Lexed & res,
+  int format,
+  thread_pool_t * pool)
+{
+  std::cout << "Writing To: " << filename << std::endl;
+  auto start = std::chrono::high_resolution_clock::now();
+
+  auto fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  auto ok = (fd >= 0) && write_tokens(fd, res, format, pool);
+  if (fd >= 0) ok = (close(fd) == 0) && ok;
+  if (!ok) {
+    std::cerr << "Could not write '" << filename << "'" << std::endl;
+    return false;
+  }
+
+  auto end = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double, std::milli> duration = end - start;
+  std::cout << "Write Elapsed: " << duration.count() << " ms" << std::endl;
+  return true;
+}
+
+//==============================================================================
+/// Open the counters, or explain why there are none
+//==============================================================================
+std::unique_ptr<perf_counters_t> open_perf()
+{
+  auto perf = std::make_unique<perf_counters_t>();
+  if (!perf->available()) {
+    std::cout << "Perf counters unavailable (" << perf->reason() << ")" << std::endl;
+    perf.reset();
+  }
+  return perf;
+}
+
+//==============================================================================
+/// Lex many files on the pool, reporting the aggregate throughput and the
+/// slowest files
+//==============================================================================
+int batch_main(
+  const std::vector<std::string> & inputs,
+  const std::string & lexer_type,
+  const file_lexer_t & lexer,
+  int nthreads,
+  int niter,
+  bool use_mmap,
+  bool intern,
+  size_t error_limit,
+  const token_cache_t * cache,
+  perf_counters_t * perf)
+{
+  std::vector<batch_file_t> files;
+  if (list_inputs(inputs, files)) return 1;
+
+  std::cout << "Processing: " << files.size() << " files" << std::endl;
+
+  thread_pool_t pool(nthreads);
+  int err = 0;
+  double elapsed = 0;
+
+  for (int i=0; i<niter; ++i) {
+    auto start = std::chrono::high_resolution_clock::now();
+    std::cout << "... Lexing via " << lexer_type << " on " << pool.size()
+      << " threads ... ";
+
+    if (perf) perf->start();
+    err += batch_lex(files, lexer, pool, use_mmap, intern, batch_task_size, cache,
+      error_limit);
+    if (perf) perf->stop();
+
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double, std::milli> duration = end - start;
+    elapsed += duration.count();
+    std::cout << duration.count() << " ms" << std::endl;
+  }
+
+  size_t nbytes = 0, ntoks = 0, nlines = 0, ncached = 0;
+  for (auto & f : files) {
+    nbytes += f.bytes;
+    ntoks += f.tokens;
+    nlines += f.lines;
+    ncached += f.cached;
+  }
+
+  auto seconds = elapsed / niter / 1000;
+  std::cout << "Avg Elapsed: " << elapsed/niter << " ms" << std::endl;
+  std::cout << "Files: " << files.size() << std::endl;
+  std::cout << "Bytes: " << nbytes << std::endl;
+  std::cout << "Tokens: " << ntoks << std::endl;
+  std::cout << "Lines: " << nlines << std::endl;
+  if (cache)
+    std::cout << "Cached: " << ncached << std::endl;
+  std::cout << "Files/s: " << files.size() / seconds << std::endl;
+  std::cout << "MB/s: " << nbytes / seconds / 1e6 << std::endl;
+  std::cout << "Tokens/s: " << ntoks / seconds << std::endl;
+  if (perf)
+    print_perf(*perf, niter, nbytes, ntoks);
+
+  // the slowest of the last iteration
+  auto nslow = std::min<size_t>(files.size(), 10);
+  std::partial_sort(files.begin(), files.begin() + nslow, files.end(),
+    [](auto & a, auto & b) { return a.ms > b.ms; });
+
+  std::cout << "Slowest files:" << std::endl;
+  std::cout << std::right << std::setw(12) << "ms" << std::setw(12) << "MB/s"
+    << "  " << "file" << std::endl;
+  for (size_t i=0; i<nslow; ++i) {
+    auto & f = files[i];
+    std::cout << std::fixed << std::setprecision(3) << std::setw(12) << f.ms
+      << std::setprecision(1) << std::setw(12) << f.bytes / std::max(f.ms, 1e-6) / 1e3
+      << "  " << f.name << std::endl;
+    std::cout.unsetf(std::ios::fixed);
+  }
+
+  return err;
+}
+
 int main(int argc, char* argv[]) {
 
+  // the inputs, then the lexer type, come before any options
+  int nargs = 1;
+  while (nargs < argc && std::string(argv[nargs]).rfind("--", 0) != 0) nargs++;
+
   // check arg count and print usage if necessary
-  if (argc < 3) {
+  if (nargs < 3) {
     print_usage(argv);
     return 1;
   }
 
   // required parameters
-  std::string filename = argv[1];
-  std::string lexer_type = argv[2];
+  std::vector<std::string> inputs(argv + 1, argv + nargs - 1);
+  std::string filename = inputs.front();
+  std::string lexer_type = argv[nargs - 1];
 
   if (!valid_lexer(lexer_type)) {
     std::cout << "Invalid lexer type '" << lexer_type << "'" << std::endl;
@@ -54,14 +483,64 @@ int main(int argc, char* argv[]) {
 
   // Parse optional args
   std::string output_file;
+  int format = FORMAT_TABLE;
   int niter = 1;
+  bool use_mmap = false;
+  int nthreads = 1;
+  bool intern = false;
+  bool streaming = (filename == "-");
+  size_t window_size = stream_window_size;
+  bool use_perf = false;
+  std::string cache_dir;
+  size_t error_limit = 100;
+  bool decode = false;
+  bool compact = false;
+  bool count_only = false;
+  bool calibrate = false;
+  std::string calibration_file = "lexit.calibration";
 
-  for (int i = 3; i < argc; ++i) {
+  for (int i = nargs; i < argc; ++i) {
     std::string arg = argv[i];
     if (arg == "--output" && i + 1 < argc)
       output_file = argv[++i];
+    else if (arg == "--format" && i + 1 < argc) {
+      format = str_to_format(argv[++i]);
+      if (format < 0) {
+        std::cerr << "Unknown format '" << argv[i] << "'" << std::endl;
+        print_usage(argv);
+        return 1;
+      }
+    }
     else if (arg == "--iters" && i + 1 < argc)
       niter = atoi(argv[++i]);
+    else if (arg == "--mmap")
+      use_mmap = true;
+    else if (arg == "--threads" && i + 1 < argc)
+      nthreads = atoi(argv[++i]);
+    else if (arg == "--intern")
+      intern = true;
+    else if (arg == "--stream")
+      streaming = true;
+    else if (arg == "--window" && i + 1 < argc)
+      window_size = std::strtoull(argv[++i], nullptr, 10);
+    else if (arg == "--perf")
+      use_perf = true;
+    else if (arg == "--cache" && i + 1 < argc)
+      cache_dir = argv[++i];
+    else if (arg == "--decode")
+      decode = true;
+    else if (arg == "--compact")
+      compact = true;
+    else if (arg == "--count-only")
+      count_only = true;
+    else if (arg == "--calibrate")
+      calibrate = true;
+    else if (arg == "--calibration" && i + 1 < argc)
+      calibration_file = argv[++i];
+    else if (arg == "--max-errors" && i + 1 < argc) {
+      error_limit = std::strtoull(argv[++i], nullptr, 10);
+      if (!error_limit) error_limit = no_error_limit;
+    }
     else if (arg == "--help" ) {
       print_usage(argv);
       return 0;
@@ -72,43 +551,183 @@ int main(int argc, char* argv[]) {
     }
   }
 
+  if (calibrate)
+    return calibrate_main(inputs, std::max(niter, 1), calibration_file);
+
+  // auto picks from what --calibrate measured on this machine
+  std::shared_ptr<calibration_t> calibration;
+  if (lexer_type == "auto") {
+    calibration = std::make_shared<calibration_t>();
+    if (!calibration->load(calibration_file)) {
+      std::cout << "No calibration in '" << calibration_file
+        << "' (run with --calibrate), auto picks fsm" << std::endl;
+      *calibration = calibration_t();
+    }
+    // a table written by another build may name engines this one lacks
+    calibration->keep_engines([](auto & name) { return bool(range_lexer(name)); });
+  }
+
+  // Many files, or the ones in a directory or list
+  if (inputs.size() > 1 || filename[0] == '@' || std::filesystem::is_directory(filename)) {
+    auto fixed = range_lexer(lexer_type);
+    if (!calibration && !fixed) {
+      std::cerr << "The " << lexer_type << " lexer is not available" << std::endl;
+      return 1;
+    }
+    file_lexer_t lexer = [fixed](stream_t &) { return fixed; };
+    if (calibration) lexer = auto_lexer(calibration);
+    if (output_file.size() || streaming || decode || compact || count_only) {
+      std::cerr << "--output, --stream, --decode, --compact and --count-only "
+        "take a single input" << std::endl;
+      return 1;
+    }
+    std::unique_ptr<token_cache_t> cache;
+    if (cache_dir.size())
+      cache = std::make_unique<token_cache_t>(cache_dir, lexer_type, error_limit);
+    auto perf = use_perf ? open_perf() : nullptr;
+    return batch_main(inputs, lexer_type, lexer, nthreads, niter, use_mmap,
+      intern, error_limit, cache.get(), perf.get());
+  }
+
   // Get IO
   std::cout << "Processing: " << filename << std::endl;
 
   std::ifstream infile(filename);
-  if (!infile.good()) {
+  if (filename != "-" && !infile.good()) {
     std::cerr << "File not found '" << filename << "'" << std::endl;
     return 1;
   }
 
-  auto is = make_stream(infile, filename);
+  if (streaming) {
+    auto lexer = range_lexer(lexer_type);
+    if (!lexer || lexer_type == "re2c") {
+      std::cerr << "The " << lexer_type << " lexer can not stream" << std::endl;
+      return 1;
+    }
+    // standard input can only be read once
+    if (filename == "-") niter = 1;
+
+    lexed_t res;
+    auto err = stream_main(filename, lexer_type, lexer, window_size, error_limit, niter,
+      output_file.size() || intern || decode, intern, decode, res);
+
+    std::unique_ptr<thread_pool_t> pool;
+    if (nthreads > 1) pool = std::make_unique<thread_pool_t>(nthreads);
+    if (output_file.size() && !write_output(output_file, res, format, pool.get()))
+      return 1;
+    return err;
+  }
+
+  auto load_start = std::chrono::high_resolution_clock::now();
+  auto is = use_mmap ? map_stream(filename) : make_stream(infile, filename);
+  auto load_end = std::chrono::high_resolution_clock::now();
+  std::chrono::duration<double, std::milli> load_duration = load_end - load_start;
+  std::cout << "Load Elapsed: " << load_duration.count() << " ms";
+  std::cout << (use_mmap ? " (mmap)" : " (copy)") << std::endl;
+
+  if (calibration) {
+    auto profile = profile_input(is);
+    lexer_type = calibration->pick(profile, "fsm");
+    std::cout << "Profile:";
+#define PROFILE_PRINT(name, str) std::cout << " " << str << " " << profile.name;
+    FOR_PROFILE_DENSITIES(PROFILE_PRINT)
+#undef PROFILE_PRINT
+    std::cout << " length " << profile.token_length << std::endl;
+    std::cout << "Auto: " << lexer_type << std::endl;
+  }
+
+  if (count_only)
+    return count_main(is, lexer_type, niter, error_limit);
+
+  // Reuse the tokens of a buffer that was lexed before.  The files keep no
+  // number values, so decoding always lexes.
+  std::unique_ptr<token_cache_t> cache;
+  uint64_t hash = 0;
+  if (cache_dir.size() && decode)
+    std::cout << "Not caching: --decode needs the values of the numbers" << std::endl;
+  else if (cache_dir.size()) {
+    cache = std::make_unique<token_cache_t>(cache_dir, lexer_type, error_limit);
+    hash = hash_buffer(is.buffer);
+    lexed_view_t view;
+    if (cache->find(is, hash, intern, view)) {
+      std::cout << "Cached: " << cache->path(hash, intern) << std::endl;
+      error_output() << view.errors;
+      std::cout << "Tokens: " << view.numTokens() << std::endl;
+      std::cout << "Lines: " << is.newlines.size() << std::endl;
+      if (intern)
+        std::cout << "Symbols: " << view.numSymbols() << std::endl;
+      std::unique_ptr<thread_pool_t> pool;
+      if (nthreads > 1) pool = std::make_unique<thread_pool_t>(nthreads);
+      if (output_file.size() && !write_output(output_file, view, format, pool.get()))
+        return 1;
+      return view.err;
+    }
+  }
+
+  // Process, opening the counters before the pool so they follow its threads
+  auto perf = use_perf ? open_perf() : nullptr;
+
+  auto lexer = range_lexer(lexer_type);
+  std::unique_ptr<thread_pool_t> pool;
+  if (nthreads > 1) pool = std::make_unique<thread_pool_t>(nthreads);
 
-  // Process
-  auto table = make_fsm_table();
   auto start = std::chrono::high_resolution_clock::now();
     
-  std::unique_ptr<lexed_t> res;
-  int err = 0;
+  // the tokens are kept in an arena, reserved for the input once and reset
+  // for each iteration, so the later ones allocate nothing
+  std::pmr::monotonic_buffer_resource arena;
+  lexed_t res(&arena);
+  res.intern = intern;
+  res.decode = decode;
+  res.compact = compact;
+  res.reserve(is.buffer.size());
+
+  int err = 0, last_err = 0;
+  std::string errors;
   double elapsed = 0;
 
   for (int i=0; i<niter; ++i) {
   
     auto start = std::chrono::high_resolution_clock::now();
     
-    res = std::make_unique<lexed_t>();
+    res.reset();
+    res.diagnostics.limit = error_limit;
 
-    if (lexer_type == "hand") {
+    // the messages are kept for the cache
+    std::ostringstream errs;
+    auto redirect = cache ? std::make_unique<error_redirect_t>(errs) : nullptr;
+    last_err = err;
+
+    if (perf) perf->start();
+
+    if (lexer_type == "fsm-enum") {
+      std::cout << "... Lexing via FSM blocks on " << nthreads << " threads ... ";
+      err += fsm_enum_lex(is, res, pool.get());
+    }
+    else if (pool && lexer) {
+      std::cout << "... Lexing via " << lexer_type << " on " << nthreads << " threads ... ";
+      err += parallel_lex(is, res, lexer, *pool);
+    }
+    else if (lexer_type == "hand") {
       std::cout << "... Lexing via hand lexer ... ";
-      err += hand_lex(is, *res);
+      err += hand_lex(is, res);
+    }
+    else if (lexer_type == "hand-simd") {
+      std::cout << "... Lexing via hand lexer (" << simd_name(detect_simd()) << ") ... ";
+      err += hand_simd_lex(is, res);
     }
     else if (lexer_type == "fsm" ) {
       std::cout << "... Lexing via FSM ... ";
-      err += fsm_lex(is, table, *res);
+      err += fsm_lex(is, res);
+    }
+    else if (lexer_type == "fsm-gen" ) {
+      std::cout << "... Lexing via generated FSM ... ";
+      err += fsm_gen_lex(is, res);
     }
 #ifdef HAVE_RE2C
     else if (lexer_type == "re2c" ) {
       std::cout << "... Lexing via re2c ... ";
-      err += re2c_lex(is, *res);
+      err += re2c_lex(is, res);
     }
 #endif
     else {
@@ -116,26 +735,41 @@ int main(int argc, char* argv[]) {
       return -1;
     }
 
+    if (perf) perf->stop();
     auto end = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double, std::milli> duration = end - start;
     elapsed += duration.count();
     std::cout << duration.count() << " ms" << std::endl;
 
+    last_err = err - last_err;
+    if (redirect) {
+      redirect.reset();
+      errors = errs.str();
+      error_output() << errors;
+    }
   }
 
+  if (cache && !cache->store(is, hash, res, last_err, errors))
+    std::cerr << "Could not write to the cache '" << cache_dir << "'" << std::endl;
+
   auto end = std::chrono::high_resolution_clock::now();
   std::chrono::duration<double, std::milli> duration = end - start;
 
   std::cout << "Avg Elapsed: " << duration.count()/niter << " ms" << std::endl;
-  std::cout << "Tokens: " << res->numTokens() << std::endl;
+  std::cout << "Tokens: " << res.numTokens() << std::endl;
   std::cout << "Lines: " << is.newlines.size() << std::endl;
+  if (intern)
+    std::cout << "Symbols: " << res.numSymbols() << std::endl;
+  if (compact)
+    std::cout << "Position bytes: " << res.compact_pos.bytes() << std::endl;
+  if (decode)
+    print_numbers(res);
+  if (perf)
+    print_perf(*perf, niter, is.buffer.size(), res.numTokens());
   
   // output
-  if (output_file.size()) {
-    std::cout << "Writing To: " << output_file << std::endl;
-    std::ofstream out(output_file);
-    print(out, *res);
-  }
+  if (output_file.size() && !write_output(output_file, res, format, pool.get()))
+    return 1;
 
   return err;
 }
@@ -0,0 +1,513 @@
+#include <errors.hpp>
+#include <fsm_tables.hpp>
+#include <keywords.hpp>
+#include <lex.hpp>
+#include <stream.hpp>
+#include <utils.hpp>
+
+#include <map>
+#include <memory_resource>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+using namespace lex;
+
+//==============================================================================
+// Generated inputs
+//==============================================================================
+
+#define FOR_MIXES(DO) \
+  DO(ident) \
+  DO(numeric) \
+  DO(comment) \
+  DO(keyword) \
+  DO(error)
+
+enum mix_t {
+#define MIX_ENUM(name) mix_##name,
+  FOR_MIXES(MIX_ENUM)
+#undef MIX_ENUM
+};
+
+static const char * mix_names[] = {
+#define MIX_NAME(name) #name,
+  FOR_MIXES(MIX_NAME)
+#undef MIX_NAME
+};
+
+//---------------------------------------------------------------------------
+/// Ten or so tokens per line, mostly of one kind
+static std::string generate(mix_t mix, int lines)
+{
+  std::mt19937 gen(lines);
+  auto pick = [&](int n) { return std::uniform_int_distribution<int>(0, n-1)(gen); };
+  static const char * ops[] = {"+", "-", "*", "/", "=", "==", "!=", "<=", "(", ")", ",", ";"};
+
+  std::ostringstream os;
+  for (int l=0; l<lines; ++l) {
+    switch (mix) {
+    case mix_ident:
+      for (int t=0; t<5; ++t)
+        os << "var" << pick(1000) << " " << ops[pick(12)] << " ";
+      break;
+    case mix_numeric:
+      os << pick(100000) << " " << pick(1000) << "." << pick(1000) << " 0x"
+         << std::hex << pick(65536) << std::dec << " 0" << std::oct << pick(512)
+         << std::dec << " " << pick(100) << "e" << pick(20) << " + "
+         << pick(10) << " * " << pick(100) << ".5 ,";
+      break;
+    case mix_comment:
+      if (l % 3 == 0)
+        os << "x = \"a quoted string that goes on for a while\"";
+      else if (l % 3 == 1)
+        os << "\"one that spans\nlines\" # and a comment after it";
+      else
+        os << "# a whole line of comment text, with \"quotes\" and 1.2.3";
+      break;
+    case mix_keyword: {
+      static const char * words[] = {"if", "else", "while", "for", "fn",
+        "return", "let", "true", "iffy", "format", "letter", "x"};
+      for (int t=0; t<5; ++t)
+        os << words[pick(12)] << " " << ops[pick(12)] << " ";
+      break;
+    }
+    case mix_error:
+      os << "1.2.3 a" << pick(100) << " 0120x12 b = 1x14 + 0x ; 4..5 c";
+      break;
+    }
+    os << "\n";
+  }
+  return os.str();
+}
+
+//---------------------------------------------------------------------------
+static stream_t & corpus(mix_t mix, int lines)
+{
+  static std::map<std::pair<int,int>, stream_t> cache;
+  auto key = std::make_pair(int(mix), lines);
+  auto it = cache.find(key);
+  if (it == cache.end()) {
+    std::istringstream ss(generate(mix, lines));
+    it = cache.emplace(key, lex::make_stream(ss, mix_names[mix])).first;
+  }
+  return it->second;
+}
+
+/// Discards the error messages
+static std::ostream & null_output()
+{
+  static std::ostream os(nullptr);
+  return os;
+}
+
+//==============================================================================
+// Lexers
+//==============================================================================
+
+using lexer_t = int(*)(stream_t &, lexed_t &);
+
+static const std::vector<std::pair<const char *, lexer_t>> lexers = {
+  {"hand",      [](auto & is, auto & lx) { return hand_lex(is, lx); }},
+  {"hand-simd", [](auto & is, auto & lx) { return hand_simd_lex(is, lx); }},
+  {"fsm",       [](auto & is, auto & lx) { return fsm_lex(is, lx); }},
+  {"fsm-gen",   [](auto & is, auto & lx) { return fsm_gen_lex(is, lx); }},
+  {"fsm-enum",  [](auto & is, auto & lx) { return fsm_enum_lex(is, lx); }},
+#ifdef HAVE_RE2C
+  {"re2c",      [](auto & is, auto & lx) { return re2c_lex(is, lx); }},
+#endif
+};
+
+/// The same lexers only counting their tokens
+using count_lexer_t = int(*)(stream_t &, count_sink_t &);
+
+static const std::vector<std::pair<const char *, count_lexer_t>> counters = {
+  {"hand",      [](auto & is, auto & sink) { return hand_lex(is, sink); }},
+  {"hand-simd", [](auto & is, auto & sink) { return hand_simd_lex(is, sink); }},
+  {"fsm",       [](auto & is, auto & sink) { return fsm_lex(is, sink); }},
+  {"fsm-gen",   [](auto & is, auto & sink) { return fsm_gen_lex(is, sink); }},
+#ifdef HAVE_RE2C
+  {"re2c",      [](auto & is, auto & sink) { return re2c_lex(is, sink); }},
+#endif
+};
+
+//---------------------------------------------------------------------------
+static void lex_input(benchmark::State & state, lexer_t lexer, mix_t mix)
+{
+  auto & is = corpus(mix, state.range(0));
+  error_redirect_t redirect(null_output());
+  size_t ntoks = 0;
+
+  for (auto _ : state) {
+    lexed_t lx;
+    lexer(is, lx);
+    ntoks = lx.numTokens();
+    benchmark::DoNotOptimize(lx.tokens.data());
+  }
+
+  state.SetBytesProcessed(state.iterations() * is.buffer.size());
+  state.SetItemsProcessed(state.iterations() * ntoks);
+  state.counters["tokens"] = ntoks;
+}
+
+//---------------------------------------------------------------------------
+/// The same, into one lexed_t in an arena that is reserved once and reset
+static void lex_reuse(benchmark::State & state, lexer_t lexer, mix_t mix)
+{
+  auto & is = corpus(mix, state.range(0));
+  error_redirect_t redirect(null_output());
+
+  std::pmr::monotonic_buffer_resource arena;
+  lexed_t lx(&arena);
+  lx.reserve(is.buffer.size());
+
+  for (auto _ : state) {
+    lx.reset();
+    lexer(is, lx);
+    benchmark::DoNotOptimize(lx.tokens.data());
+  }
+
+  state.SetBytesProcessed(state.iterations() * is.buffer.size());
+  state.SetItemsProcessed(state.iterations() * lx.numTokens());
+  state.counters["tokens"] = lx.numTokens();
+}
+
+//---------------------------------------------------------------------------
+/// Counting the tokens, with nothing kept
+static void lex_count(benchmark::State & state, count_lexer_t lexer, mix_t mix)
+{
+  auto & is = corpus(mix, state.range(0));
+  error_redirect_t redirect(null_output());
+  count_sink_t counts;
+
+  for (auto _ : state) {
+    counts = count_sink_t();
+    lexer(is, counts);
+    benchmark::DoNotOptimize(counts.tokens);
+  }
+
+  state.SetBytesProcessed(state.iterations() * is.buffer.size());
+  state.SetItemsProcessed(state.iterations() * counts.tokens);
+  state.counters["tokens"] = counts.tokens;
+}
+
+//---------------------------------------------------------------------------
+/// The keyword mix, or the same text with each keyword changed to an
+/// identifier of the same length, so that the difference between the two is
+/// what a lexer spends on recognising keywords: a hash probe for hand and
+/// fsm, literal rules folded into the DFA for re2c.
+static stream_t & keyword_corpus(bool disguised, int lines)
+{
+  static std::map<int, stream_t> cache;
+  auto & is = corpus(mix_keyword, lines);
+  if (!disguised) return is;
+
+  auto it = cache.find(lines);
+  if (it == cache.end()) {
+    lexed_t lx;
+    hand_lex(is, lx);
+    std::string text(is.buffer);
+    for (size_t i=0; i<lx.numTokens(); ++i) {
+      if (!is_keyword(lx.tokens[i])) continue;
+      auto pos = lx.token_pos[i];
+      do ++text[pos.begin];
+      while (lex::keyword_kind(text.data() + pos.begin, pos.end - pos.begin) != LEX_IDENT);
+    }
+    std::istringstream ss(text);
+    it = cache.emplace(lines, lex::make_stream(ss, "disguised")).first;
+  }
+  return it->second;
+}
+
+static void keywords(benchmark::State & state, lexer_t lexer, bool disguised)
+{
+  auto & is = keyword_corpus(disguised, state.range(0));
+  error_redirect_t redirect(null_output());
+
+  std::pmr::monotonic_buffer_resource arena;
+  lexed_t lx(&arena);
+  lx.reserve(is.buffer.size());
+
+  for (auto _ : state) {
+    lx.reset();
+    lexer(is, lx);
+    benchmark::DoNotOptimize(lx.tokens.data());
+  }
+
+  size_t nkeywords = 0;
+  for (auto tok : lx.tokens) nkeywords += is_keyword(tok);
+  state.SetBytesProcessed(state.iterations() * is.buffer.size());
+  state.SetItemsProcessed(state.iterations() * lx.numTokens());
+  state.counters["keywords"] = nkeywords;
+}
+
+//==============================================================================
+/// The FSM lexer with each layout of its table, named fsm/<layout>/<mix>
+//==============================================================================
+
+#define FOR_FSM_LAYOUTS(DO) \
+  DO(table) \
+  DO(fixed) \
+  DO(dense8) \
+  DO(comb)
+
+enum layout_t {
+#define LAYOUT_ENUM(name) layout_##name,
+  FOR_FSM_LAYOUTS(LAYOUT_ENUM)
+#undef LAYOUT_ENUM
+};
+
+static const char * layout_names[] = {
+#define LAYOUT_NAME(name) #name,
+  FOR_FSM_LAYOUTS(LAYOUT_NAME)
+#undef LAYOUT_NAME
+};
+
+static void fsm_layout(benchmark::State & state, layout_t layout, mix_t mix)
+{
+  auto & is = corpus(mix, state.range(0));
+  error_redirect_t redirect(null_output());
+
+  // compiled with a sample of its own mix
+  static const auto table = make_fsm_table();
+  auto fsm = compile_fsm(table, std::string_view(is.buffer).substr(0, 1 << 16));
+  fsm_dense_t<uint8_t> dense(fsm);
+  fsm_comb_t comb(fsm);
+
+  size_t bytes = 0, padded = 1;
+  while (padded < size_t(table.cols)) padded *= 2;
+  switch (layout) {
+  case layout_table:  bytes = table.table.size() * sizeof(int); break;
+  case layout_fixed:  bytes = table.rows * padded; break;
+  case layout_dense8: bytes = dense.bytes(); break;
+  case layout_comb:   bytes = comb.bytes(); break;
+  }
+
+  for (auto _ : state) {
+    lexed_t lx;
+    switch (layout) {
+    case layout_table:  fsm_lex(is, table, lx); break;
+    case layout_fixed:  fsm_lex(is, lx); break;
+    case layout_dense8: fsm_lex(is, fsm, dense, lx); break;
+    case layout_comb:   fsm_lex(is, fsm, comb, lx); break;
+    }
+    benchmark::DoNotOptimize(lx.tokens.data());
+  }
+
+  state.SetBytesProcessed(state.iterations() * is.buffer.size());
+  state.counters["table_bytes"] = bytes;
+  state.counters["states"] = fsm.num_states;
+  state.counters["classes"] = fsm.num_classes;
+}
+
+//==============================================================================
+// Components
+//==============================================================================
+
+static void make_stream(benchmark::State & state)
+{
+  auto & is = corpus(mix_ident, state.range(0));
+  std::string str(is.buffer);
+  for (auto _ : state) {
+    std::istringstream ss(str);
+    auto strm = lex::make_stream(ss);
+    benchmark::DoNotOptimize(strm.buffer.data());
+  }
+  state.SetBytesProcessed(state.iterations() * str.size());
+}
+BENCHMARK(make_stream)->Arg(1000)->Arg(10000)->Arg(100000);
+
+static void newline_positions(benchmark::State & state)
+{
+  auto & is = corpus(mix_ident, state.range(0));
+  for (auto _ : state) {
+    auto lines = lex::newline_positions(is.buffer);
+    benchmark::DoNotOptimize(lines.data());
+  }
+  state.SetBytesProcessed(state.iterations() * is.buffer.size());
+}
+BENCHMARK(newline_positions)->Arg(1000)->Arg(10000)->Arg(100000);
+
+static void char_to_class(benchmark::State & state)
+{
+  auto & is = corpus(mix_ident, state.range(0));
+  for (auto _ : state) {
+    int sum = 0;
+    for (auto c : is.buffer) sum += lex::char_to_class(c);
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetBytesProcessed(state.iterations() * is.buffer.size());
+}
+BENCHMARK(char_to_class)->Arg(1000)->Arg(10000)->Arg(100000);
+
+static void decode(benchmark::State & state)
+{
+  auto & is = corpus(mix_numeric, state.range(0));
+  error_redirect_t redirect(null_output());
+  for (auto _ : state) {
+    lexed_t lx;
+    lx.decode = true;
+    fsm_lex(is, lx);
+    benchmark::DoNotOptimize(lx.identifier_values.data());
+  }
+  state.SetBytesProcessed(state.iterations() * is.buffer.size());
+}
+BENCHMARK(decode)->Arg(1000)->Arg(10000)->Arg(100000)
+  ->Unit(benchmark::kMillisecond);
+
+static void keyword_kind(benchmark::State & state)
+{
+  auto & is = corpus(mix_keyword, state.range(0));
+  lexed_t lx;
+  hand_lex(is, lx);
+  for (auto _ : state) {
+    int sum = 0;
+    for (auto & pos : lx.token_pos)
+      sum += lex::keyword_kind(is.buffer.data() + pos.begin, pos.end - pos.begin);
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * lx.numTokens());
+}
+BENCHMARK(keyword_kind)->Arg(1000)->Arg(10000)->Arg(100000);
+
+//---------------------------------------------------------------------------
+/// Lexing into, and walking, whole or compact positions
+static void positions(benchmark::State & state, bool compact, bool walk)
+{
+  auto & is = corpus(mix_ident, state.range(0));
+  lexed_t lx;
+  lx.compact = compact;
+  hand_lex(is, lx);
+
+  for (auto _ : state) {
+    if (walk) {
+      size_t sum = 0;
+      for (size_t i=0; i<lx.numTokens(); ++i) sum += lx.tokenPos(i).end;
+      benchmark::DoNotOptimize(sum);
+    }
+    else {
+      lx.reset();
+      hand_lex(is, lx);
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * lx.numTokens());
+  state.counters["bytes_per_token"] = double(compact ?
+    lx.compact_pos.bytes() : lx.token_pos.size()*sizeof(stream_pos_t)) / lx.numTokens();
+}
+BENCHMARK_CAPTURE(positions, lex_whole, false, false)->Arg(100000)
+  ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(positions, lex_compact, true, false)->Arg(100000)
+  ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(positions, walk_whole, false, true)->Arg(100000)->Arg(1000000)
+  ->Unit(benchmark::kMillisecond);
+BENCHMARK_CAPTURE(positions, walk_compact, true, true)->Arg(100000)->Arg(1000000)
+  ->Unit(benchmark::kMillisecond);
+
+//---------------------------------------------------------------------------
+/// Typing a character somewhere in the input and deleting it again, with
+/// relex on one lexed_t or on an edit_buffer_t, as the input grows
+static void edit(benchmark::State & state, bool pieces, bool compact)
+{
+  auto & input = corpus(mix_ident, state.range(0));
+  error_redirect_t redirect(null_output());
+  auto is = input;
+  lexed_t lx;
+  lx.compact = compact;
+  hand_lex(is, lx);
+  edit_buffer_t buf(is, lx, relex<hand_cursor_t>);
+
+  std::mt19937 gen(0);
+  for (auto _ : state) {
+    auto pos = std::uniform_int_distribution<size_t>(0, is.buffer.size())(gen);
+    if (pieces) {
+      buf.edit({pos, pos, "x"});
+      buf.edit({pos, pos+1, ""});
+    }
+    else {
+      relex<hand_cursor_t>(is, lx, {pos, pos, "x"});
+      relex<hand_cursor_t>(is, lx, {pos, pos+1, ""});
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * 2);
+  state.counters["pieces"] = buf.pieces.size();
+}
+BENCHMARK_CAPTURE(edit, relex, false, false)->Arg(10000)->Arg(100000)->Arg(1000000)
+  ->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(edit, relex_compact, false, true)->Arg(10000)->Arg(100000)->Arg(1000000)
+  ->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(edit, buffer, true, false)->Arg(10000)->Arg(100000)->Arg(1000000)
+  ->Unit(benchmark::kMicrosecond);
+
+static void print(benchmark::State & state)
+{
+  auto & is = corpus(mix_ident, state.range(0));
+  lexed_t lx;
+  hand_lex(is, lx);
+  for (auto _ : state) {
+    std::ostringstream os;
+    lex::print(os, lx);
+    benchmark::DoNotOptimize(os.tellp());
+  }
+  state.SetItemsProcessed(state.iterations() * lx.numTokens());
+}
+BENCHMARK(print)->Arg(1000)->Arg(10000)->Arg(100000)
+  ->Unit(benchmark::kMillisecond);
+
+//==============================================================================
+/// Every lexer is run on every mix, named lex/<lexer>/<mix>/<lines>, and so
+/// is every layout of the FSM table.  keywords/<lexer>/{real,disguised}
+/// compares the keyword hash against re2c's own keyword rules.
+//==============================================================================
+int main(int argc, char ** argv)
+{
+  for (auto & [name, lexer] : lexers)
+    for (int mix=0; mix<int(std::size(mix_names)); ++mix) {
+      auto label = std::string("lex/") + name + "/" + mix_names[mix];
+      benchmark::RegisterBenchmark(label.c_str(), lex_input, lexer, mix_t(mix))
+        ->Arg(1000)->Arg(10000)->Arg(100000)
+        ->Unit(benchmark::kMillisecond);
+    }
+
+  for (auto & [name, lexer] : lexers)
+    for (int mix=0; mix<int(std::size(mix_names)); ++mix) {
+      auto label = std::string("reuse/") + name + "/" + mix_names[mix];
+      benchmark::RegisterBenchmark(label.c_str(), lex_reuse, lexer, mix_t(mix))
+        ->Arg(100000)
+        ->Unit(benchmark::kMillisecond);
+    }
+
+  for (auto & [name, lexer] : counters)
+    for (int mix=0; mix<int(std::size(mix_names)); ++mix) {
+      auto label = std::string("count/") + name + "/" + mix_names[mix];
+      benchmark::RegisterBenchmark(label.c_str(), lex_count, lexer, mix_t(mix))
+        ->Arg(100000)
+        ->Unit(benchmark::kMillisecond);
+    }
+
+  for (auto & [name, lexer] : lexers)
+    for (bool disguised : {false, true}) {
+      auto label = std::string("keywords/") + name + (disguised ? "/disguised" : "/real");
+      benchmark::RegisterBenchmark(label.c_str(), keywords, lexer, disguised)
+        ->Arg(100000)
+        ->Unit(benchmark::kMillisecond);
+    }
+
+  for (int layout=0; layout<int(std::size(layout_names)); ++layout)
+    for (int mix=0; mix<int(std::size(mix_names)); ++mix) {
+      auto label = std::string("fsm/") + layout_names[layout] + "/" + mix_names[mix];
+      benchmark::RegisterBenchmark(label.c_str(), fsm_layout, layout_t(layout), mix_t(mix))
+        ->Arg(100000)
+        ->Unit(benchmark::kMillisecond);
+    }
+
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+  return 0;
+}
@@ -0,0 +1,71 @@
+#include <lex.hpp>
+#include <stream.hpp>
+
+#include <algorithm>
+#include <fstream>
+
+#include <benchmark/benchmark.h>
+
+using namespace lex;
+
+//---------------------------------------------------------------------------
+static const lexed_t & corpus()
+{
+  static lexed_t res = []() {
+    std::ifstream infile(DATA_DIR "fake_program_10k.txt");
+    auto is = make_stream(infile);
+    lexed_t lx;
+    hand_lex(is, lx);
+    return lx;
+  }();
+  return res;
+}
+
+//---------------------------------------------------------------------------
+/// The binary search over identifier_tokens that findIdentifier used to do
+static int search_identifier(const lexed_t & lx, int tok)
+{
+  auto & ids = lx.identifier_tokens;
+  auto it = std::lower_bound(ids.begin(), ids.end(), tok);
+  if (it != ids.end() && (*it == tok))
+    return std::distance(ids.begin(), it);
+  return -1;
+}
+
+//=============================================================================
+// Walk the whole stream, fetching the string of every token
+//=============================================================================
+
+static void iterate_search(benchmark::State & state)
+{
+  auto & lx = corpus();
+  int n = lx.numTokens();
+  for (auto _ : state) {
+    size_t len = 0;
+    for (int i=0; i<n; ++i) {
+      auto id = search_identifier(lx, i);
+      len += lx.getIdentifierString(id).size();
+    }
+    benchmark::DoNotOptimize(len);
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(iterate_search);
+
+static void iterate_rank(benchmark::State & state)
+{
+  auto & lx = corpus();
+  int n = lx.numTokens();
+  for (auto _ : state) {
+    size_t len = 0;
+    for (int i=0; i<n; ++i) {
+      auto id = lx.findIdentifier(i);
+      len += lx.getIdentifierString(id).size();
+    }
+    benchmark::DoNotOptimize(len);
+  }
+  state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(iterate_rank);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,252 @@
+#include "cache.hpp"
+#include "errors.hpp"
+#include "lex.hpp"
+#include "stream.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <numeric>
+
+namespace lex {
+
+namespace fs = std::filesystem;
+
+using steady_clock = std::chrono::steady_clock;
+
+//==============================================================================
+/// Add a file, or every file below a directory in name order.  A file whose
+/// size can not be read is reported and counted in unreadable, not added.
+//==============================================================================
+static bool add_input(
+  const fs::path & path,
+  std::vector<batch_file_t> & files,
+  int & unreadable)
+{
+  std::error_code ec;
+
+  if (fs::is_directory(path, ec)) {
+    std::vector<fs::path> found;
+    for (auto & entry : fs::recursive_directory_iterator(path, ec))
+      if (entry.is_regular_file(ec)) found.push_back(entry.path());
+    std::sort(found.begin(), found.end());
+    for (auto & p : found) add_input(p, files, unreadable);
+    return true;
+  }
+
+  if (!fs::is_regular_file(path, ec)) return false;
+
+  batch_file_t file;
+  file.name = path.string();
+  file.bytes = fs::file_size(path, ec);
+  if (ec) {
+    error_output() << "Could not read '" << file.name << "': " << ec.message()
+      << std::endl;
+    unreadable++;
+    return true;
+  }
+  files.emplace_back(std::move(file));
+  return true;
+}
+
+//==============================================================================
+/// Expand the paths given into files
+//==============================================================================
+int list_inputs(
+  const std::vector<std::string> & paths,
+  std::vector<batch_file_t> & files)
+{
+  int missing = 0, unreadable = 0;
+  auto not_found = [&](const std::string & path) {
+    error_output() << "File not found '" << path << "'" << std::endl;
+    missing++;
+  };
+
+  for (auto & path : paths) {
+    if (path.size() > 1 && path[0] == '@') {
+      std::ifstream list(path.substr(1));
+      if (!list) {
+        not_found(path.substr(1));
+        continue;
+      }
+      std::string line;
+      while (std::getline(list, line)) {
+        if (line.size() && line.back() == '\r') line.pop_back();
+        if (line.size() && !add_input(line, files, unreadable)) not_found(line);
+      }
+    }
+    else if (!add_input(path, files, unreadable)) {
+      not_found(path);
+    }
+  }
+
+  return missing + unreadable;
+}
+
+//==============================================================================
+/// Read or map a file of the batch
+//==============================================================================
+static stream_t load(const batch_file_t & file, bool use_mmap)
+{
+  if (use_mmap) return map_stream(file.name);
+  std::ifstream in(file.name);
+  return make_stream(in, file.name);
+}
+
+static double ms_since(steady_clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(steady_clock::now() - start).count();
+}
+
+//==============================================================================
+/// Lex a batch of files on the pool.
+///
+/// The largest files are queued first.  One is split when it is larger than
+/// what each thread has to do on average, since lexing its chunks both ways
+/// costs more than lexing it whole.  The remaining files are queued in order,
+/// as many to a task as fit in task_size.  The tasks are then balanced by the
+/// pool stealing them from each other.
+//==============================================================================
+int batch_lex(
+  std::vector<batch_file_t> & files,
+  const file_lexer_t & pick_lexer,
+  thread_pool_t & pool,
+  bool use_mmap,
+  bool intern,
+  size_t task_size,
+  const token_cache_t * cache,
+  size_t error_limit)
+{
+  size_t total = 0;
+  for (auto & f : files) total += f.bytes;
+  auto split_size = std::max(4*task_size, total / pool.size());
+
+  // decided up front, since the sizes are updated as the files are read
+  std::vector<bool> split(files.size());
+  for (size_t i=0; i<files.size(); ++i)
+    split[i] = pool.size() > 1 && files[i].bytes > split_size;
+
+  std::vector<std::string> errors(files.size());
+
+  // the files to split, largest first
+  std::vector<size_t> order(files.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+    [&](auto a, auto b) { return files[a].bytes > files[b].bytes; });
+
+  struct split_job_t {
+    steady_clock::time_point start;
+    stream_t stream;
+    lexed_t lx;
+    uint64_t hash = 0;
+  };
+
+  // take the tokens of a file from the cache, if they are there
+  auto from_cache = [&](
+    size_t i,
+    const stream_t & stream,
+    uint64_t hash,
+    steady_clock::time_point start)
+  {
+    lexed_view_t view;
+    if (!cache->find(stream, hash, intern, view)) return false;
+    auto & f = files[i];
+    f.err = view.err;
+    f.bytes = stream.buffer.size();
+    f.tokens = view.numTokens();
+    f.lines = stream.newlines.size();
+    f.ms = ms_since(start);
+    f.cached = true;
+    errors[i] = view.errors;
+    return true;
+  };
+
+  for (auto i : order) {
+    if (!split[i]) break;
+    pool.submit([&, i]() {
+      auto job = std::make_shared<split_job_t>();
+      job->start = steady_clock::now();
+      job->stream = load(files[i], use_mmap);
+      job->lx.intern = intern;
+      job->lx.diagnostics.limit = error_limit;
+      if (cache) {
+        job->hash = hash_buffer(job->stream.buffer);
+        if (from_cache(i, job->stream, job->hash, job->start)) return;
+      }
+      job->lx.reserve(job->stream.buffer.size());
+      parallel_lex(job->stream, job->lx, pick_lexer(job->stream), pool, task_size,
+        [&, i, job](int err, const std::string & errs) {
+          auto & f = files[i];
+          if (cache) cache->store(job->stream, job->hash, job->lx, err, errs);
+          f.err = err;
+          f.bytes = job->stream.buffer.size();
+          f.tokens = job->lx.numTokens();
+          f.lines = job->stream.newlines.size();
+          f.ms = ms_since(job->start);
+          f.cached = false;
+          errors[i] = errs;
+        });
+    });
+  }
+
+  // and the rest, grouped, into one lexed_t reset for each file
+  auto lex_group = [&](size_t first, size_t last) {
+    lexed_t lx;
+    lx.intern = intern;
+    lx.diagnostics.limit = error_limit;
+    lx.diagnostics.hold = true;
+
+    for (auto i=first; i<last; ++i) {
+      auto & f = files[i];
+      if (split[i]) continue;
+
+      auto start = steady_clock::now();
+      auto stream = load(f, use_mmap);
+      uint64_t hash = 0;
+      if (cache) {
+        hash = hash_buffer(stream.buffer);
+        if (from_cache(i, stream, hash, start)) continue;
+      }
+
+      lx.reset();
+      lx.reserve(stream.buffer.size());
+      size_t stop;
+      f.err = pick_lexer(stream)(stream, lx, 0, stream.buffer.size(), stop);
+      f.bytes = stream.buffer.size();
+      f.tokens = lx.numTokens();
+      f.lines = stream.newlines.size();
+      errors[i] = render_errors(stream, lx.diagnostics);
+      if (cache) cache->store(stream, hash, lx, f.err, errors[i]);
+      f.ms = ms_since(start);
+      f.cached = false;
+    }
+  };
+
+  size_t first = 0, bytes = 0;
+  for (size_t i=0; i<files.size(); ++i) {
+    if (split[i]) continue;
+    bytes += files[i].bytes;
+    if (bytes >= task_size) {
+      pool.submit([&lex_group, first, last=i+1]() { lex_group(first, last); });
+      first = i+1;
+      bytes = 0;
+    }
+  }
+  if (first < files.size())
+    pool.submit([&lex_group, first, last=files.size()]() { lex_group(first, last); });
+
+  pool.wait();
+
+  int err = 0;
+  auto & out = error_output();
+  for (size_t i=0; i<files.size(); ++i) {
+    err += files[i].err;
+    out << errors[i];
+  }
+  return err;
+}
+
+} // namespace
@@ -0,0 +1,379 @@
+#include "cache.hpp"
+#include "errors.hpp"
+#include "lex.hpp"
+#include "stream.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace lex {
+
+namespace fs = std::filesystem;
+
+static constexpr char lexed_file_magic[8] = {'L','E','X','T','O','K','S','\n'};
+static constexpr uint32_t lexed_byte_order = 0x01020304;
+
+//==============================================================================
+/// Where each array of a token file starts, and the size of the file
+//==============================================================================
+struct lexed_layout_t {
+  size_t tokens, token_pos;
+  size_t identifier_tokens, identifier_symbols, identifier_offsets;
+  size_t identifier_bits, identifier_rank;
+  size_t identifier_data, name, errors;
+  size_t size;
+};
+
+static lexed_layout_t layout(const lexed_file_header_t & h)
+{
+  auto nwords = (h.ntokens + 63) / 64;
+  auto nsymbols = (h.flags & 1) ? h.nidentifiers : 0;
+
+  lexed_layout_t l;
+  size_t at = sizeof(h);
+  auto place = [&](size_t & section, size_t bytes) {
+    section = at;
+    at = (at + bytes + 7) & ~size_t(7);
+  };
+
+  place(l.tokens, h.ntokens * sizeof(int));
+  place(l.token_pos, h.ntokens * sizeof(stream_pos_t));
+  place(l.identifier_tokens, h.nidentifiers * sizeof(int));
+  place(l.identifier_symbols, nsymbols * sizeof(int));
+  place(l.identifier_offsets, h.nsymbols * sizeof(int));
+  place(l.identifier_bits, nwords * sizeof(uint64_t));
+  place(l.identifier_rank, nwords * sizeof(int));
+  place(l.identifier_data, h.ndata);
+  place(l.name, h.nname);
+  place(l.errors, h.nerrors);
+  l.size = at;
+  return l;
+}
+
+//==============================================================================
+/// Four independent lanes of 64-bit multiply and rotate, folded together at
+/// the end
+//==============================================================================
+uint64_t hash_buffer(std::string_view buffer)
+{
+  constexpr uint64_t k0 = 0x9e3779b97f4a7c15ull;
+  constexpr uint64_t k1 = 0xbf58476d1ce4e5b9ull;
+  auto mix = [](uint64_t h, uint64_t w) {
+    h ^= w * k0;
+    return ((h << 31) | (h >> 33)) * k1;
+  };
+
+  auto p = buffer.data();
+  auto n = buffer.size();
+  uint64_t h[4] = {n, n ^ k0, n ^ k1, ~n};
+
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32)
+    for (int l=0; l<4; ++l) {
+      uint64_t w;
+      std::memcpy(&w, p + i + 8*l, 8);
+      h[l] = mix(h[l], w);
+    }
+
+  for (; i < n; i += 8) {
+    uint64_t w = 0;
+    std::memcpy(&w, p + i, std::min<size_t>(8, n - i));
+    h[0] = mix(h[0], w);
+  }
+
+  auto r = mix(mix(mix(h[0], h[1]), h[2]), h[3]);
+  r ^= r >> 33;
+  r *= 0xff51afd7ed558ccdull;
+  r ^= r >> 33;
+  return r;
+}
+
+//==============================================================================
+// Reading in place
+//==============================================================================
+std::string_view lexed_view_t::getIdentifierString(int i) const
+{
+  if (i<0 || size_t(i) >= numSymbols()) return {};
+  auto beg = i>0 ? identifier_offsets[i-1] : 0;
+  auto len = identifier_offsets[i] - beg;
+  return identifier_data.substr(beg, len);
+}
+
+lexed_t lexed_view_t::to_lexed() const
+{
+  lexed_t lx;
+  lx.intern = intern;
+
+  auto nt = numTokens(), ni = numIdentifiers(), ns = numSymbols();
+  auto nwords = (nt + 63) / 64;
+  lx.tokens.assign(tokens, tokens + nt);
+  lx.token_pos.assign(token_pos, token_pos + nt);
+  lx.identifier_tokens.assign(identifier_tokens, identifier_tokens + ni);
+  lx.identifier_offsets.assign(identifier_offsets, identifier_offsets + ns);
+  lx.identifier_bits.assign(identifier_bits, identifier_bits + nwords);
+  lx.identifier_rank.assign(identifier_rank, identifier_rank + nwords);
+  lx.identifier_data = identifier_data;
+  if (intern) {
+    lx.identifier_symbols.assign(identifier_symbols, identifier_symbols + ni);
+    lx.rehashSymbols();
+  }
+  return lx;
+}
+
+//==============================================================================
+/// Check that everything the view reads by index stays inside the file: the
+/// kinds and positions of the tokens, the identifier ranks, the symbol ids
+/// and the offsets into the identifier data
+//==============================================================================
+static bool check_lexed(const lexed_view_t & v)
+{
+  auto h = v.header;
+  auto nt = h->ntokens, ni = h->nidentifiers, ns = h->nsymbols;
+  if (ni > nt || ns > ni) return false;
+
+  for (size_t t=0; t<nt; ++t) {
+    auto pos = v.token_pos[t];
+    if (v.tokens[t] < 0 || v.tokens[t] >= _LEX_STATE_END_ ||
+        pos.begin > pos.end || pos.end > h->source_size)
+      return false;
+  }
+
+  size_t nids = 0;
+  for (size_t w=0; w<(nt + 63)/64; ++w) {
+    if (size_t(v.identifier_rank[w]) != nids) return false;
+    nids += __builtin_popcountll(v.identifier_bits[w]);
+  }
+  if (nids != ni) return false;
+
+  for (size_t i=0; i<ni; ++i) {
+    if (v.identifier_tokens[i] < 0 || size_t(v.identifier_tokens[i]) >= nt)
+      return false;
+    if (v.intern &&
+        (v.identifier_symbols[i] < 0 || size_t(v.identifier_symbols[i]) >= ns))
+      return false;
+  }
+
+  int last = 0;
+  for (size_t i=0; i<ns; ++i) {
+    if (v.identifier_offsets[i] < last) return false;
+    last = v.identifier_offsets[i];
+  }
+  return size_t(last) <= h->ndata;
+}
+
+//==============================================================================
+/// Map a token file and check that it is whole and consistent
+//==============================================================================
+bool map_lexed(const std::string & filename, lexed_view_t & view)
+{
+  view = lexed_view_t();
+
+  auto fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(lexed_file_header_t)) {
+    close(fd);
+    return false;
+  }
+
+  size_t size = st.st_size;
+  auto data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) return false;
+
+  auto base = static_cast<const char*>(data);
+  view.storage = std::shared_ptr<const char>(base,
+    [size](const char * p) { munmap(const_cast<char*>(p), size); });
+
+  // no count can exceed the bytes of the file, which keeps the layout from
+  // overflowing, so the sections all lie inside it when the sizes agree
+  auto h = reinterpret_cast<const lexed_file_header_t*>(base);
+  if (std::memcmp(h->magic, lexed_file_magic, sizeof(h->magic)) ||
+      h->version != lexed_file_version ||
+      h->byte_order != lexed_byte_order ||
+      h->ntokens > size || h->nidentifiers > size || h->nsymbols > size ||
+      h->ndata > size || h->nname > size || h->nerrors > size ||
+      layout(*h).size != size)
+  {
+    view = lexed_view_t();
+    return false;
+  }
+
+  auto l = layout(*h);
+  auto at = [&](size_t offset) { return base + offset; };
+
+  view.header = h;
+  view.intern = h->flags & 1;
+  view.err = h->err;
+  view.tokens = reinterpret_cast<const int*>(at(l.tokens));
+  view.token_pos = reinterpret_cast<const stream_pos_t*>(at(l.token_pos));
+  view.identifier_tokens = reinterpret_cast<const int*>(at(l.identifier_tokens));
+  view.identifier_symbols = reinterpret_cast<const int*>(at(l.identifier_symbols));
+  view.identifier_offsets = reinterpret_cast<const int*>(at(l.identifier_offsets));
+  view.identifier_bits = reinterpret_cast<const uint64_t*>(at(l.identifier_bits));
+  view.identifier_rank = reinterpret_cast<const int*>(at(l.identifier_rank));
+  view.identifier_data = std::string_view(at(l.identifier_data), h->ndata);
+  view.name = std::string_view(at(l.name), h->nname);
+  view.errors = std::string_view(at(l.errors), h->nerrors);
+
+  if (!check_lexed(view)) {
+    view = lexed_view_t();
+    return false;
+  }
+  return true;
+}
+
+//==============================================================================
+/// Write a token file with a known source hash
+//==============================================================================
+static bool write_lexed(
+  const std::string & filename,
+  const stream_t & stream,
+  uint64_t hash,
+  const lexed_t & lx,
+  int err,
+  std::string_view errors)
+{
+  lexed_file_header_t h;
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, lexed_file_magic, sizeof(h.magic));
+  h.version = lexed_file_version;
+  h.byte_order = lexed_byte_order;
+  h.flags = lx.intern ? 1 : 0;
+  h.err = err;
+  h.source_hash = hash;
+  h.source_size = stream.buffer.size();
+  h.ntokens = lx.numTokens();
+  h.nidentifiers = lx.numIdentifiers();
+  h.nsymbols = lx.numSymbols();
+  h.ndata = lx.identifier_data.size();
+  h.nname = stream.name.size();
+  h.nerrors = errors.size();
+
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  if (!out) return false;
+
+  auto l = layout(h);
+  size_t at = 0;
+  auto put = [&](size_t offset, const void * data, size_t bytes) {
+    static const char zeros[8] = {};
+    out.write(zeros, offset - at);
+    out.write(static_cast<const char*>(data), bytes);
+    at = offset + bytes;
+  };
+
+  // the file keeps whole positions
+  const stream_pos_t * token_pos = lx.token_pos.data();
+  std::vector<stream_pos_t> positions;
+  if (lx.compact) {
+    positions.resize(h.ntokens);
+    for (size_t t=0; t<h.ntokens; ++t) positions[t] = lx.tokenPos(t);
+    token_pos = positions.data();
+  }
+
+  auto nwords = (h.ntokens + 63) / 64;
+  put(0, &h, sizeof(h));
+  put(l.tokens, lx.tokens.data(), h.ntokens * sizeof(int));
+  put(l.token_pos, token_pos, h.ntokens * sizeof(stream_pos_t));
+  put(l.identifier_tokens, lx.identifier_tokens.data(), h.nidentifiers * sizeof(int));
+  if (lx.intern)
+    put(l.identifier_symbols, lx.identifier_symbols.data(), h.nidentifiers * sizeof(int));
+  put(l.identifier_offsets, lx.identifier_offsets.data(), h.nsymbols * sizeof(int));
+  put(l.identifier_bits, lx.identifier_bits.data(), nwords * sizeof(uint64_t));
+  put(l.identifier_rank, lx.identifier_rank.data(), nwords * sizeof(int));
+  put(l.identifier_data, lx.identifier_data.data(), h.ndata);
+  put(l.name, stream.name.data(), h.nname);
+  put(l.errors, errors.data(), h.nerrors);
+  put(l.size, nullptr, 0);
+
+  return bool(out);
+}
+
+bool write_lexed(
+  const std::string & filename,
+  const stream_t & stream,
+  const lexed_t & lx,
+  int err,
+  std::string_view errors)
+{
+  return write_lexed(filename, stream, hash_buffer(stream.buffer), lx, err, errors);
+}
+
+//==============================================================================
+// The cache
+//==============================================================================
+token_cache_t::token_cache_t(
+  const std::string & dir,
+  const std::string & engine,
+  size_t error_limit) :
+  dir(dir), engine(engine), error_limit(error_limit)
+{
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+}
+
+std::string token_cache_t::path(uint64_t hash, bool intern) const
+{
+  std::ostringstream os;
+  os << std::hex << std::setw(16) << std::setfill('0') << hash
+    << "-" << engine << (intern ? "-intern" : "");
+  if (error_limit != no_error_limit) os << std::dec << "-max" << error_limit;
+  os << ".lxt";
+  return (fs::path(dir) / os.str()).string();
+}
+
+bool token_cache_t::find(
+  const stream_t & stream,
+  uint64_t hash,
+  bool intern,
+  lexed_view_t & view) const
+{
+  if (!map_lexed(path(hash, intern), view)) return false;
+
+  // a hash collision, or messages that name another file
+  auto h = view.header;
+  if (h->source_hash != hash || h->source_size != stream.buffer.size() ||
+      view.intern != intern || (view.err && view.name != stream.name))
+  {
+    view = lexed_view_t();
+    return false;
+  }
+  return true;
+}
+
+bool token_cache_t::store(
+  const stream_t & stream,
+  uint64_t hash,
+  const lexed_t & lx,
+  int err,
+  std::string_view errors) const
+{
+  // written aside and renamed, so a reader never sees half a file
+  auto final = path(hash, lx.intern);
+  std::ostringstream tmp;
+  tmp << final << "." << getpid() << "."
+    << std::hash<std::thread::id>()(std::this_thread::get_id()) << ".tmp";
+
+  if (!write_lexed(tmp.str(), stream, hash, lx, err, errors)) {
+    std::error_code ec;
+    fs::remove(tmp.str(), ec);
+    return false;
+  }
+
+  std::error_code ec;
+  fs::rename(tmp.str(), final, ec);
+  return !ec;
+}
+
+} // namespace
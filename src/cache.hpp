@@ -0,0 +1,157 @@
+#ifndef CONTRA_CACHE_HPP
+#define CONTRA_CACHE_HPP
+
+#include "errors.hpp"
+#include "lex.hpp"
+#include "stream.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace lex {
+
+//==============================================================================
+/// The binary token file.  A header is followed by the arrays of a lexed_t,
+/// each 8-byte aligned, in the order of lexed_layout_t: the token kinds,
+/// their positions, the identifier tokens, symbols (when interning), offsets,
+/// bits and ranks, then the identifier data, the name of the stream and the
+/// error messages lexing it produced.  The file is in the byte order of the
+/// machine that wrote it and is rejected by any other.
+//==============================================================================
+
+/// Bumped whenever the layout or the meaning of the token kinds changes
+constexpr uint32_t lexed_file_version = 2;
+
+struct lexed_file_header_t {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t flags;
+  int32_t err;
+  uint64_t source_hash;
+  uint64_t source_size;
+  uint64_t ntokens;
+  uint64_t nidentifiers;
+  uint64_t nsymbols;
+  uint64_t ndata;
+  uint64_t nname;
+  uint64_t nerrors;
+};
+
+/// A hash of the contents of a buffer that is the same on every run
+uint64_t hash_buffer(std::string_view buffer);
+
+//==============================================================================
+/// A token file mapped into memory and read in place
+//==============================================================================
+struct lexed_view_t {
+
+  /// Keeps the mapping alive
+  std::shared_ptr<const char> storage;
+  const lexed_file_header_t * header = nullptr;
+
+  bool intern = false;
+  const int * tokens = nullptr;
+  const stream_pos_t * token_pos = nullptr;
+  const int * identifier_tokens = nullptr;
+  const int * identifier_symbols = nullptr;
+  const int * identifier_offsets = nullptr;
+  const uint64_t * identifier_bits = nullptr;
+  const int * identifier_rank = nullptr;
+  std::string_view identifier_data;
+
+  /// What lexing the stream reported
+  std::string_view name;
+  std::string_view errors;
+  int err = 0;
+
+  size_t numTokens() const { return header ? header->ntokens : 0; }
+  size_t numIdentifiers() const { return header ? header->nidentifiers : 0; }
+  size_t numSymbols() const { return header ? header->nsymbols : 0; }
+
+  stream_pos_t tokenPos(size_t tok) const { return token_pos[tok]; }
+
+  bool hasIdentifier(int tok) const
+  {
+    return size_t(tok) < numTokens() &&
+      (identifier_bits[tok >> 6] >> (tok & 63) & 1);
+  }
+
+  int findIdentifier(int tok) const
+  {
+    if (!hasIdentifier(tok)) return -1;
+    auto word = tok >> 6;
+    auto below = identifier_bits[word] & ((uint64_t(1) << (tok & 63)) - 1);
+    auto i = identifier_rank[word] + __builtin_popcountll(below);
+    return intern ? identifier_symbols[i] : i;
+  }
+
+  std::string_view getIdentifierString(int i) const;
+
+  /// Copy it into a lexed_t that can be added to
+  lexed_t to_lexed() const;
+};
+
+/// Write the tokens of a stream to a file, returning false if it failed
+bool write_lexed(
+  const std::string & filename,
+  const stream_t & stream,
+  const lexed_t & lx,
+  int err = 0,
+  std::string_view errors = {});
+
+/// Map a token file, returning false if it is missing, truncated, from
+/// another version, or has indices that point outside of it
+bool map_lexed(const std::string & filename, lexed_view_t & view);
+
+/// Print or write the tokens like print() and write_tokens() do for a
+/// lexed_t
+void print(std::ostream & os, const lexed_view_t & res, int format = FORMAT_TABLE);
+
+bool write_tokens(
+  int fd,
+  const lexed_view_t & res,
+  int format = FORMAT_TABLE,
+  thread_pool_t * pool = nullptr);
+
+//==============================================================================
+/// A directory of token files named by the hash of the buffer they were
+/// lexed from and the lexer that did it.  A file that was renamed keeps its
+/// tokens, unless it has errors whose messages would name the old file.
+/// The messages kept are those of one error limit, which is in the name too.
+//==============================================================================
+struct token_cache_t {
+
+  std::string dir;
+  std::string engine;
+  size_t error_limit;
+
+  token_cache_t(
+    const std::string & dir,
+    const std::string & engine,
+    size_t error_limit = no_error_limit);
+
+  /// The token file of a buffer with the given hash
+  std::string path(uint64_t hash, bool intern) const;
+
+  /// Map the cached tokens of a stream, if there are any
+  bool find(
+    const stream_t & stream,
+    uint64_t hash,
+    bool intern,
+    lexed_view_t & view) const;
+
+  /// Cache the tokens of a stream, returning false if they were not
+  bool store(
+    const stream_t & stream,
+    uint64_t hash,
+    const lexed_t & lx,
+    int err,
+    std::string_view errors) const;
+};
+
+} // namespace
+
+#endif // CONTRA_CACHE_HPP
@@ -0,0 +1,193 @@
+#include "calibrate.hpp"
+#include "lex.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+namespace lex {
+
+/// Bytes per token that count as much as all of one density
+constexpr double profile_length_scale = 16;
+
+//==============================================================================
+/// Windows are evenly spaced and start after the first newline in them, so
+/// they begin on a token.  A range that is too small to spread them over is
+/// only sampled at its start, so profiling a file never costs more than a
+/// few windows.  Errors are held and dropped.
+//==============================================================================
+input_profile_t profile_input(
+  stream_t & stream,
+  size_t first,
+  size_t last,
+  size_t windows,
+  size_t window_size)
+{
+  auto & buffer = stream.buffer;
+  last = std::min(last, buffer.size());
+
+  input_profile_t profile;
+  if (first >= last || !windows || !window_size) return profile;
+
+  count_sink_t counts;
+  counts.diagnostics.hold = true;
+  counts.diagnostics.limit = 1;
+
+  auto sample = [&](size_t begin, size_t end) {
+    size_t stop = begin;
+    fsm_lex(stream, counts, begin, end, stop);
+    profile.bytes += std::max(stop, end) - begin;
+  };
+
+  auto n = last - first;
+  if (n <= windows*window_size)
+    sample(first, std::min(last, first + window_size));
+  else {
+    for (size_t k=0; k<windows; ++k) {
+      auto begin = first + (k ? k*(n - window_size)/(windows - 1) : 0);
+      auto end = begin + window_size;
+      if (k) {
+        auto nl = static_cast<const char*>(
+          std::memchr(buffer.data() + begin, '\n', end - begin));
+        if (!nl) continue;
+        begin = nl - buffer.data() + 1;
+      }
+      sample(begin, end);
+    }
+  }
+
+  if (!counts.tokens) return profile;
+
+  size_t idents = counts.kinds[LEX_IDENT], numbers = 0;
+  for (int k=0; k<_LEX_STATE_END_; ++k) {
+    if (is_keyword(k)) idents += counts.kinds[k];
+    if (is_number(k)) numbers += counts.kinds[k];
+  }
+
+  double ntoks = counts.tokens;
+  profile.tokens = counts.tokens;
+  profile.ident = idents / ntoks;
+  profile.number = numbers / ntoks;
+  profile.comment = counts.kinds[LEX_COMMENT] / ntoks;
+  profile.quoted = counts.kinds[LEX_QUOTED] / ntoks;
+  profile.token_length = profile.bytes / ntoks;
+  return profile;
+}
+
+double profile_distance(const input_profile_t & a, const input_profile_t & b)
+{
+  auto d = (a.token_length - b.token_length) / profile_length_scale;
+  double sum = d*d;
+#define PROFILE_DENSITY(name, str) sum += (a.name - b.name) * (a.name - b.name);
+  FOR_PROFILE_DENSITIES(PROFILE_DENSITY)
+#undef PROFILE_DENSITY
+  return std::sqrt(sum);
+}
+
+//==============================================================================
+// The table file
+//==============================================================================
+bool calibration_t::load(const std::string & filename)
+{
+  std::ifstream in(filename);
+  if (!in) return false;
+
+  engines.clear();
+  rows.clear();
+
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream ss(line);
+    std::string key;
+    if (!(ss >> key) || key[0] == '#') continue;
+
+    if (key == "engines") {
+      for (std::string name; ss >> name; ) engines.emplace_back(name);
+    }
+    else if (key == "row") {
+      row_t row;
+#define PROFILE_READ(name, str) ss >> row.profile.name;
+      FOR_PROFILE_DENSITIES(PROFILE_READ)
+#undef PROFILE_READ
+      ss >> row.profile.token_length;
+      row.mbps.resize(engines.size());
+      for (auto & mbps : row.mbps) ss >> mbps;
+      if (!ss) return false;
+      rows.emplace_back(std::move(row));
+    }
+    else
+      return false;
+  }
+
+  return !engines.empty();
+}
+
+bool calibration_t::save(const std::string & filename) const
+{
+  std::ofstream out(filename);
+  out << "# lexit --calibrate: row";
+#define PROFILE_NAME(name, str) out << " " << str;
+  FOR_PROFILE_DENSITIES(PROFILE_NAME)
+#undef PROFILE_NAME
+  out << " token_length, then the MB/s of each engine\n";
+
+  out << "engines";
+  for (auto & name : engines) out << " " << name;
+  out << "\n";
+
+  out.precision(std::numeric_limits<double>::max_digits10);
+  for (auto & row : rows) {
+    out << "row";
+#define PROFILE_WRITE(name, str) out << " " << row.profile.name;
+    FOR_PROFILE_DENSITIES(PROFILE_WRITE)
+#undef PROFILE_WRITE
+    out << " " << row.profile.token_length;
+    for (auto mbps : row.mbps) out << " " << mbps;
+    out << "\n";
+  }
+
+  out.close();
+  return !out.fail();
+}
+
+size_t calibration_t::keep_engines(
+  const std::function<bool(const std::string &)> & runnable)
+{
+  size_t kept = 0;
+  for (size_t i=0; i<engines.size(); ++i) {
+    if (!runnable(engines[i])) continue;
+    engines[kept] = engines[i];
+    for (auto & row : rows) row.mbps[kept] = row.mbps[i];
+    kept++;
+  }
+
+  auto dropped = engines.size() - kept;
+  engines.resize(kept);
+  for (auto & row : rows) row.mbps.resize(kept);
+  return dropped;
+}
+
+std::string calibration_t::pick(
+  const input_profile_t & profile,
+  const std::string & fallback) const
+{
+  const row_t * nearest = nullptr;
+  double best = std::numeric_limits<double>::max();
+  for (auto & row : rows) {
+    auto d = profile_distance(profile, row.profile);
+    if (d < best) {
+      best = d;
+      nearest = &row;
+    }
+  }
+  if (!nearest || engines.empty()) return fallback;
+
+  size_t fastest = 0;
+  for (size_t i=1; i<engines.size(); ++i)
+    if (nearest->mbps[i] > nearest->mbps[fastest]) fastest = i;
+  return engines[fastest];
+}
+
+} // namespace
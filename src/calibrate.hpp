@@ -0,0 +1,84 @@
+#ifndef CONTRA_CALIBRATE_HPP
+#define CONTRA_CALIBRATE_HPP
+
+#include "stream.hpp"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace lex {
+
+//==============================================================================
+/// The token mix of an input, estimated from a few windows spread over it.
+/// Each window starts after a newline and is lexed by the FSM lexer into a
+/// count_sink_t.  The densities are fractions of the tokens; token_length is
+/// the bytes of input per token, the space between tokens included.
+//==============================================================================
+#define FOR_PROFILE_DENSITIES(DO) \
+  DO( ident,   "ident") \
+  DO( number,  "number") \
+  DO( comment, "comment") \
+  DO( quoted,  "quoted")
+
+struct input_profile_t {
+#define PROFILE_FIELD(name, str) double name = 0;
+  FOR_PROFILE_DENSITIES(PROFILE_FIELD)
+#undef PROFILE_FIELD
+  double token_length = 0;
+  size_t tokens = 0;
+  size_t bytes = 0;
+};
+
+/// Windows of the sample, and the bytes in each
+constexpr size_t profile_windows = 8;
+constexpr size_t profile_window_size = 4096;
+
+/// Profile [first, last) of a stream; a range no bigger than the sample is
+/// profiled from one window at its start
+input_profile_t profile_input(
+  stream_t & stream,
+  size_t first = 0,
+  size_t last = -1,
+  size_t windows = profile_windows,
+  size_t window_size = profile_window_size);
+
+//==============================================================================
+/// The throughput of each engine on inputs of known profiles, as measured by
+/// lexit --calibrate on the machine that will do the lexing.  An input gets
+/// the engine that was fastest on the nearest profile.  The file is text: an
+/// "engines" line naming them, then a "row" line per input with its densities
+/// in the order of FOR_PROFILE_DENSITIES, its token length and the MB/s of
+/// each engine.  Lines starting with # are comments.
+//==============================================================================
+struct calibration_t {
+
+  struct row_t {
+    input_profile_t profile;
+    std::vector<double> mbps;
+  };
+
+  std::vector<std::string> engines;
+  std::vector<row_t> rows;
+
+  /// Read or write the table, returning false if it could not be
+  bool load(const std::string & filename);
+  bool save(const std::string & filename) const;
+
+  /// Drop the engines, and their columns, that can not be run here, such as
+  /// one measured by a build with re2c.  Returns how many were dropped.
+  size_t keep_engines(const std::function<bool(const std::string &)> & runnable);
+
+  /// The engine predicted to be fastest, or fallback without any rows
+  std::string pick(
+    const input_profile_t & profile,
+    const std::string & fallback) const;
+};
+
+/// How far apart two profiles are.  Token lengths are scaled down to weigh
+/// about as much as the densities.
+double profile_distance(const input_profile_t & a, const input_profile_t & b);
+
+} // namespace
+
+#endif // CONTRA_CALIBRATE_HPP
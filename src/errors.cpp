@@ -1,78 +1,166 @@
+#include "errors.hpp"
 #include "stream.hpp"
-#include "utils.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <vector>
 
 namespace lex {
 
+/// Where the errors of this thread go, std::cerr when not set
+static thread_local std::ostream * error_stream = nullptr;
+
+error_redirect_t::error_redirect_t(std::ostream & os) : prev(error_stream)
+{ error_stream = &os; }
+
+error_redirect_t::~error_redirect_t()
+{ error_stream = prev; }
+
+std::ostream & error_output()
+{ return error_stream ? *error_stream : std::cerr; }
+
+const char * error_to_str(int code)
+{
+  switch (code) {
+#define ERROR_CASE(name, str) case name: return str;
+  FOR_LEX_ERRORS(ERROR_CASE)
+#undef ERROR_CASE
+  }
+  return "Unknown error";
+}
+
 //==============================================================================
-/// Count the lines in the file
+/// The number of the line holding pos, and where it starts and ends
 //==============================================================================
-std::pair<size_t,size_t> count_lines(std::vector<size_t> & lines, size_t pos)
+struct line_t {
+  size_t number, begin, end;
+};
+
+static line_t find_line(const stream_t & is, size_t pos)
 {
-  // seek to beginning of the file
-  size_t lineCount=0;
-  size_t lineStart = 0;
-
-  if (lines.size()) {
-    auto it = std::lower_bound(lines.begin(), lines.end(), pos);
-    lineStart = (it != lines.end()) ? *it : lines.back();
-    lineStart++;
-    lineCount = std::distance(lines.begin(), it);
-  }
+  auto & lines = is.newlines;
 
+  // the first newline at or after pos ends the line
+  auto it = std::lower_bound(lines.begin(), lines.end(), pos);
+  line_t line;
+  line.number = std::distance(lines.begin(), it);
+  line.begin = (it != lines.begin()) ? *std::prev(it) + 1 : 0;
+  line.end = (it != lines.end()) ? *it : is.buffer.size();
+  return line;
+}
+
+//==============================================================================
+/// The message of one error, followed by its line and a marker under it
+//==============================================================================
+static void render_error(std::string & out, const stream_t & is, const diagnostic_t & d)
+{
+  auto line = find_line(is, d.begin);
+  auto col = d.begin - line.begin;
 
-  return {lineCount, lineStart};
+  if (is.name.size()) {
+    out += is.name;
+    out += ':';
+  }
+  out += std::to_string(is.first_line + line.number + 1);
+  out += ':';
+  out += std::to_string(d.range ? col+1 : col);
+  out += ": error: ";
+  out += error_to_str(d.code);
+  out += '\n';
+  out += is.buffer.substr(line.begin, line.end - line.begin);
+  out += '\n';
+
+  if (d.range) {
+    out.append(col, ' ');
+    out.append(d.end - d.begin, '^');
+  }
+  else {
+    out.append(col ? col-1 : 0, ' ');
+    out += '^';
+  }
+  out += '\n';
 }
 
 //==============================================================================
-/// dump out the current line
+// Keeping errors
 //==============================================================================
-int error(stream_t & is, const std::string & msg, std::size_t pos)
+void diagnostics_t::add(const diagnostic_t & d)
 {
-  // seek to beginning of the file
-  auto [lineCount, lineStart] = count_lines(is.newlines, pos);
-
-  // get the line with the error
-  auto line = extract_to_newline(is.buffer, lineStart);
-  
-  // output
-  if (is.name.size()) std::cerr << is.name << ":";
-  auto col = pos - lineStart;
-  std::cerr << lineCount+1 << ":" << col << ": error: " << msg << std::endl;
-  std::cerr << line << std::endl;
-  std::cerr << std::string(col-1, ' ') << "^" << std::endl;
+  if (items.size() && items.back() == d) return;
+  if (items.size() < limit)
+    items.push_back(d);
+  else
+    dropped++;
+}
 
-  return 1;
+void diagnostics_t::append(const diagnostics_t & other)
+{
+  for (auto & d : other.items) add(d);
+  dropped += other.dropped;
 }
 
 //==============================================================================
-/// dump out the current line
+/// Sorted and without repeats, since errors can arrive from several calls
 //==============================================================================
-int error(
-  stream_t & is,
-  const std::string & msg,
-  const stream_pos_t & pos)
+std::string render_errors(const stream_t & is, const diagnostics_t & diag)
 {
-  // figure out the line start
-  auto [lineNo, lineStart] = count_lines(is.newlines, pos.begin);
+  auto items = diag.items;
+  std::stable_sort(items.begin(), items.end(),
+    [](const auto & a, const auto & b) { return a.begin < b.begin; });
 
-  // get the line
-  auto line = extract_to_newline(is.buffer, lineStart);
-  auto lineLen = line.size();
+  std::string out;
+  for (size_t i=0, group=0; i<items.size(); ++i) {
+    if (items[i].begin != items[group].begin) group = i;
+    auto seen = items.begin() + group, here = items.begin() + i;
+    if (std::find(seen, here, *here) == here)
+      render_error(out, is, items[i]);
+  }
 
-  // output
-  if (is.name.size()) std::cerr << is.name << ":";
-  auto colNo = pos.begin - lineStart;
-  auto width = pos.end - pos.begin;
+  if (diag.dropped) {
+    if (is.name.size()) {
+      out += is.name;
+      out += ": ";
+    }
+    out += std::to_string(diag.dropped);
+    out += diag.dropped > 1 ? " more errors" : " more error";
+    out += " not shown\n";
+  }
+  return out;
+}
+
+void report_errors(const stream_t & is, diagnostics_t & diag)
+{
+  if (diag.empty()) return;
+  auto out = render_errors(is, diag);
+  error_output().write(out.data(), out.size());
+  diag.clear();
+}
 
-  std::cerr << lineNo+1 << ":" << colNo+1 << ": error: " << msg << std::endl;
-  std::cerr << line << std::endl;
-  std::cerr << std::string(colNo, ' ') << std::string(width, '^') << std::endl;
+//==============================================================================
+/// Keep an error, or write it out in one go
+//==============================================================================
+static int error(stream_t & is, diagnostics_t * sink, const diagnostic_t & d)
+{
+  if (sink) {
+    sink->add(d);
+    return 1;
+  }
 
+  std::string out;
+  render_error(out, is, d);
+  error_output().write(out.data(), out.size());
   return 1;
 }
 
+int error(stream_t & is, diagnostics_t * sink, int code, size_t pos)
+{ return error(is, sink, diagnostic_t{pos, pos, code, false}); }
+
+int error(
+  stream_t & is,
+  diagnostics_t * sink,
+  int code,
+  const stream_pos_t & pos)
+{ return error(is, sink, diagnostic_t{pos.begin, pos.end, code, true}); }
+
 } // namespace
@@ -6,21 +6,92 @@
 #include <string>
 #include <vector>
 
+#define FOR_LEX_ERRORS(DO) \
+  DO( ERR_UNKNOWN,       "Unknown string.") \
+  DO( ERR_UNEXPECTED,    "Unexpected character.") \
+  DO( ERR_MULTIPLE_DOTS, "Multiple '.' encountered in real") \
+  DO( ERR_EXPONENT,      "Digit or +/- must follow exponent") \
+  DO( ERR_EXPONENT_SIGN, "Digit must follow exponent sign") \
+  DO( ERR_UNTERMINATED,  "Unterminated string")
+
 namespace lex {
 
 struct stream_t;
 struct stream_pos_t;
 
-/// dump out the current line
-int error(stream_t & is, const std::string & msg, size_t i);
+enum LexErrors {
+#define ERROR_ENUM(name, str) name,
+  FOR_LEX_ERRORS(ERROR_ENUM)
+#undef ERROR_ENUM
+};
+
+/// The message of an error code
+const char * error_to_str(int code);
+
+/// Send the error messages of the calling thread to another stream while
+/// in scope (std::cerr otherwise)
+struct error_redirect_t {
+  std::ostream * prev;
+  explicit error_redirect_t(std::ostream & os);
+  ~error_redirect_t();
+};
+
+/// Where the error messages of the calling thread are written
+std::ostream & error_output();
+
+//==============================================================================
+/// The errors found by a lexer, kept as codes and positions and only turned
+/// into messages when they are reported.  Past the limit they are counted but
+/// not kept.  Unless held for the caller, the errors of a lexer call are
+/// reported when it returns.
+//==============================================================================
+constexpr size_t no_error_limit = size_t(-1);
+
+struct diagnostic_t {
+  size_t begin, end;
+  int code;
+  /// Underline [begin, end) rather than point at begin
+  bool range;
+
+  bool operator==(const diagnostic_t & o) const
+  { return begin == o.begin && end == o.end && code == o.code && range == o.range; }
+};
+
+struct diagnostics_t {
+  std::vector<diagnostic_t> items;
+  size_t limit = no_error_limit;
+  size_t dropped = 0;
+  bool hold = false;
+
+  /// Keep an error, unless it repeats the last one or the limit is reached
+  void add(const diagnostic_t & d);
+
+  /// Add the errors of another lexer call over the same stream
+  void append(const diagnostics_t & other);
+
+  size_t size() const { return items.size() + dropped; }
+  bool empty() const { return items.empty() && !dropped; }
+  void clear() { items.clear(); dropped = 0; }
+};
+
+/// The messages of a set of errors in the order they appear in the stream,
+/// each one once, followed by how many were over the limit
+std::string render_errors(const stream_t & is, const diagnostics_t & diag);
+
+/// Report a set of errors to error_output() and forget them
+void report_errors(const stream_t & is, diagnostics_t & diag);
+
+/// Keep an error at a position, or report it straight away without a sink
+int error(stream_t & is, diagnostics_t * sink, int code, size_t pos);
 
-/// dump out the current line
+/// Keep an error underlining a token, or report it straight away
 int error(
   stream_t & is,
-  const std::string & msg,
+  diagnostics_t * sink,
+  int code,
   const stream_pos_t & pos);
 
 
-} // namespace 
+} // namespace
 
 #endif // ERRORS_HPP
@@ -1,9 +1,16 @@
 #include "stream.hpp"
 #include "errors.hpp"
+#include "fsm.hpp"
+#include "fsm_lex.hpp"
+#include "fsm_tables.hpp"
+#include "keywords.hpp"
 #include "lex.hpp"
+#include "thread_pool.hpp"
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <cstdlib>
-#include <cctype>
 #include <fstream>
 #include <iostream>
 #include <iomanip>
@@ -11,334 +18,347 @@
 #include <string>
 #include <vector>
 
-#define FOR_FSM_TRANS_STATES(DO) \
-  DO( S_REJECT     , "REJECT"      ) \
-  DO( S_SPACE      , "SPACE"       ) \
-  DO( S_SEEN_DQUOTE, "SEEN_DQUOTE" )
-
-#define FOR_FSM_FINAL_ID_STATES(DO) \
-  DO( S_INT   , "INT_LIT"  , LEX_INT    ) \
-  DO( S_REAL  , "REAL_LIT" , LEX_REAL   ) \
-  DO( S_ZERO  , "ZERO"     , LEX_INT    ) \
-  DO( S_OCTAL , "OCTAL"    , LEX_OCTAL  ) \
-  DO( S_HEX   , "HEX"      , LEX_HEX    ) \
-  DO( S_IDENT , "IDENT"    , LEX_IDENT  ) \
-  DO( S_EOF ,   "EOF"      , LEX_EOF    ) \
-  DO( S_UNK ,   "UNK"      , LEX_UNK    )
-  
-#define FOR_FSM_OTHER_FINAL_STATES(DO) \
-  DO( S_QUOTED, "QUOTED"   , LEX_QUOTED ) \
-  DO( S_COMMENT, "COMMENT" , LEX_COMMENT )
-
-#define FOR_FSM_FINAL_OP_STATES(DO) \
-  DO( S_DOT   , "DOT"      , '.'        ) \
-  DO( S_EQUAL , "EQUAL"    , '='        ) \
-  DO( S_ADD   , "ADD"      , '+'        ) \
-  DO( S_SUB   , "SUB"      , '-'        ) \
-  DO( S_MUL   , "MUL"      , '*'        ) \
-  DO( S_DIV   , "DIV"      , '/'        ) \
-  DO( S_GT    , "GT"       , '>'        ) \
-  DO( S_LT    , "LT"       , '<'        ) \
-  DO( S_EQUIV , "EQUIV"    , LEX_EQUIV  ) \
-  DO( S_ADD_EQ, "ADD_EQ"   , LEX_ADD_EQ ) \
-  DO( S_SUB_EQ, "SUB_EQ"   , LEX_SUB_EQ ) \
-  DO( S_MUL_EQ, "MUL_EQ"   , LEX_MUL_EQ ) \
-  DO( S_DIV_EQ, "DIV_EQ"   , LEX_DIV_EQ ) \
-  DO( S_GE    , "GE"       , LEX_GE     ) \
-  DO( S_LE    , "LE"       , LEX_LE     ) \
-  DO( S_INC   , "INC"      , LEX_INC    ) \
-  DO( S_DEC   , "DEC"      , LEX_DEC    )
-  
-#define FOR_FSM_EXACT_STATES(DO) \
-  DO( S_OP     , "OP"      ) \
-  DO( S_EQUABLE, "EQUABLE" )
-
-#define FOR_FSM_DECODE_STATES(DO) \
-  DO( S_EQUABLE_EQ, "EQUABLE", "!=", LEX_NE, "^=", LEX_XOR_EQ )
-
-
-
-#define FOR_FSM_ONE_CHAR_CLASSES(DO) \
-  DO( C_LF,      "LF"    , '\n') \
-  DO( C_EQUAL,   "EQUAL" , '=') \
-  DO( C_ZERO,    "ZERO"  , '0') \
-  DO( C_PLUS,    "PLUS"  , '+') \
-  DO( C_AND,     "AND"   , '&') \
-  DO( C_OR,      "OR"    , '|') \
-  DO( C_HASH,    "HASH"  , '#') \
-  DO( C_DASH,    "DASH"  , '-') \
-  DO( C_GREAT,   "GREAT" , '>') \
-  DO( C_LESS,    "LESS"  , '<') \
-  DO( C_SLASH,   "SLASH" , '/') \
-  DO( C_STAR,    "STAR"  , '*') \
-  DO( C_DOT,     "DOT"   , '.') \
-  DO( C_SQUOTE,  "SQUOTE", '\'') \
-  DO( C_DQUOTE,  "DQUOTE", '\"') \
-  DO( C_EOF,     "EOF"   , '\0')
-
-#define FOR_FSM_TWO_CHAR_CLASSES(DO) \
-  DO( C_EQUABLE, "EQUABLE", '^', '!') \
-  DO( C_X,       "X"      , 'x', 'X')
-
-#define FOR_FSM_IF_CLASSES(DO) \
-  DO( C_WHITE,   "WHITE" , isspace) \
-  DO( C_DIGIT,   "DIGIT" , isdigit) \
-  DO( C_MISC,    "MISC"  , ispunct)
-  
-#define FOR_FSM_IF_CHAR_CLASSES(DO) \
-  DO( C_ALPHA,   "ALPHA" , isalpha, '_')
-
 namespace lex {
 
-enum FSM_STATES {
-#define DEFINE_TOKS(name, str, ...) name,
-  FOR_FSM_TRANS_STATES(DEFINE_TOKS)
-  FOR_FSM_FINAL_ID_STATES(DEFINE_TOKS)
-  FOR_FSM_OTHER_FINAL_STATES(DEFINE_TOKS)
-  FOR_FSM_FINAL_OP_STATES(DEFINE_TOKS)
-  FOR_FSM_EXACT_STATES(DEFINE_TOKS)
-  FOR_FSM_DECODE_STATES(DEFINE_TOKS)
-#undef DEFINE_TOKS
-  FSM_NUM_STATES
-};
+machine_t make_fsm_table() {
+  machine_t stateTable;
+  stateTable.resize(FSM_NUM_STATES, C_SIZE);
+  fill_fsm_table(stateTable);
+  return stateTable;
+}
 
-enum FSM_CLASS
-{
-#define DEFINE_TOKS(name, str, ...) name,
-  FOR_FSM_ONE_CHAR_CLASSES(DEFINE_TOKS)
-  FOR_FSM_TWO_CHAR_CLASSES(DEFINE_TOKS)
-  FOR_FSM_IF_CLASSES(DEFINE_TOKS)
-  FOR_FSM_IF_CHAR_CLASSES(DEFINE_TOKS)
-#undef DEFINE_TOKS
-  C_SIZE
+int char_to_class(char c)
+{ return fsm_classes[static_cast<uint8_t>(c)]; }
+
+/// A compiled table, whose states are mapped back to those of the table at
+/// the end of each token
+template<typename Layout>
+struct fsm_compiled_scan_t {
+  const compiled_fsm_t & fsm;
+  const Layout & table;
+
+  int operator()(const char * buffer, size_t & pos, int & state) const
+  {
+    int s = fsm.compact[state], prev, col;
+    do {
+      prev = s;
+      col = fsm.classes[static_cast<uint8_t>(buffer[pos++])];
+      s = table(s, col);
+    } while (s != 0);
+    state = fsm.states[table(0, col)];
+    return fsm.states[prev];
+  }
 };
 
-std::string state_to_str(int tok)
+/// Start the machine as if it had just rejected the previous token on the
+/// character at first
+static void fsm_start(fsm_cursor_t & c)
 {
-  switch (tok) {
-#define TOKS_CASE(name, str, ...) case name: return str;
-  FOR_FSM_TRANS_STATES(TOKS_CASE)
-  FOR_FSM_FINAL_ID_STATES(TOKS_CASE)
-  FOR_FSM_OTHER_FINAL_STATES(TOKS_CASE)
-  FOR_FSM_FINAL_OP_STATES(TOKS_CASE)
-  FOR_FSM_EXACT_STATES(TOKS_CASE)
-  FOR_FSM_DECODE_STATES(TOKS_CASE)
-#undef TOKS_CASE
-  default: return "Error";
-  };
+  auto buffer = c.stream.buffer.data();
+  c.state = fsm_table(S_REJECT, fsm_classes[static_cast<uint8_t>(buffer[c.pos])]);
+  c.next = c.pos + 1;
 }
 
-std::string class_to_str(int tok)
+fsm_cursor_t::fsm_cursor_t(stream_t & strm, size_t first, size_t last) :
+  cursor_t(strm, first, last)
+{ fsm_start(*this); }
+
+bool fsm_cursor_t::next_token(token_t & tok)
+{ return next_fsm_token(*this, fsm_table_scan_t<decltype(fsm_table)>{fsm_table}, tok); }
+
+bool fsm_gen_cursor_t::next_token(token_t & tok)
+{ return next_fsm_token(*this, fsm_gen_scan_t{}, tok); }
+
+int fsm_lex(
+  stream_t & is,
+  const machine_t & table,
+  lexed_t & lx,
+  size_t first,
+  size_t last,
+  size_t & stop)
+{ return fsm_lex_range(is, fsm_table_scan_t<machine_t>{table}, lx, first, last, stop); }
+
+int fsm_lex(stream_t & is, const machine_t & table, lexed_t & lx)
 {
-  switch (tok) {
-#define TOKS_CASE(name, str, ...) case name: return str;
-  FOR_FSM_ONE_CHAR_CLASSES(TOKS_CASE)
-  FOR_FSM_TWO_CHAR_CLASSES(TOKS_CASE)
-  FOR_FSM_IF_CLASSES(TOKS_CASE)
-  FOR_FSM_IF_CHAR_CLASSES(TOKS_CASE)
-#undef TOKS_CASE
-  default: return "Error";
-  };
+  size_t stop;
+  return fsm_lex(is, table, lx, 0, is.buffer.size(), stop);
+}// end of main
+
+template<typename Layout>
+static int fsm_compiled_lex(
+  stream_t & is,
+  const compiled_fsm_t & fsm,
+  const Layout & table,
+  lexed_t & lx)
+{
+  size_t stop;
+  fsm_compiled_scan_t<Layout> scan{fsm, table};
+  return fsm_lex_range(is, scan, lx, 0, is.buffer.size(), stop);
 }
 
+int fsm_lex(
+  stream_t & is,
+  const compiled_fsm_t & fsm,
+  const fsm_dense_t<uint8_t> & table,
+  lexed_t & lx)
+{ return fsm_compiled_lex(is, fsm, table, lx); }
+
+int fsm_lex(
+  stream_t & is,
+  const compiled_fsm_t & fsm,
+  const fsm_comb_t & table,
+  lexed_t & lx)
+{ return fsm_compiled_lex(is, fsm, table, lx); }
+
+// the sinks of the library, which other files need not instantiate again
+#define FSM_LEX_SINK(Sink) \
+  template int fsm_lex(stream_t &, Sink &, size_t, size_t, size_t &); \
+  template int fsm_gen_lex(stream_t &, Sink &, size_t, size_t, size_t &);
+FOR_LEX_SINKS(FSM_LEX_SINK)
+#undef FSM_LEX_SINK
+
+//==============================================================================
+/// Data-parallel lexing.  The state of the machine after a byte depends only
+/// on the state before it, so a block of the stream maps each state it can
+/// start in to the state it ends in.  Few states can follow any one byte, and
+/// the runs from them soon meet, so mapping a block costs about as much as
+/// running it once.  The blocks are mapped at once, the maps are composed in
+/// order to find the state each block really starts in, and the blocks are
+/// then lexed at once from those states.  The first token a block ends began
+/// in an earlier one, so it is only made when the blocks are joined.
+//==============================================================================
+
+/// Blocks smaller than this are not worth a task
+constexpr size_t min_fsm_block_size = 64 * 1024;
+
+constexpr size_t no_pos = size_t(-1);
+
+/// The state after each class, the machine starting over if it rejects it
+static constexpr auto fsm_steps = []() {
+  auto steps = fsm_table;
+  for (int s=0; s<FSM_NUM_STATES; ++s)
+    for (int c=0; c<C_SIZE; ++c)
+      if (fsm_table(s, c) == S_REJECT) steps(s, c) = fsm_table(S_REJECT, c);
+  return steps;
+}();
+
+static inline int fsm_step(int state, char ch)
+{ return fsm_steps(state, fsm_classes[static_cast<uint8_t>(ch)]); }
+
+struct fsm_block_t {
+  /// The bytes run through the machine
+  size_t begin = 0, end = 0;
+  /// The states the block can start in, and the state it ends in from each
+  std::vector<int> starts, ends;
+  /// The state it does start and end in
+  int state = S_REJECT, end_state = S_REJECT;
+  /// Where the first token it ends begins, if known
+  size_t token_begin = no_pos;
+  /// The tokens it ends, but for a first one that began in an earlier block,
+  /// go to its own lexed_t, or to the caller's for the first block
+  lexed_t lexed;
+  lexed_t * out = nullptr;
+  diagnostics_t * diagnostics = nullptr;
+  int err = 0;
+  int head_state = -1;
+  size_t head_end = 0;
+  /// Where the last token it ends ends
+  size_t last_end = no_pos;
+};
 
-int char_to_class(char c)
+/// Follow every start of a block at once, until the runs meet
+static void fsm_map_block(const char * buffer, fsm_block_t & b)
 {
-  switch (c) {
-
-  #define TOKS_CASE(name, str, ch) case ch: return name;
-  FOR_FSM_ONE_CHAR_CLASSES(TOKS_CASE)
-  #undef TOKS_CASE
-  
-  #define TOKS_CASE(name, str, ch1, ch2) case ch1: case ch2: return name;
-  FOR_FSM_TWO_CHAR_CLASSES(TOKS_CASE)
-  #undef TOKS_CASE
-  
-  #define TOKS_CASE(name, str, ch1, ch2) case ch2: return name;
-  FOR_FSM_IF_CHAR_CLASSES(TOKS_CASE)
-  #undef TOKS_CASE
+  std::array<int, FSM_NUM_STATES> runs, merged;
+  std::array<size_t, FSM_NUM_STATES> to;
+  std::vector<size_t> run_of(b.starts.size());
+  size_t nruns = b.starts.size();
+  for (size_t i=0; i<nruns; ++i) {
+    runs[i] = b.starts[i];
+    run_of[i] = i;
+  }
 
+  auto pos = b.begin;
+  while (nruns > 1 && pos < b.end) {
+    auto ch = buffer[pos++];
+    size_t nmerged = 0;
+    for (size_t i=0; i<nruns; ++i) {
+      auto s = fsm_step(runs[i], ch);
+      auto it = std::find(merged.begin(), merged.begin() + nmerged, s);
+      to[i] = it - merged.begin();
+      if (to[i] == nmerged) merged[nmerged++] = s;
+    }
+    if (nmerged < nruns)
+      for (auto & r : run_of) r = to[r];
+    std::copy_n(merged.begin(), nmerged, runs.begin());
+    nruns = nmerged;
   }
 
-  #define TOKS_CASE(name, str, ifch, ...) if (ifch(c)) return name;
-  FOR_FSM_IF_CHAR_CLASSES(TOKS_CASE)
-  FOR_FSM_IF_CLASSES(TOKS_CASE)
-  #undef TOKS_CASE
-  
-  return C_EOF;
-}// end of Get_FSM_Col
+  // a single run from here on
+  auto state = runs[0];
+  while (pos < b.end) state = fsm_step(state, buffer[pos++]);
+  runs[0] = state;
 
-machine_t make_fsm_table() {
-  machine_t stateTable;
+  b.ends.resize(b.starts.size());
+  for (size_t i=0; i<b.starts.size(); ++i) b.ends[i] = runs[run_of[i]];
+}
 
-  stateTable.resize(FSM_NUM_STATES, C_SIZE);
-  stateTable.fill(S_REJECT);
-  
-  stateTable(S_REJECT, C_LF   ) = S_SPACE;
-  stateTable(S_REJECT, C_WHITE) = S_SPACE;
-  stateTable(S_SPACE,  C_WHITE) = S_SPACE;
-
-  stateTable(S_REJECT, C_ALPHA) = S_IDENT;
-  stateTable(S_IDENT , C_ALPHA) = S_IDENT;
-  stateTable(S_IDENT , C_X    ) = S_IDENT;
-  stateTable(S_IDENT , C_DIGIT) = S_IDENT;
-  stateTable(S_IDENT , C_ZERO ) = S_IDENT;
-  
-  stateTable(S_REJECT, C_X) = S_IDENT;
-  
-  stateTable(S_REJECT, C_DIGIT) = S_INT;
-  stateTable(S_INT   , C_DIGIT) = S_INT;
-  stateTable(S_INT   , C_ZERO ) = S_INT;
-  stateTable(S_INT   , C_DOT  ) = S_REAL;
-  stateTable(S_INT   , C_X    ) = S_UNK;
-  
-  stateTable(S_REJECT, C_ZERO ) = S_ZERO;
-  stateTable(S_ZERO  , C_DIGIT) = S_OCTAL;
-  stateTable(S_ZERO  , C_ZERO ) = S_OCTAL;
-  stateTable(S_OCTAL , C_DIGIT) = S_OCTAL;
-  stateTable(S_OCTAL , C_ZERO ) = S_OCTAL;
-  stateTable(S_OCTAL , C_X    ) = S_UNK;
-  stateTable(S_ZERO  , C_X    ) = S_HEX;
-  stateTable(S_HEX   , C_DIGIT) = S_HEX;
-  stateTable(S_HEX   , C_ZERO ) = S_HEX;
-  
-  stateTable(S_REJECT, C_DOT  ) = S_DOT;
-  stateTable(S_DOT   , C_DIGIT) = S_REAL;
-  stateTable(S_DOT   , C_ZERO ) = S_REAL;
-  stateTable(S_REAL  , C_DIGIT) = S_REAL;
-  stateTable(S_REAL  , C_ZERO ) = S_REAL;
-  stateTable(S_REAL  , C_DOT  ) = S_UNK;
-  
-  stateTable(S_REJECT, C_EQUAL) = S_EQUAL;
-  stateTable(S_EQUAL , C_EQUAL) = S_EQUIV;
-  
-  stateTable(S_REJECT, C_PLUS ) = S_ADD;
-  stateTable(S_ADD   , C_PLUS ) = S_INC;
-  stateTable(S_ADD   , C_EQUAL) = S_ADD_EQ;
-  
-  stateTable(S_REJECT, C_DASH ) = S_SUB;
-  stateTable(S_SUB   , C_DASH ) = S_DEC;
-  stateTable(S_SUB   , C_EQUAL) = S_SUB_EQ;
-  
-  stateTable(S_REJECT, C_STAR ) = S_MUL;
-  stateTable(S_MUL   , C_EQUAL) = S_MUL_EQ;
-  
-  stateTable(S_REJECT, C_SLASH) = S_DIV;
-  stateTable(S_DIV   , C_EQUAL) = S_DIV_EQ;
-  
-  stateTable(S_REJECT, C_GREAT) = S_GT;
-  stateTable(S_GT    , C_EQUAL) = S_GE;
-  
-  stateTable(S_REJECT, C_LESS ) = S_LT;
-  stateTable(S_LT    , C_EQUAL) = S_LE;
-  
-  stateTable(S_REJECT, C_MISC ) = S_OP;
-
-  stateTable(S_REJECT, C_EQUABLE) = S_EQUABLE;
-  stateTable(S_EQUABLE, C_EQUAL ) = S_EQUABLE_EQ;
-  
-  stateTable(S_REJECT, C_DQUOTE) = S_SEEN_DQUOTE;
-  stateTable.setRow(S_SEEN_DQUOTE, S_SEEN_DQUOTE);
-  stateTable(S_SEEN_DQUOTE, C_DQUOTE) = S_QUOTED;
-  stateTable(S_SEEN_DQUOTE, C_EOF)    = S_REJECT;
-  
-  stateTable(S_REJECT, C_HASH) = S_COMMENT;
-  stateTable.setRow(S_COMMENT, S_COMMENT);
-  stateTable(S_COMMENT, C_LF)  = S_REJECT;
-  stateTable(S_COMMENT, C_EOF) = S_REJECT;
-  
-  stateTable.setRow(S_UNK, S_UNK);
-  stateTable(S_UNK, C_WHITE) = S_REJECT;
-  stateTable(S_UNK, C_EOF) = S_REJECT;
-  stateTable(S_UNK, C_LF) = S_REJECT;
-  
-  return stateTable;
+/// Lex a block from the state it starts in
+static void fsm_lex_block(stream_t & is, fsm_block_t & b)
+{
+  auto buffer = is.buffer.data();
+  cursor_t c(is, b.begin, b.end);
+  c.diagnostics = b.diagnostics;
+  token_t tok;
+
+  auto state = b.state;
+  auto begPos = b.token_begin;
+  for (auto pos = b.begin; pos < b.end; ++pos) {
+    auto col = fsm_classes[static_cast<uint8_t>(buffer[pos])];
+    auto next = fsm_table(state, col);
+    if (next != S_REJECT) {
+      state = next;
+      continue;
+    }
+    if (begPos == no_pos) {
+      b.head_state = state;
+      b.head_end = pos;
+    }
+    else if (fsm_token(c, state, begPos, pos, tok))
+      b.out->add(tok);
+    begPos = pos;
+    state = fsm_table(S_REJECT, col);
+  }
+
+  b.end_state = state;
+  b.last_end = begPos;
+  b.err = c.err;
 }
 
-int fsm_lex(stream_t & is, const machine_t & table, lexed_t & lx)
+int fsm_enum_lex(
+  stream_t & is,
+  lexed_t & lx,
+  size_t first,
+  size_t last,
+  size_t & stop,
+  thread_pool_t * pool,
+  size_t block_size)
 {
-  // get data from user
-  auto & buffer = is.buffer;
-  
-  // declare variables
+  auto buffer = is.buffer.data();
+  last = std::min(last, is.buffer.size());
+  if (first >= last) {
+    stop = first;
+    return 0;
+  }
+
+  // without a pool, one block needs no map
+  if (!block_size)
+    block_size = pool ?
+      std::max((last - first) / (4*pool->size()), min_fsm_block_size) :
+      last - first;
+
+  // the bytes after first, up to the one at last that a token starting
+  // before it is ended by at the latest (the end of the stream at most)
+  std::vector<fsm_block_t> blocks;
+  for (auto begin = first + 1; begin <= last; ) {
+    auto end = std::min(begin + block_size, last + 1);
+    blocks.emplace_back();
+    auto & b = blocks.back();
+    b.begin = begin;
+    b.end = end;
+    b.lexed.intern = lx.intern;
+    b.lexed.decode = lx.decode;
+    b.lexed.diagnostics.limit = lx.diagnostics.limit;
+    begin = end;
+  }
+
+  // the states that can follow the byte before each block
+  blocks[0].starts = {fsm_step(S_REJECT, buffer[first])};
+  for (size_t k=1; k<blocks.size(); ++k) {
+    auto & starts = blocks[k].starts;
+    for (int s=0; s<FSM_NUM_STATES; ++s) {
+      auto t = fsm_step(s, buffer[blocks[k].begin - 1]);
+      if (std::find(starts.begin(), starts.end(), t) == starts.end())
+        starts.push_back(t);
+    }
+  }
+
+  auto run = [&](auto task) {
+    if (!pool) {
+      for (auto & b : blocks) task(b);
+      return;
+    }
+    for (auto & b : blocks) pool->submit([&task, &b]() { task(b); });
+    pool->wait();
+  };
+
+  // map the blocks, but for the last, then compose the maps in order
+  auto & tail = blocks.back();
+  run([buffer, &tail](fsm_block_t & b) {
+    if (&b != &tail) fsm_map_block(buffer, b);
+  });
+
+  blocks[0].state = blocks[0].starts[0];
+  for (size_t k=1; k<blocks.size(); ++k) {
+    auto & prev = blocks[k-1];
+    auto i = std::find(prev.starts.begin(), prev.starts.end(), prev.state);
+    blocks[k].state = prev.ends[i - prev.starts.begin()];
+  }
+
+  // the first block knows where its first token begins
+  for (auto & b : blocks) {
+    b.out = &b.lexed;
+    b.diagnostics = &b.lexed.diagnostics;
+  }
+  error_sink_t sink(is, lx);
+  blocks[0].token_begin = first;
+  blocks[0].out = &lx;
+  blocks[0].diagnostics = sink.diagnostics;
+
+  run([&is](fsm_block_t & b) { fsm_lex_block(is, b); });
+
+  // join the blocks, making the tokens that cross into them
+  cursor_t c(is, first, last);
+  c.diagnostics = sink.diagnostics;
+  token_t tok;
   int err = 0;
-  int col;
-  auto currChar = ' ';
-  int currState = S_REJECT;
-  int prevState = S_REJECT;
-  size_t prevPos = 0;
-  size_t currPos = 0;
-    
-
-  // use a loop to scan each line in the file
-  while(currPos <= buffer.size())
-  {
-    auto begPos = prevPos;
+  auto begPos = first;
+
+  for (auto & b : blocks) {
+    if (b.head_state >= 0 &&
+        fsm_token(c, b.head_state, begPos, b.head_end, tok))
+      lx.add(tok);
+    if (b.last_end != no_pos) begPos = b.last_end;
+    if (b.out != &lx) {
+      sink.diagnostics->append(b.lexed.diagnostics);
+      b.lexed.diagnostics.clear();
+      lx.append(b.lexed);
+    }
+    err += b.err;
+  }
 
-    do {
-      prevState = currState;
-      prevPos = currPos;
-      
-      currChar = buffer[currPos];
-      currPos++;
-      
-      // get the column number for the curr character
-      col = char_to_class(currChar);
-
-      // get the curr state of the expression
-      currState = table(currState, col);
-
-    } while (currState != S_REJECT);
-
-    // If the curr state of the expression == REJECT
-    // (the starting state), then we have sucessfully parsed
-    // a token.
-      
-    stream_pos_t pos{begPos, prevPos};
-    auto len = prevPos - begPos;
-    
-    if (prevState == S_UNK) err += error(is, "Unknown string.", pos);
-
-    switch (prevState) {
-
-      #define STATE_CASE(name, str) \
-        case name: lx.add(buffer[begPos], pos); break;
-      FOR_FSM_EXACT_STATES(STATE_CASE)
-      #undef STATE_CASE
-
-      #define STATE_CASE(name, str, lstate) \
-        case name: \
-        lx.add(lstate, pos, buffer.substr(begPos, len)); \
-        break;
-      FOR_FSM_FINAL_ID_STATES(STATE_CASE)
-      #undef STATE_CASE
-
-      #define STATE_CASE(name, str, lstate) \
-        case name: lx.add(lstate, pos); break;
-      FOR_FSM_FINAL_OP_STATES(STATE_CASE)
-      #undef STATE_CASE
-
-      case S_QUOTED:
-        lx.add(LEX_QUOTED, pos, buffer.substr(begPos+1, len-2));
-        break;
-      
-      case S_COMMENT:
-        lx.add(LEX_COMMENT, pos);
-        break;
-
-
-      case S_EQUABLE_EQ:
-        lx.add( buffer[begPos] == '!' ? LEX_NE : LEX_XOR_EQ, pos );
-        break;
-
-    } // switch
-
-    // Reset the state/token
-    currState = table(currState, col);
+  // a token that starts before last and runs past it
+  if (begPos < last) {
+    auto state = blocks.back().end_state;
+    auto pos = last + 1;
+    for (;; ++pos) {
+      auto next = fsm_table(state, fsm_classes[static_cast<uint8_t>(buffer[pos])]);
+      if (next == S_REJECT) break;
+      state = next;
+    }
+    if (fsm_token(c, state, begPos, pos, tok)) lx.add(tok);
+    begPos = pos;
   }
 
-  return err;
-}// end of main
+  stop = begPos;
+  return err + c.err;
+}
+
+int fsm_enum_lex(stream_t & is, lexed_t & lx, thread_pool_t * pool)
+{
+  size_t stop;
+  return fsm_enum_lex(is, lx, 0, is.buffer.size(), stop, pool);
+}
 
 
 } // namespace
@@ -0,0 +1,271 @@
+#ifndef CONTRA_FSM_HPP
+#define CONTRA_FSM_HPP
+
+#include <string>
+
+//==============================================================================
+// The states, character classes and transitions of the FSM lexer.  Kept apart
+// from the lexer so that fsm_gen can build the same table without the library.
+//==============================================================================
+
+#define FOR_FSM_TRANS_STATES(DO) \
+  DO( S_REJECT     , "REJECT"      ) \
+  DO( S_SPACE      , "SPACE"       ) \
+  DO( S_SEEN_DQUOTE, "SEEN_DQUOTE" )
+
+#define FOR_FSM_FINAL_ID_STATES(DO) \
+  DO( S_INT   , "INT_LIT"  , LEX_INT    ) \
+  DO( S_REAL  , "REAL_LIT" , LEX_REAL   ) \
+  DO( S_ZERO  , "ZERO"     , LEX_INT    ) \
+  DO( S_OCTAL , "OCTAL"    , LEX_OCTAL  ) \
+  DO( S_HEX   , "HEX"      , LEX_HEX    ) \
+  DO( S_IDENT , "IDENT"    , LEX_IDENT  ) \
+  DO( S_EOF ,   "EOF"      , LEX_EOF    ) \
+  DO( S_UNK ,   "UNK"      , LEX_UNK    )
+  
+#define FOR_FSM_OTHER_FINAL_STATES(DO) \
+  DO( S_QUOTED, "QUOTED"   , LEX_QUOTED ) \
+  DO( S_COMMENT, "COMMENT" , LEX_COMMENT )
+
+#define FOR_FSM_FINAL_OP_STATES(DO) \
+  DO( S_DOT   , "DOT"      , '.'        ) \
+  DO( S_EQUAL , "EQUAL"    , '='        ) \
+  DO( S_ADD   , "ADD"      , '+'        ) \
+  DO( S_SUB   , "SUB"      , '-'        ) \
+  DO( S_MUL   , "MUL"      , '*'        ) \
+  DO( S_DIV   , "DIV"      , '/'        ) \
+  DO( S_GT    , "GT"       , '>'        ) \
+  DO( S_LT    , "LT"       , '<'        ) \
+  DO( S_EQUIV , "EQUIV"    , LEX_EQUIV  ) \
+  DO( S_ADD_EQ, "ADD_EQ"   , LEX_ADD_EQ ) \
+  DO( S_SUB_EQ, "SUB_EQ"   , LEX_SUB_EQ ) \
+  DO( S_MUL_EQ, "MUL_EQ"   , LEX_MUL_EQ ) \
+  DO( S_DIV_EQ, "DIV_EQ"   , LEX_DIV_EQ ) \
+  DO( S_GE    , "GE"       , LEX_GE     ) \
+  DO( S_LE    , "LE"       , LEX_LE     ) \
+  DO( S_INC   , "INC"      , LEX_INC    ) \
+  DO( S_DEC   , "DEC"      , LEX_DEC    )
+  
+#define FOR_FSM_EXACT_STATES(DO) \
+  DO( S_OP     , "OP"      ) \
+  DO( S_EQUABLE, "EQUABLE" )
+
+#define FOR_FSM_DECODE_STATES(DO) \
+  DO( S_EQUABLE_EQ, "EQUABLE", "!=", LEX_NE, "^=", LEX_XOR_EQ )
+
+
+
+#define FOR_FSM_ONE_CHAR_CLASSES(DO) \
+  DO( C_LF,      "LF"    , '\n') \
+  DO( C_EQUAL,   "EQUAL" , '=') \
+  DO( C_ZERO,    "ZERO"  , '0') \
+  DO( C_PLUS,    "PLUS"  , '+') \
+  DO( C_AND,     "AND"   , '&') \
+  DO( C_OR,      "OR"    , '|') \
+  DO( C_HASH,    "HASH"  , '#') \
+  DO( C_DASH,    "DASH"  , '-') \
+  DO( C_GREAT,   "GREAT" , '>') \
+  DO( C_LESS,    "LESS"  , '<') \
+  DO( C_SLASH,   "SLASH" , '/') \
+  DO( C_STAR,    "STAR"  , '*') \
+  DO( C_DOT,     "DOT"   , '.') \
+  DO( C_SQUOTE,  "SQUOTE", '\'') \
+  DO( C_DQUOTE,  "DQUOTE", '\"') \
+  DO( C_EOF,     "EOF"   , '\0')
+
+#define FOR_FSM_TWO_CHAR_CLASSES(DO) \
+  DO( C_EQUABLE, "EQUABLE", '^', '!') \
+  DO( C_X,       "X"      , 'x', 'X')
+
+#define FOR_FSM_IF_CLASSES(DO) \
+  DO( C_WHITE,   "WHITE" , is_space) \
+  DO( C_DIGIT,   "DIGIT" , is_digit) \
+  DO( C_MISC,    "MISC"  , is_punct)
+  
+#define FOR_FSM_IF_CHAR_CLASSES(DO) \
+  DO( C_ALPHA,   "ALPHA" , is_alpha, '_')
+
+namespace lex {
+
+enum FSM_STATES {
+#define DEFINE_TOKS(name, str, ...) name,
+  FOR_FSM_TRANS_STATES(DEFINE_TOKS)
+  FOR_FSM_FINAL_ID_STATES(DEFINE_TOKS)
+  FOR_FSM_OTHER_FINAL_STATES(DEFINE_TOKS)
+  FOR_FSM_FINAL_OP_STATES(DEFINE_TOKS)
+  FOR_FSM_EXACT_STATES(DEFINE_TOKS)
+  FOR_FSM_DECODE_STATES(DEFINE_TOKS)
+#undef DEFINE_TOKS
+  FSM_NUM_STATES
+};
+
+enum FSM_CLASS
+{
+#define DEFINE_TOKS(name, str, ...) name,
+  FOR_FSM_ONE_CHAR_CLASSES(DEFINE_TOKS)
+  FOR_FSM_TWO_CHAR_CLASSES(DEFINE_TOKS)
+  FOR_FSM_IF_CLASSES(DEFINE_TOKS)
+  FOR_FSM_IF_CHAR_CLASSES(DEFINE_TOKS)
+#undef DEFINE_TOKS
+  C_SIZE
+};
+
+inline std::string state_to_str(int tok)
+{
+  switch (tok) {
+#define TOKS_CASE(name, str, ...) case name: return str;
+  FOR_FSM_TRANS_STATES(TOKS_CASE)
+  FOR_FSM_FINAL_ID_STATES(TOKS_CASE)
+  FOR_FSM_OTHER_FINAL_STATES(TOKS_CASE)
+  FOR_FSM_FINAL_OP_STATES(TOKS_CASE)
+  FOR_FSM_EXACT_STATES(TOKS_CASE)
+  FOR_FSM_DECODE_STATES(TOKS_CASE)
+#undef TOKS_CASE
+  default: return "Error";
+  };
+}
+
+inline std::string class_to_str(int tok)
+{
+  switch (tok) {
+#define TOKS_CASE(name, str, ...) case name: return str;
+  FOR_FSM_ONE_CHAR_CLASSES(TOKS_CASE)
+  FOR_FSM_TWO_CHAR_CLASSES(TOKS_CASE)
+  FOR_FSM_IF_CLASSES(TOKS_CASE)
+  FOR_FSM_IF_CHAR_CLASSES(TOKS_CASE)
+#undef TOKS_CASE
+  default: return "Error";
+  };
+}
+
+
+//==============================================================================
+/// Character tests of the "C" locale, usable at compile time
+//==============================================================================
+constexpr bool is_space(char c)
+{ return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+constexpr bool is_digit(char c)
+{ return c >= '0' && c <= '9'; }
+
+constexpr bool is_alpha(char c)
+{ return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+
+constexpr bool is_punct(char c)
+{ return c > ' ' && c < 127 && !is_alpha(c) && !is_digit(c); }
+
+constexpr int classify_char(char c)
+{
+  switch (c) {
+
+  #define TOKS_CASE(name, str, ch) case ch: return name;
+  FOR_FSM_ONE_CHAR_CLASSES(TOKS_CASE)
+  #undef TOKS_CASE
+  
+  #define TOKS_CASE(name, str, ch1, ch2) case ch1: case ch2: return name;
+  FOR_FSM_TWO_CHAR_CLASSES(TOKS_CASE)
+  #undef TOKS_CASE
+  
+  #define TOKS_CASE(name, str, ch1, ch2) case ch2: return name;
+  FOR_FSM_IF_CHAR_CLASSES(TOKS_CASE)
+  #undef TOKS_CASE
+
+  }
+
+  #define TOKS_CASE(name, str, ifch, ...) if (ifch(c)) return name;
+  FOR_FSM_IF_CHAR_CLASSES(TOKS_CASE)
+  FOR_FSM_IF_CLASSES(TOKS_CASE)
+  #undef TOKS_CASE
+  
+  return C_EOF;
+}// end of Get_FSM_Col
+
+//==============================================================================
+/// Fill in the transitions of any table with fill(), setRow() and (s,c)
+//==============================================================================
+template<typename Table>
+constexpr void fill_fsm_table(Table & stateTable) {
+  stateTable.fill(S_REJECT);
+  
+  stateTable(S_REJECT, C_LF   ) = S_SPACE;
+  stateTable(S_REJECT, C_WHITE) = S_SPACE;
+  stateTable(S_SPACE,  C_WHITE) = S_SPACE;
+
+  stateTable(S_REJECT, C_ALPHA) = S_IDENT;
+  stateTable(S_IDENT , C_ALPHA) = S_IDENT;
+  stateTable(S_IDENT , C_X    ) = S_IDENT;
+  stateTable(S_IDENT , C_DIGIT) = S_IDENT;
+  stateTable(S_IDENT , C_ZERO ) = S_IDENT;
+  
+  stateTable(S_REJECT, C_X) = S_IDENT;
+  
+  stateTable(S_REJECT, C_DIGIT) = S_INT;
+  stateTable(S_INT   , C_DIGIT) = S_INT;
+  stateTable(S_INT   , C_ZERO ) = S_INT;
+  stateTable(S_INT   , C_DOT  ) = S_REAL;
+  stateTable(S_INT   , C_X    ) = S_UNK;
+  
+  stateTable(S_REJECT, C_ZERO ) = S_ZERO;
+  stateTable(S_ZERO  , C_DIGIT) = S_OCTAL;
+  stateTable(S_ZERO  , C_ZERO ) = S_OCTAL;
+  stateTable(S_OCTAL , C_DIGIT) = S_OCTAL;
+  stateTable(S_OCTAL , C_ZERO ) = S_OCTAL;
+  stateTable(S_OCTAL , C_X    ) = S_UNK;
+  stateTable(S_ZERO  , C_X    ) = S_HEX;
+  stateTable(S_HEX   , C_DIGIT) = S_HEX;
+  stateTable(S_HEX   , C_ZERO ) = S_HEX;
+  
+  stateTable(S_REJECT, C_DOT  ) = S_DOT;
+  stateTable(S_DOT   , C_DIGIT) = S_REAL;
+  stateTable(S_DOT   , C_ZERO ) = S_REAL;
+  stateTable(S_REAL  , C_DIGIT) = S_REAL;
+  stateTable(S_REAL  , C_ZERO ) = S_REAL;
+  stateTable(S_REAL  , C_DOT  ) = S_UNK;
+  
+  stateTable(S_REJECT, C_EQUAL) = S_EQUAL;
+  stateTable(S_EQUAL , C_EQUAL) = S_EQUIV;
+  
+  stateTable(S_REJECT, C_PLUS ) = S_ADD;
+  stateTable(S_ADD   , C_PLUS ) = S_INC;
+  stateTable(S_ADD   , C_EQUAL) = S_ADD_EQ;
+  
+  stateTable(S_REJECT, C_DASH ) = S_SUB;
+  stateTable(S_SUB   , C_DASH ) = S_DEC;
+  stateTable(S_SUB   , C_EQUAL) = S_SUB_EQ;
+  
+  stateTable(S_REJECT, C_STAR ) = S_MUL;
+  stateTable(S_MUL   , C_EQUAL) = S_MUL_EQ;
+  
+  stateTable(S_REJECT, C_SLASH) = S_DIV;
+  stateTable(S_DIV   , C_EQUAL) = S_DIV_EQ;
+  
+  stateTable(S_REJECT, C_GREAT) = S_GT;
+  stateTable(S_GT    , C_EQUAL) = S_GE;
+  
+  stateTable(S_REJECT, C_LESS ) = S_LT;
+  stateTable(S_LT    , C_EQUAL) = S_LE;
+  
+  stateTable(S_REJECT, C_MISC ) = S_OP;
+
+  stateTable(S_REJECT, C_EQUABLE) = S_EQUABLE;
+  stateTable(S_EQUABLE, C_EQUAL ) = S_EQUABLE_EQ;
+  
+  stateTable(S_REJECT, C_DQUOTE) = S_SEEN_DQUOTE;
+  stateTable.setRow(S_SEEN_DQUOTE, S_SEEN_DQUOTE);
+  stateTable(S_SEEN_DQUOTE, C_DQUOTE) = S_QUOTED;
+  stateTable(S_SEEN_DQUOTE, C_EOF)    = S_REJECT;
+  
+  stateTable(S_REJECT, C_HASH) = S_COMMENT;
+  stateTable.setRow(S_COMMENT, S_COMMENT);
+  stateTable(S_COMMENT, C_LF)  = S_REJECT;
+  stateTable(S_COMMENT, C_EOF) = S_REJECT;
+  
+  stateTable.setRow(S_UNK, S_UNK);
+  stateTable(S_UNK, C_WHITE) = S_REJECT;
+  stateTable(S_UNK, C_EOF) = S_REJECT;
+  stateTable(S_UNK, C_LF) = S_REJECT;
+}
+
+} // namespace
+
+#endif // CONTRA_FSM_HPP
@@ -0,0 +1,239 @@
+#ifndef CONTRA_FSM_LEX_HPP
+#define CONTRA_FSM_LEX_HPP
+
+//==============================================================================
+// The bodies of fsm_lex and fsm_gen_lex, with the tables they run.  Including
+// this header lets them be instantiated and inlined for any sink, not only
+// those of FOR_LEX_SINKS, which the library already instantiates.
+//==============================================================================
+
+#include "errors.hpp"
+#include "fsm.hpp"
+#include "keywords.hpp"
+#include "lex.hpp"
+#include "stream.hpp"
+
+#include <array>
+#include <cstdint>
+
+namespace lex {
+
+//==============================================================================
+/// A transition table sized at compile time.  Rows are padded to a power of
+/// two so a lookup is a shift, an or, and a single byte load.
+//==============================================================================
+template<typename T, int Rows, int Cols>
+struct fixed_machine_t {
+  static constexpr int shift = Cols <= 16 ? 4 : Cols <= 32 ? 5 : 6;
+  static_assert(Cols <= (1 << shift), "too many character classes");
+  static_assert(Rows <= (1 << (8*sizeof(T))), "too many states");
+
+  std::array<T, (Rows << shift)> table{};
+
+  constexpr void fill(int v)
+  { for (auto & t : table) t = v; }
+
+  constexpr int operator()(int s, int c) const
+  { return table[(s << shift) | c]; }
+
+  constexpr T & operator()(int s, int c)
+  { return table[(s << shift) | c]; }
+
+  constexpr void setRow(int r, int s)
+  { for (int c=0; c<Cols; ++c) table[(r << shift) | c] = s; }
+};
+
+/// The transition table, built by the compiler
+inline constexpr auto fsm_table = []() {
+  fixed_machine_t<uint8_t, FSM_NUM_STATES, C_SIZE> stateTable;
+  fill_fsm_table(stateTable);
+  return stateTable;
+}();
+
+/// Character class of every byte, built by the compiler
+inline constexpr auto fsm_classes = []() {
+  std::array<uint8_t, 256> classes{};
+  for (int i=0; i<256; ++i) classes[i] = classify_char(static_cast<char>(i));
+  return classes;
+}();
+
+static_assert(fsm_classes['\n'] == C_LF && fsm_classes['_'] == C_ALPHA);
+static_assert(fsm_classes['\t'] == C_WHITE && fsm_classes[0x80] == C_EOF);
+static_assert(fsm_table(S_REJECT, C_ALPHA) == S_IDENT);
+
+//==============================================================================
+/// Run the machine from state until it rejects a byte, one table lookup per
+/// byte.  pos is left just past that byte, state is where the machine starts
+/// over on it, and the state it was in before is returned.
+//==============================================================================
+template<typename Table>
+struct fsm_table_scan_t {
+  const Table & table;
+
+  int operator()(const char * buffer, size_t & pos, int & state) const
+  {
+    int prev, col;
+    do {
+      prev = state;
+      col = fsm_classes[static_cast<uint8_t>(buffer[pos++])];
+      state = table(state, col);
+    } while (state != S_REJECT);
+    state = table(S_REJECT, col);
+    return prev;
+  }
+};
+
+/// The same machine compiled to code by fsm_gen, one label per state
+#include "fsm_gen.inc"
+
+struct fsm_gen_scan_t {
+  int operator()(const char * buffer, size_t & pos, int & state) const
+  { return fsm_gen_scan(buffer, pos, state); }
+};
+
+/// The token that ends in a state, if the state ends one
+inline bool fsm_token(
+  cursor_t & c,
+  int state,
+  size_t begPos,
+  size_t endPos,
+  token_t & tok)
+{
+  auto & is = c.stream;
+  auto buffer = is.buffer.data();
+
+  stream_pos_t pos{begPos, endPos};
+  auto len = endPos - begPos;
+  
+  if (state == S_UNK) c.err += error(is, c.diagnostics, ERR_UNKNOWN, pos);
+
+  tok.pos = pos;
+  tok.text = {};
+
+  switch (state) {
+
+    #define STATE_CASE(name, str) \
+      case name: tok.kind = buffer[begPos]; break;
+    FOR_FSM_EXACT_STATES(STATE_CASE)
+    #undef STATE_CASE
+
+    #define STATE_CASE(name, str, lstate) \
+      case name: \
+      tok.kind = lstate; \
+      tok.text = is.buffer.substr(begPos, len); \
+      break;
+    FOR_FSM_FINAL_ID_STATES(STATE_CASE)
+    #undef STATE_CASE
+
+    #define STATE_CASE(name, str, lstate) \
+      case name: tok.kind = lstate; break;
+    FOR_FSM_FINAL_OP_STATES(STATE_CASE)
+    #undef STATE_CASE
+
+    case S_QUOTED:
+      tok.kind = LEX_QUOTED;
+      tok.text = is.buffer.substr(begPos+1, len-2);
+      break;
+    
+    case S_COMMENT:
+      tok.kind = LEX_COMMENT;
+      break;
+
+    case S_EQUABLE_EQ:
+      tok.kind = buffer[begPos] == '!' ? LEX_NE : LEX_XOR_EQ;
+      break;
+
+    default:
+      return false;
+
+  } // switch
+
+  // an identifier that is in the keyword table
+  if (state == S_IDENT) {
+    auto kind = keyword_kind(buffer + begPos, len);
+    if (kind != LEX_IDENT) {
+      tok.kind = kind;
+      tok.text = {};
+    }
+  }
+
+  return true;
+}
+
+//==============================================================================
+/// Run the machine up to the end of the next token.  The machine starts out
+/// as if it had just rejected the previous token on the character at first,
+/// and the next token always starts at pos.
+//==============================================================================
+template<typename Scan>
+bool next_fsm_token(fsm_cursor_t & c, const Scan & scan, token_t & tok)
+{
+  auto buffer = c.stream.buffer.data();
+
+  // a new token starts at begPos
+  auto currState = c.state;
+  auto begPos = c.pos;
+  auto currPos = c.next;
+  bool found = false;
+
+  while(!found && currPos <= c.last)
+  {
+    // the state before the machine rejected is the kind of token it parsed
+    int prevState = scan(buffer, currPos, currState);
+    auto endPos = currPos - 1;
+    found = fsm_token(c, prevState, begPos, endPos, tok);
+    begPos = endPos;
+  }
+
+  c.state = currState;
+  c.pos = begPos;
+  c.next = currPos;
+  return found;
+}
+
+//==============================================================================
+/// Lex with any scanner
+//==============================================================================
+template<typename Scan, typename Sink>
+int fsm_lex_range(
+  stream_t & is,
+  const Scan & scan,
+  Sink & out,
+  size_t first,
+  size_t last,
+  size_t & stop)
+{
+  error_sink_t sink(is, out.diagnostics);
+  fsm_cursor_t cursor(is, first, last);
+  cursor.diagnostics = sink.diagnostics;
+  token_t tok;
+  while (next_fsm_token(cursor, scan, tok))
+    out.on_token(tok.kind, tok.pos, tok.text);
+  stop = cursor.stop();
+  return cursor.err;
+}
+
+template<typename Sink>
+int fsm_lex(
+  stream_t & is,
+  Sink & out,
+  size_t first,
+  size_t last,
+  size_t & stop)
+{
+  fsm_table_scan_t<decltype(fsm_table)> scan{fsm_table};
+  return fsm_lex_range(is, scan, out, first, last, stop);
+}
+
+template<typename Sink>
+int fsm_gen_lex(
+  stream_t & is,
+  Sink & out,
+  size_t first,
+  size_t last,
+  size_t & stop)
+{ return fsm_lex_range(is, fsm_gen_scan_t{}, out, first, last, stop); }
+
+} // namespace
+
+#endif // CONTRA_FSM_LEX_HPP
@@ -0,0 +1,194 @@
+#include "fsm.hpp"
+#include "fsm_tables.hpp"
+
+#include <algorithm>
+#include <map>
+#include <numeric>
+#include <vector>
+
+namespace lex {
+
+//==============================================================================
+/// What lexing does with a token that ends in each state of the table.  Only
+/// states with the same output can be merged.
+//==============================================================================
+static int output_of(int s)
+{
+  // the reject state ends every token, so it stays on its own
+  if (s == S_REJECT) return -1;
+
+  switch (s) {
+  #define STATE_CASE(name, str) case name: return -2;
+  FOR_FSM_TRANS_STATES(STATE_CASE)
+  #undef STATE_CASE
+  #define STATE_CASE(name, str) case name: return -3;
+  FOR_FSM_EXACT_STATES(STATE_CASE)
+  #undef STATE_CASE
+  #define STATE_CASE(name, str, lstate) case name: return lstate;
+  FOR_FSM_FINAL_ID_STATES(STATE_CASE)
+  FOR_FSM_OTHER_FINAL_STATES(STATE_CASE)
+  FOR_FSM_FINAL_OP_STATES(STATE_CASE)
+  #undef STATE_CASE
+  }
+  // a state decoded from its first character, like S_EQUABLE_EQ
+  return _LEX_STATE_END_ + s;
+}
+
+//==============================================================================
+/// Split the states into blocks until the states of each block go to the same
+/// blocks on every class (Moore's algorithm)
+//==============================================================================
+static std::vector<int> merge_states(
+  const machine_t & table,
+  const std::vector<int> & reachable)
+{
+  std::vector<int> block(table.rows, -1);
+  {
+    std::map<int, int> outputs;
+    for (auto s : reachable)
+      block[s] = outputs.emplace(output_of(s), outputs.size()).first->second;
+  }
+
+  for (size_t nblocks = 0; ; ) {
+    std::map<std::vector<int>, int> signatures;
+    std::vector<int> split(table.rows, -1);
+    for (auto s : reachable) {
+      std::vector<int> sig{block[s]};
+      for (int c=0; c<table.cols; ++c) sig.push_back(block[table(s, c)]);
+      split[s] = signatures.emplace(std::move(sig), signatures.size()).first->second;
+    }
+    block = std::move(split);
+    if (signatures.size() == nblocks) break;
+    nblocks = signatures.size();
+  }
+  return block;
+}
+
+compiled_fsm_t compile_fsm(const machine_t & table, std::string_view sample)
+{
+  // the states reached from the reject state, in the order they are reached
+  std::vector<int> reachable{S_REJECT};
+  std::vector<bool> seen(table.rows);
+  seen[S_REJECT] = true;
+  for (size_t i=0; i<reachable.size(); ++i)
+    for (int c=0; c<table.cols; ++c) {
+      auto t = table(reachable[i], c);
+      if (!seen[t]) {
+        seen[t] = true;
+        reachable.push_back(t);
+      }
+    }
+
+  // one state for each block, standing for the first state reached in it
+  auto block = merge_states(table, reachable);
+  std::vector<int> states;
+  std::vector<bool> taken(reachable.size());
+  for (auto s : reachable)
+    if (!taken[block[s]]) {
+      taken[block[s]] = true;
+      states.push_back(s);
+    }
+
+  // classes that every state treats alike
+  std::vector<int> class_of(table.cols);
+  std::map<std::vector<int>, int> columns;
+  for (int c=0; c<table.cols; ++c) {
+    std::vector<int> column;
+    for (auto s : states) column.push_back(block[table(s, c)]);
+    class_of[c] = columns.emplace(std::move(column), columns.size()).first->second;
+  }
+
+  compiled_fsm_t fsm;
+  if (states.size() >= 0xff || columns.size() > 0xff) return fsm;
+  fsm.num_states = states.size();
+  fsm.num_classes = columns.size();
+  for (int b=0; b<256; ++b)
+    fsm.classes[b] = class_of[classify_char(static_cast<char>(b))];
+
+  // the transitions between blocks, to count the visits to each
+  std::vector<uint8_t> next(states.size() * fsm.num_classes);
+  for (size_t i=0; i<states.size(); ++i)
+    for (int c=0; c<table.cols; ++c)
+      next[block[states[i]]*fsm.num_classes + class_of[c]] = block[table(states[i], c)];
+
+  std::vector<size_t> visits(states.size());
+  auto state = block[S_REJECT];
+  for (auto ch : sample) {
+    state = next[state*fsm.num_classes + fsm.classes[static_cast<uint8_t>(ch)]];
+    visits[state]++;
+  }
+
+  // the hottest first, ties in the order they were reached, reject as 0
+  std::vector<int> order(states.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+    [&](int a, int b) { return visits[a] > visits[b]; });
+  std::stable_partition(order.begin(), order.end(),
+    [&](int a) { return a == block[S_REJECT]; });
+
+  std::vector<int> number(states.size());
+  for (size_t i=0; i<order.size(); ++i) number[order[i]] = i;
+
+  fsm.states.resize(states.size());
+  fsm.compact.assign(table.rows, -1);
+  for (auto s : reachable) fsm.compact[s] = number[block[s]];
+  for (auto s : states) fsm.states[number[block[s]]] = s;
+
+  fsm.next.resize(next.size());
+  for (size_t b=0; b<states.size(); ++b)
+    for (int c=0; c<fsm.num_classes; ++c)
+      fsm.next[number[b]*fsm.num_classes + c] = number[next[b*fsm.num_classes + c]];
+
+  return fsm;
+}
+
+//==============================================================================
+/// Row displacement.  Each state keeps its most common target as a default,
+/// and its other cells are slid along one shared array, the fullest rows
+/// first, until they land on free slots.  check holds the state that owns a
+/// slot.
+//==============================================================================
+fsm_comb_t::fsm_comb_t(const compiled_fsm_t & fsm)
+{
+  auto nclass = fsm.num_classes;
+  base.resize(fsm.num_states);
+  fallback.resize(fsm.num_states);
+
+  std::vector<std::vector<int>> cells(fsm.num_states);
+  for (int s=0; s<fsm.num_states; ++s) {
+    std::map<int, int> counts;
+    for (int c=0; c<nclass; ++c) counts[fsm(s, c)]++;
+    fallback[s] = std::max_element(counts.begin(), counts.end(),
+      [](auto & a, auto & b) { return a.second < b.second; })->first;
+    for (int c=0; c<nclass; ++c)
+      if (fsm(s, c) != fallback[s]) cells[s].push_back(c);
+  }
+
+  std::vector<int> order(fsm.num_states);
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+    [&](int a, int b) { return cells[a].size() > cells[b].size(); });
+
+  // slots past the last base are never owned, so any class can be looked up
+  constexpr uint8_t unowned = 0xff;
+  for (auto s : order) {
+    size_t b = 0;
+    auto fits = [&]() {
+      for (auto c : cells[s])
+        if (b + c < check.size() && check[b + c] != unowned) return false;
+      return true;
+    };
+    while (!fits()) b++;
+    base[s] = b;
+    if (check.size() < b + nclass) {
+      check.resize(b + nclass, unowned);
+      next.resize(b + nclass);
+    }
+    for (auto c : cells[s]) {
+      check[b + c] = s;
+      next[b + c] = fsm(s, c);
+    }
+  }
+}
+
+} // namespace
@@ -0,0 +1,98 @@
+#ifndef CONTRA_FSM_TABLES_HPP
+#define CONTRA_FSM_TABLES_HPP
+
+#include "lex.hpp"
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace lex {
+
+//==============================================================================
+/// The FSM lexer's machine after compiling its table.  Unreachable states are
+/// dropped, states that lead to the same tokens are merged, and so are the
+/// character classes that no state tells apart.  The states are then numbered
+/// by how often a sample of input visits them, hottest first, with the reject
+/// state as 0.  Each state keeps one of the states of the table it stands for.
+//==============================================================================
+struct compiled_fsm_t {
+  int num_states = 0;
+  int num_classes = 0;
+  /// The merged class of every byte
+  std::array<uint8_t, 256> classes{};
+  /// The state of the table each state stands for, and back (-1 if dropped)
+  std::vector<int> states;
+  std::vector<int> compact;
+  /// The transitions, num_classes to a row
+  std::vector<uint8_t> next;
+
+  int operator()(int s, int c) const { return next[s*num_classes + c]; }
+  size_t bytes() const { return next.size(); }
+};
+
+/// Compile a table, counting the visits to each state over sample to number
+/// them; without one they are numbered in the order they are reached
+compiled_fsm_t compile_fsm(const machine_t & table, std::string_view sample = {});
+
+//==============================================================================
+/// Layouts of the compiled transitions, all looked up with (s,c).  The dense
+/// one pads rows to a power of two; the comb keeps a default per state and
+/// packs the other cells of all rows into one array by row displacement.
+//==============================================================================
+template<typename T>
+struct fsm_dense_t {
+  int shift = 0;
+  std::vector<T> table;
+
+  explicit fsm_dense_t(const compiled_fsm_t & fsm)
+  {
+    while ((1 << shift) < fsm.num_classes) shift++;
+    table.resize(size_t(fsm.num_states) << shift);
+    for (int s=0; s<fsm.num_states; ++s)
+      for (int c=0; c<fsm.num_classes; ++c)
+        table[(s << shift) | c] = fsm(s, c);
+  }
+
+  int operator()(int s, int c) const { return table[(s << shift) | c]; }
+  size_t bytes() const { return table.size() * sizeof(T); }
+};
+
+struct fsm_comb_t {
+  std::vector<uint16_t> base;
+  std::vector<uint8_t> fallback;
+  std::vector<uint8_t> next;
+  std::vector<uint8_t> check;
+
+  explicit fsm_comb_t(const compiled_fsm_t & fsm);
+
+  int operator()(int s, int c) const
+  {
+    auto i = base[s] + c;
+    return check[i] == s ? next[i] : fallback[s];
+  }
+
+  size_t bytes() const
+  {
+    return base.size()*sizeof(uint16_t) + fallback.size() + next.size() +
+      check.size();
+  }
+};
+
+/// FSM lexer function running a compiled table in one of its layouts
+int fsm_lex(
+  stream_t & stream,
+  const compiled_fsm_t & fsm,
+  const fsm_dense_t<uint8_t> & table,
+  lexed_t & lx);
+
+int fsm_lex(
+  stream_t & stream,
+  const compiled_fsm_t & fsm,
+  const fsm_comb_t & table,
+  lexed_t & lx);
+
+} // namespace
+
+#endif // CONTRA_FSM_TABLES_HPP
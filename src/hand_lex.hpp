@@ -0,0 +1,269 @@
+#ifndef CONTRA_HAND_LEX_HPP
+#define CONTRA_HAND_LEX_HPP
+
+//==============================================================================
+// The bodies of hand_lex and hand_simd_lex.  Including this header lets them
+// be instantiated and inlined for any sink, not only those of FOR_LEX_SINKS,
+// which the library already instantiates.
+//==============================================================================
+
+#include "errors.hpp"
+#include "keywords.hpp"
+#include "lex.hpp"
+#include "simd.hpp"
+#include "stream.hpp"
+#include "utils.hpp"
+
+#include <cctype>
+#include <tuple>
+
+namespace lex {
+
+//==============================================================================
+/// Character tests and runs one byte at a time through <cctype>
+//==============================================================================
+struct ctype_scan_t {
+  static bool is_alpha(char c) { return std::isalpha(c); }
+  static bool is_digit(char c) { return std::isdigit(c); }
+
+  static size_t space(const char * p)
+  {
+    size_t n = 0;
+    while (std::isspace(p[n])) n++;
+    return n;
+  }
+  static size_t alnum(const char * p)
+  {
+    size_t n = 0;
+    while (std::isalnum(p[n]) || p[n]=='_') n++;
+    return n;
+  }
+  static size_t digits(const char * p)
+  {
+    size_t n = 0;
+    while (std::isdigit(p[n])) n++;
+    return n;
+  }
+};
+
+inline std::tuple<int,size_t,int>
+a_or_ab(
+  const char * buffer,
+  size_t cur,
+  int NextSym,
+  int NextLabel,
+  int err)
+{
+  auto tok = buffer[cur];
+  auto LastChar = buffer[++cur];
+  if (LastChar == NextSym)
+    return {NextLabel, ++cur, err};
+  else
+    return {tok, cur, err};
+}
+  
+//==============================================================================
+/// gettok - Return the next token from standard input.
+//==============================================================================
+template<typename Scan>
+std::tuple<int,size_t,int>
+gettok( stream_t & is, diagnostics_t * diag, size_t cur )
+{
+  auto buffer = is.buffer.data();
+  auto LastChar = buffer[cur];
+  int err = 0;
+  
+  //----------------------------------------------------------------------------
+  // identifier: [a-zA-Z][a-zA-Z0-9]*, or a keyword
+  if (Scan::is_alpha(LastChar)) {
+     
+    auto start = cur;
+    cur += 1 + Scan::alnum(buffer + cur + 1);
+
+    return {keyword_kind(buffer + start, cur - start), cur, err};
+  }
+  
+  //----------------------------------------------------------------------------
+  // Number: [0-9.]+
+
+  if (Scan::is_digit(LastChar) || (LastChar == '.' && Scan::is_digit(buffer[cur+1]))) {
+
+    // read first part of number, runs of digits separated by '.'
+    int numDec = (LastChar == '.');
+    while (true) {
+      cur += 1 + Scan::digits(buffer + cur + 1);
+      LastChar = buffer[cur];
+      if (LastChar != '.') break;
+      if (numDec == 1)
+        err += error( is, diag, ERR_MULTIPLE_DOTS, cur );
+      numDec++;
+    }
+
+    bool is_float = numDec;
+
+    if (LastChar == 'e' || LastChar == 'E') {
+      is_float = true;
+      // eat e/E
+      LastChar = buffer[++cur];
+      // make sure next character is sign or number
+      auto isSign = (LastChar == '+') || (LastChar == '-');
+      if (!isSign && !Scan::is_digit(LastChar))
+        err += error( is, diag, ERR_EXPONENT, cur );
+      // eat sign or number
+      LastChar = buffer[++cur];
+      // if it was a sign, there has to be a number
+      if (isSign && !Scan::is_digit(LastChar))
+        err += error( is, diag, ERR_EXPONENT_SIGN, cur );
+      // only numbers should follow
+      cur += Scan::digits(buffer + cur);
+    }
+    auto tok = is_float ? LEX_REAL : LEX_INT;
+    return {tok, cur, err};
+  }
+
+  switch (LastChar) {
+
+  //----------------------------------------------------------------------------
+  // Comment until end of line.
+  case '#':
+  
+    do {
+      LastChar = buffer[++cur];
+    } while (LastChar != '\0' && LastChar != '\n' && LastChar != '\r');
+
+    return {LEX_COMMENT, cur, err};
+  
+  
+  //----------------------------------------------------------------------------
+  // string literal
+  case '\"':
+      
+    LastChar = buffer[++cur];
+
+    while (LastChar != '\"' && LastChar != '\0')
+      LastChar = buffer[++cur];
+
+    // an unterminated literal ends at the padding, not past it
+    if (LastChar == '\0') {
+      err += error( is, diag, ERR_UNTERMINATED, cur );
+      return {LEX_QUOTED, cur, err};
+    }
+
+    return {LEX_QUOTED, ++cur, err};
+  
+  //----------------------------------------------------------------------------
+  // Operators
+
+  case '+': return a_or_ab(buffer, cur, '=', LEX_ADD_EQ, err);
+  case '-': return a_or_ab(buffer, cur, '=', LEX_SUB_EQ, err);
+  case '*': return a_or_ab(buffer, cur, '=', LEX_MUL_EQ, err);
+  case '/': return a_or_ab(buffer, cur, '=', LEX_DIV_EQ, err);
+  case '=': return a_or_ab(buffer, cur, '=', LEX_EQUIV, err);
+  case '!': return a_or_ab(buffer, cur, '=', LEX_NE, err);
+  case '<': return a_or_ab(buffer, cur, '=', LEX_LE, err);
+  case '>': return a_or_ab(buffer, cur, '=', LEX_GE, err);
+  
+  }
+
+  //----------------------------------------------------------------------------
+  // Otherwise, just return the character as its ascii value.
+  return {LastChar, ++cur, err};
+}
+
+//==============================================================================
+// Find the next token that starts before the end of the cursor
+//==============================================================================
+template<typename Scan>
+bool next_hand_token(cursor_t & c, token_t & tok)
+{
+  auto buffer = c.stream.buffer.data();
+
+  while (c.pos < c.last)
+  {
+    // Skip any whitespace.
+    c.pos += Scan::space(buffer + c.pos);
+
+    if (c.pos >= c.last) break;
+
+    // get the next token
+    auto beg = c.pos;
+    int e, kind;
+    std::tie(kind, c.pos, e) = gettok<Scan>(c.stream, c.diagnostics, c.pos);
+    c.err += e;
+    auto end = c.pos;
+
+    // bytes above 127 come back negative and are skipped
+    if (kind < 0) continue;
+
+    tok.kind = kind;
+    tok.pos = {beg, end};
+
+    // remove quotes, of which an unterminated literal has only the first
+    if (kind == LEX_QUOTED) {
+      beg++;
+      if (end > beg && c.stream.buffer[end-1] == '\"') end--;
+    }
+
+    tok.text = has_text(kind) ?
+      c.stream.buffer.substr(beg, end - beg) : std::string_view();
+    return true;
+  }
+
+  return false;
+}
+
+//==============================================================================
+// Generate the tokens that start in [first, last)
+//==============================================================================
+template<typename Scan, typename Sink>
+int hand_lex_range(
+  stream_t & in,
+  Sink & out,
+  size_t first,
+  size_t last,
+  size_t & stop)
+{
+  error_sink_t sink(in, out.diagnostics);
+  cursor_t cursor(in, first, last);
+  cursor.diagnostics = sink.diagnostics;
+  token_t tok;
+  while (next_hand_token<Scan>(cursor, tok))
+    out.on_token(tok.kind, tok.pos, tok.text);
+  stop = cursor.stop();
+  return cursor.err;
+}
+
+template<typename Sink>
+int hand_lex(
+  stream_t & in,
+  Sink & out,
+  size_t first,
+  size_t last,
+  size_t & stop)
+{ return hand_lex_range<ctype_scan_t>(in, out, first, last, stop); }
+
+//==============================================================================
+// The same lexer with the character runs measured by vector kernels
+//==============================================================================
+template<typename Sink>
+int hand_simd_lex(
+  stream_t & in,
+  Sink & out,
+  size_t first,
+  size_t last,
+  size_t & stop)
+{
+  static const auto level = detect_simd();
+  switch (level) {
+  case simd_level_t::avx2:
+    return hand_lex_range<avx2_scan_t>(in, out, first, last, stop);
+  case simd_level_t::sse42:
+    return hand_lex_range<sse42_scan_t>(in, out, first, last, stop);
+  default:
+    return hand_lex_range<ascii_scan_t>(in, out, first, last, stop);
+  }
+}
+
+} // namespace
+
+#endif // CONTRA_HAND_LEX_HPP
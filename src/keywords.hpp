@@ -0,0 +1,87 @@
+#ifndef CONTRA_KEYWORDS_HPP
+#define CONTRA_KEYWORDS_HPP
+
+#include "lex.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+namespace lex {
+
+//==============================================================================
+/// A perfect hash of FOR_LEX_KEYWORDS, built by the compiler.  A word is
+/// hashed from its length and its first, second and last characters, which
+/// a lexer has at hand when an identifier ends, so at most one keyword is
+/// compared against it.  The multiplier is searched for at compile time
+/// until no two keywords share a slot.
+//==============================================================================
+constexpr int keyword_bits = 6;
+constexpr size_t keyword_slots = size_t(1) << keyword_bits;
+
+struct keyword_t {
+  std::string_view word;
+  int kind = LEX_IDENT;
+};
+
+struct keyword_table_t {
+  keyword_t slots[keyword_slots];
+  uint32_t seed = 0;
+  size_t max_len = 0;
+};
+
+constexpr keyword_t keyword_list[] = {
+#define KEYWORD_ENTRY(name, str) {str, name},
+  FOR_LEX_KEYWORDS(KEYWORD_ENTRY)
+#undef KEYWORD_ENTRY
+};
+
+static_assert(2*std::size(keyword_list) <= keyword_slots,
+  "keyword_bits is too small for FOR_LEX_KEYWORDS");
+
+constexpr uint32_t keyword_hash(const char * str, size_t len, uint32_t seed)
+{
+  uint32_t key = uint8_t(str[0]) | uint32_t(uint8_t(str[len > 1])) << 8 |
+    uint32_t(uint8_t(str[len-1])) << 16 | uint32_t(len) << 24;
+  return (key * seed) >> (32 - keyword_bits);
+}
+
+constexpr keyword_table_t make_keyword_table()
+{
+  for (uint32_t seed = 0x9e3779b1; seed < 0x9e3779b1 + 20000; seed += 2) {
+    keyword_table_t table;
+    bool ok = true;
+    for (auto & kw : keyword_list) {
+      auto & slot = table.slots[keyword_hash(kw.word.data(), kw.word.size(), seed)];
+      if (slot.word.size()) {
+        ok = false;
+        break;
+      }
+      slot = kw;
+      if (kw.word.size() > table.max_len) table.max_len = kw.word.size();
+    }
+    if (ok) {
+      table.seed = seed;
+      return table;
+    }
+  }
+  return {};
+}
+
+constexpr keyword_table_t keyword_table = make_keyword_table();
+
+static_assert(keyword_table.seed, "no perfect hash for FOR_LEX_KEYWORDS");
+
+/// The kind of an identifier that has just been lexed: its keyword, or
+/// LEX_IDENT
+inline int keyword_kind(const char * str, size_t len)
+{
+  if (len > keyword_table.max_len) return LEX_IDENT;
+  auto & kw = keyword_table.slots[keyword_hash(str, len, keyword_table.seed)];
+  return (kw.word.size() == len && std::memcmp(kw.word.data(), str, len) == 0) ?
+    kw.kind : LEX_IDENT;
+}
+
+} // namespace
+
+#endif // CONTRA_KEYWORDS_HPP
@@ -3,12 +3,78 @@
 #include "stream.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
+#include <charconv>
+#include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <functional>
 #include <iostream>
 #include <iomanip>
 
 namespace lex {
-  
+
+lexed_t::lexed_t(std::pmr::memory_resource * resource) :
+  tokens(resource),
+  token_pos(resource),
+  compact_pos(resource),
+  identifier_data(resource),
+  identifier_offsets(resource),
+  identifier_tokens(resource),
+  identifier_bits(resource),
+  identifier_rank(resource),
+  identifier_symbols(resource),
+  symbol_hashes(resource),
+  symbol_slots(resource),
+  identifier_values(resource),
+  identifier_overflow(resource)
+{}
+
+/// Reserve for the tokens of an input, nearly all of which carry text in
+/// the usual mix.  The strings take about as many bytes as the input unless
+/// they are interned.
+void lexed_t::reserve(size_t bytes)
+{
+  auto ntoks = bytes / lex_bytes_per_token + 1;
+  tokens.reserve(ntoks);
+  if (compact)
+    compact_pos.reserve(ntoks);
+  else
+    token_pos.reserve(ntoks);
+  identifier_bits.reserve(ntoks/64 + 1);
+  identifier_rank.reserve(ntoks/64 + 1);
+  identifier_tokens.reserve(ntoks);
+  if (intern)
+    identifier_symbols.reserve(ntoks);
+  else {
+    identifier_data.reserve(bytes);
+    identifier_offsets.reserve(ntoks);
+  }
+  if (decode) {
+    identifier_values.reserve(ntoks);
+    identifier_overflow.reserve(ntoks);
+  }
+}
+
+/// The symbol table keeps its size, emptied, so it need not grow again
+void lexed_t::reset()
+{
+  tokens.clear();
+  token_pos.clear();
+  compact_pos.clear();
+  identifier_data.clear();
+  identifier_offsets.clear();
+  identifier_tokens.clear();
+  identifier_bits.clear();
+  identifier_rank.clear();
+  identifier_symbols.clear();
+  symbol_hashes.clear();
+  symbol_slots.assign(symbol_slots.size(), -1);
+  identifier_values.clear();
+  identifier_overflow.clear();
+  diagnostics.clear();
+}
+
 /// Get an identifier string
 std::string_view lexed_t::getIdentifierString(int i) const
 { 
@@ -18,91 +84,370 @@ std::string_view lexed_t::getIdentifierString(int i) const
   return std::string_view(identifier_data).substr(beg, len);
 }
 
-/// Find an identifier from a token
-int lexed_t::findIdentifier(int tok) const
+/// Find or insert a string in the symbol table.  The table is open
+/// addressed and kept at most half full; the hashes are kept so growing it
+/// never touches the strings.
+int lexed_t::internSymbol(std::string_view str, size_t hash)
+{
+  auto nsyms = symbol_hashes.size();
+
+  if (2*(nsyms+1) > symbol_slots.size()) {
+    std::pmr::vector<int> slots(std::max<size_t>(64, 2*symbol_slots.size()), -1,
+      symbol_slots.get_allocator());
+    auto mask = slots.size() - 1;
+    for (size_t s=0; s<nsyms; ++s) {
+      auto i = symbol_hashes[s] & mask;
+      while (slots[i] >= 0) i = (i+1) & mask;
+      slots[i] = s;
+    }
+    symbol_slots = std::move(slots);
+  }
+
+  auto mask = symbol_slots.size() - 1;
+  auto i = hash & mask;
+  while (symbol_slots[i] >= 0) {
+    auto s = symbol_slots[i];
+    if (symbol_hashes[s] == hash && getIdentifierString(s) == str)
+      return s;
+    i = (i+1) & mask;
+  }
+
+  identifier_data += str;
+  identifier_offsets.push_back(identifier_data.size());
+  symbol_hashes.push_back(hash);
+  symbol_slots[i] = nsyms;
+  return nsyms;
+}
+
+/// Hash the symbols again and rebuild their table, after they were filled in
+/// from somewhere else
+void lexed_t::rehashSymbols()
+{
+  auto nsyms = numSymbols();
+  symbol_hashes.resize(nsyms);
+  for (size_t s=0; s<nsyms; ++s)
+    symbol_hashes[s] = std::hash<std::string_view>()(getIdentifierString(s));
+
+  size_t nslots = 64;
+  while (2*(nsyms+1) > nslots) nslots *= 2;
+  symbol_slots.assign(nslots, -1);
+  auto mask = nslots - 1;
+  for (size_t s=0; s<nsyms; ++s) {
+    auto i = symbol_hashes[s] & mask;
+    while (symbol_slots[i] >= 0) i = (i+1) & mask;
+    symbol_slots[i] = s;
+  }
+}
+
+//==============================================================================
+/// Decode a number with from_chars, which neither allocates nor looks at the
+/// locale.  Only a real out of range goes through strtod, to tell overflow
+/// from underflow.
+//==============================================================================
+number_value_t decode_number(int kind, std::string_view text, bool & overflow)
+{
+  number_value_t value;
+  value.i = 0;
+  overflow = false;
+
+  auto first = text.data(), last = text.data() + text.size();
+
+  if (kind == LEX_REAL) {
+    value.d = 0;
+    auto res = std::from_chars(first, last, value.d);
+    if (res.ec == std::errc::result_out_of_range) {
+      std::string str(first, res.ptr);
+      value.d = std::strtod(str.c_str(), nullptr);
+      overflow = std::isinf(value.d);
+    }
+    return value;
+  }
+
+  int base;
+  switch (kind) {
+  case LEX_INT:   base = 10; break;
+  case LEX_OCTAL: base = 8; break;
+  case LEX_HEX:   base = 16; first = std::min(first + 2, last); break;
+  default:        return value;
+  }
+
+  std::from_chars_result res;
+  if (base == 10)
+    res = std::from_chars(first, last, value.i);
+  else {
+    uint64_t bits = 0;
+    res = std::from_chars(first, last, bits, base);
+    value.i = bits;
+  }
+
+  if (res.ec == std::errc::result_out_of_range) {
+    overflow = true;
+    value.i = (base == 10) ? INT64_MAX : -1;
+  }
+  return value;
+}
+
+/// The values of the numbers of other, decoded again if it did not decode
+static void values_of(
+  const lexed_t & other,
+  std::pmr::vector<number_value_t> & values,
+  std::pmr::vector<bool> & overflow)
 {
-  auto it = std::lower_bound(identifier_tokens.begin(), identifier_tokens.end(), tok);
-  if (it != identifier_tokens.end() && (*it == tok))
-    return std::distance(identifier_tokens.begin(), it);
-  return -1;
+  if (other.decode) {
+    values = other.identifier_values;
+    overflow = other.identifier_overflow;
+    return;
+  }
+
+  auto n = other.numIdentifiers();
+  values.resize(n);
+  overflow.resize(n);
+  for (size_t i=0; i<n; ++i) {
+    auto id = other.intern ? other.identifier_symbols[i] : i;
+    bool over;
+    values[i] = decode_number(
+      other.tokens[other.identifier_tokens[i]], other.getIdentifierString(id), over);
+    overflow[i] = over;
+  }
 }
 
 /// Add the identifier string
-void lexed_t::add(int token, stream_pos_t pos, const std::string & identifier)
+void lexed_t::add(int token, stream_pos_t pos, std::string_view identifier)
 {
+    auto ntoks = tokens.size();
+    if ((ntoks & 63) == 0) {
+      identifier_bits.push_back(0);
+      identifier_rank.push_back(identifier_tokens.size());
+    }
+
     if (identifier.size()) {
-      auto nidents = identifier_offsets.size();
-      auto ntoks = tokens.size();
       // try to insert the identifier
-      identifier_data += identifier;
-      identifier_offsets.push_back(identifier_data.size());
+      if (intern) {
+        auto hash = std::hash<std::string_view>()(identifier);
+        identifier_symbols.push_back( internSymbol(identifier, hash) );
+      }
+      else {
+        identifier_data += identifier;
+        identifier_offsets.push_back(identifier_data.size());
+      }
       // add the token mapping
+      identifier_bits.back() |= uint64_t(1) << (ntoks & 63);
       identifier_tokens.push_back(ntoks);
+      if (decode) {
+        bool overflow;
+        identifier_values.push_back(decode_number(token, identifier, overflow));
+        identifier_overflow.push_back(overflow);
+      }
     }
     tokens.push_back( token );
-    token_pos.emplace_back( pos );
+    if (compact)
+      compact_pos.push_back( pos );
+    else
+      token_pos.emplace_back( pos );
 }
 
+/// Append the results of lexing a later part of the same stream
+void lexed_t::append(const lexed_t & other)
+{
+  auto ntoks = tokens.size();
+  auto ndata = identifier_data.size();
 
-//==============================================================================
-// Lexer output operator
-//==============================================================================
-void print(std::ostream& os, const lexed_t & res)
+  // the bits of other are generally not word aligned here
+  int nids = identifier_tokens.size();
+  for (size_t t=0; t<other.numTokens(); ++t) {
+    auto i = ntoks + t;
+    if ((i & 63) == 0) {
+      identifier_bits.push_back(0);
+      identifier_rank.push_back(nids);
+    }
+    if (other.hasIdentifier(t)) {
+      identifier_bits.back() |= uint64_t(1) << (i & 63);
+      nids++;
+    }
+  }
+
+  tokens.insert(tokens.end(), other.tokens.begin(), other.tokens.end());
+  if (!compact && !other.compact)
+    token_pos.insert(token_pos.end(), other.token_pos.begin(), other.token_pos.end());
+  else
+    for (size_t t=0; t<other.numTokens(); ++t) {
+      if (compact)
+        compact_pos.push_back(other.tokenPos(t));
+      else
+        token_pos.push_back(other.tokenPos(t));
+    }
+  diagnostics.append(other.diagnostics);
+
+  if (intern && other.intern) {
+    // map the other symbols into this table, hashing nothing again
+    std::vector<int> symbols(other.numSymbols());
+    for (size_t s=0; s<symbols.size(); ++s)
+      symbols[s] = internSymbol(other.getIdentifierString(s), other.symbol_hashes[s]);
+    for (auto s : other.identifier_symbols)
+      identifier_symbols.push_back(symbols[s]);
+  }
+  else if (!intern && !other.intern) {
+    identifier_data += other.identifier_data;
+    for (auto off : other.identifier_offsets)
+      identifier_offsets.push_back(off + ndata);
+  }
+  else {
+    for (size_t i=0; i<other.numIdentifiers(); ++i) {
+      auto id = other.intern ? other.identifier_symbols[i] : i;
+      auto str = other.getIdentifierString(id);
+      if (intern) {
+        auto hash = std::hash<std::string_view>()(str);
+        identifier_symbols.push_back( internSymbol(str, hash) );
+      }
+      else {
+        identifier_data += str;
+        identifier_offsets.push_back(identifier_data.size());
+      }
+    }
+  }
+
+  for (auto tok : other.identifier_tokens)
+    identifier_tokens.push_back(tok + ntoks);
+
+  if (decode) {
+    std::pmr::vector<number_value_t> values;
+    std::pmr::vector<bool> overflow;
+    if (!other.decode) values_of(other, values, overflow);
+    auto & from = other.decode ? other.identifier_values : values;
+    auto & from_overflow = other.decode ? other.identifier_overflow : overflow;
+    identifier_values.insert(identifier_values.end(), from.begin(), from.end());
+    identifier_overflow.insert(identifier_overflow.end(),
+      from_overflow.begin(), from_overflow.end());
+  }
+}
+
+/// Replace v[first, last) with [from, to), moving the rest only once
+template<typename Vector, typename It>
+static void replace(Vector & v, size_t first, size_t last, It from, It to)
 {
-  auto n = res.tokens.size();
-  int digits = count_digits(n);
-  auto aw = std::max(digits+1, 7);
-  auto bw = 6;
-  auto cw = 14;
-  auto dw = std::max(bw, 8);
-  auto ew = 4*aw;
-
-  printRight(os, aw, ' ', "TokenId");
-  printRight(os, 2, ' ');
-  printRight(os, bw, ' ', "TypeId");
-  printRight(os, 2, ' ');
-  printRight(os, cw, ' ', "TypeString");
-  printRight(os, 2, ' ');
-  printRight(os, dw, ' ', "IndentId");
-  printRight(os, 2, ' ');
-  printLeft (os, ew, ' ', "IdentString");
-  os << std::endl;
-
-  printRight(os, aw, '-');
-  printRight(os, 2, ' ');
-  printRight(os, bw, '-');
-  printRight(os, 2, ' ');
-  printRight(os, cw, '-');
-  printRight(os, 2, ' ');
-  printRight(os, dw, '-');
-  printRight(os, 2, ' ');
-  printLeft (os, ew, '-');
-  os << std::endl;
+  size_t n = std::distance(from, to);
+  if (n > last - first)
+    v.insert(v.begin() + last, n - (last - first), typename Vector::value_type());
+  else
+    v.erase(v.begin() + first + n, v.begin() + last);
+  std::copy(from, to, v.begin() + first);
+}
 
-  for (size_t i=0; i<n; ++i) {
-    auto id = res.findIdentifier(i);
-    auto tyid = res.tokens[i];
-    auto tystr = lex_to_str(tyid);
-    
-    std::stringstream ss;
-    if (id>=0)
-      ss << "\"" << res.getIdentifierString(id) << "\"";
-
-    printRight(os, aw, ' ', i);
-    printRight(os, 2, ' ');
-    printRight(os, bw, ' ', tyid);
-    printRight(os, 2, ' ');
-    printRight(os, cw, ' ', tystr);
-    printRight(os, 2, ' ');
-    if (id>=0)
-      printRight(os, dw, ' ', id);
-    else
-      printRight(os, dw, ' ');
-    printRight(os, 2, ' ');
-    printLeft (os, ew, ' ', ss.str());
-    os << std::endl;
+/// Replace the tokens in [first, last) with all of the tokens of other, and
+/// move the positions of those after them
+void lexed_t::splice(
+  size_t first,
+  size_t last,
+  const lexed_t & other,
+  std::ptrdiff_t moved)
+{
+  auto & ids = identifier_tokens;
+  size_t ifirst = std::lower_bound(ids.begin(), ids.end(), int(first)) - ids.begin();
+  size_t ilast = std::lower_bound(ids.begin(), ids.end(), int(last)) - ids.begin();
+  auto nids = other.numIdentifiers();
+  int shift = int(other.numTokens()) - int(last - first);
+
+  // the tokens and their positions
+  replace(tokens, first, last, other.tokens.begin(), other.tokens.end());
+  if (compact) {
+    // the compact positions go in order, so they are written out again,
+    // moving the ones after the splice on the way
+    auto ntoks = compact_pos.size();
+    compact_positions_t spliced(compact_pos.words.get_allocator().resource());
+    spliced.reserve(ntoks + other.numTokens() - (last - first));
+    for (size_t t=0; t<first; ++t) spliced.push_back(compact_pos[t]);
+    for (size_t t=0; t<other.numTokens(); ++t) spliced.push_back(other.tokenPos(t));
+    for (auto t=last; t<ntoks; ++t) {
+      auto pos = compact_pos[t];
+      spliced.push_back({pos.begin + moved, pos.end + moved});
+    }
+    compact_pos = std::move(spliced);
+  }
+  else {
+    if (!other.compact)
+      replace(token_pos, first, last, other.token_pos.begin(), other.token_pos.end());
+    else {
+      std::vector<stream_pos_t> pos(other.numTokens());
+      for (size_t t=0; t<pos.size(); ++t) pos[t] = other.tokenPos(t);
+      replace(token_pos, first, last, pos.begin(), pos.end());
+    }
+    if (moved)
+      for (auto t=first+other.numTokens(); t<token_pos.size(); ++t) {
+        token_pos[t].begin += moved;
+        token_pos[t].end += moved;
+      }
   }
 
+  // their strings, or symbols when interning
+  auto string_of = [&](size_t i) {
+    return other.getIdentifierString(other.intern ? other.identifier_symbols[i] : i);
+  };
+
+  if (intern) {
+    std::vector<int> symbols(nids);
+    for (size_t i=0; i<nids; ++i) {
+      auto str = string_of(i);
+      auto hash = other.intern ?
+        other.symbol_hashes[other.identifier_symbols[i]] :
+        std::hash<std::string_view>()(str);
+      symbols[i] = internSymbol(str, hash);
+    }
+    replace(identifier_symbols, ifirst, ilast, symbols.begin(), symbols.end());
+  }
+  else {
+    int beg = ifirst ? identifier_offsets[ifirst-1] : 0;
+    int end = ilast ? identifier_offsets[ilast-1] : 0;
+    std::string data;
+    std::vector<int> offsets(nids);
+    for (size_t i=0; i<nids; ++i) {
+      data += string_of(i);
+      offsets[i] = beg + data.size();
+    }
+    identifier_data.replace(beg, end - beg, data);
+    replace(identifier_offsets, ifirst, ilast, offsets.begin(), offsets.end());
+
+    int grow = int(data.size()) - (end - beg);
+    if (grow)
+      for (auto i=ifirst+nids; i<identifier_offsets.size(); ++i)
+        identifier_offsets[i] += grow;
+  }
+
+  // their values
+  if (decode) {
+    std::pmr::vector<number_value_t> values;
+    std::pmr::vector<bool> overflow;
+    values_of(other, values, overflow);
+    replace(identifier_values, ifirst, ilast, values.begin(), values.end());
+    replace(identifier_overflow, ifirst, ilast, overflow.begin(), overflow.end());
+  }
+
+  // the tokens they belong to
+  replace(ids, ifirst, ilast,
+    other.identifier_tokens.begin(), other.identifier_tokens.end());
+  for (auto i=ifirst; i<ifirst+nids; ++i) ids[i] += first;
+  if (shift)
+    for (auto i=ifirst+nids; i<ids.size(); ++i) ids[i] += shift;
+
+  // and the bits that find them, which only change past the edit when the
+  // number of tokens or identifiers did
+  auto nwords = (tokens.size() + 63) / 64;
+  auto word = first >> 6;
+  auto last_word = (shift || nids != ilast - ifirst) ?
+    nwords : std::min(nwords, (first + other.numTokens() + 63) >> 6);
+
+  identifier_bits.resize(nwords);
+  identifier_rank.resize(nwords);
+  std::fill(identifier_bits.begin() + word, identifier_bits.begin() + last_word, 0);
+
+  auto from = std::lower_bound(ids.begin(), ids.end(), int(word << 6));
+  for (auto it=from; it!=ids.end() && size_t(*it >> 6) < last_word; ++it)
+    identifier_bits[*it >> 6] |= uint64_t(1) << (*it & 63);
+
+  int rank = from - ids.begin();
+  for (auto w=word; w<last_word; ++w) {
+    identifier_rank[w] = rank;
+    rank += __builtin_popcountll(identifier_bits[w]);
+  }
 }
- 
+
 } // namespace
@@ -1,11 +1,21 @@
 #ifndef CONTRA_LEXER_HPP
 #define CONTRA_LEXER_HPP
 
+#include "errors.hpp"
+#include "stream.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstdint>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <limits>
+#include <memory_resource>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
@@ -31,18 +41,29 @@
   DO( LEX_INC,    "++" ) \
   DO( LEX_DEC,    "--" ) \
   DO( LEX_EOF,    "EOF")
+#define FOR_LEX_KEYWORDS(DO) \
+  DO( LEX_IF,       "if") \
+  DO( LEX_ELSE,     "else") \
+  DO( LEX_WHILE,    "while") \
+  DO( LEX_FOR,      "for") \
+  DO( LEX_FN,       "fn") \
+  DO( LEX_RETURN,   "return") \
+  DO( LEX_BREAK,    "break") \
+  DO( LEX_CONTINUE, "continue") \
+  DO( LEX_LET,      "let") \
+  DO( LEX_TRUE,     "true") \
+  DO( LEX_FALSE,    "false")
 
 namespace lex {
 
-struct stream_t;
-struct stream_pos_t;
-
 enum LexToks {
   _LEX_STATE_START_  = 255,
 #define DEFINE_TOKS(name, str, ...) name,
   FOR_LEX_IDENT_STATES(DEFINE_TOKS)
   FOR_LEX_OTHER_STATES(DEFINE_TOKS)
+  FOR_LEX_KEYWORDS(DEFINE_TOKS)
 #undef DEFINE_TOKS
+  _LEX_STATE_END_
 };
 
 static std::string lex_to_str(int tok)
@@ -51,30 +72,242 @@ static std::string lex_to_str(int tok)
 #define TOKS_CASE(name, str, ...) case name: return str;
   FOR_LEX_IDENT_STATES(TOKS_CASE)
   FOR_LEX_OTHER_STATES(TOKS_CASE)
+  FOR_LEX_KEYWORDS(TOKS_CASE)
 #undef TOKS_CASE
   case 0 ... 255:  return std::string(1, tok);
   default:         return "Error";
   };
 }
 
+/// Do tokens of this kind carry their text
+inline bool has_text(int tok)
+{
+  switch (tok) {
+#define TOKS_CASE(name, str, ...) case name: return true;
+  FOR_LEX_IDENT_STATES(TOKS_CASE)
+#undef TOKS_CASE
+  default: return false;
+  };
+}
+
+/// Is this kind a keyword, which carries no text
+inline bool is_keyword(int tok)
+{ return tok > LEX_EOF && tok < _LEX_STATE_END_; }
+
+/// Are tokens of this kind numbers
+inline bool is_number(int tok)
+{ return tok == LEX_INT || tok == LEX_REAL || tok == LEX_OCTAL || tok == LEX_HEX; }
+
+//==============================================================================
+/// The value of a number token: an integer for LEX_INT, LEX_OCTAL and
+/// LEX_HEX, or a real for LEX_REAL
+//==============================================================================
+union number_value_t {
+  int64_t i;
+  double d;
+};
+
+/// Decode the text of a token of the given kind, zero if it is not a number.
+/// Octal and hex literals keep all 64 bits, so they can come out negative.
+/// overflow is set when the value does not fit, and it is then clamped.
+number_value_t decode_number(int kind, std::string_view text, bool & overflow);
+
+//==============================================================================
+/// A single token as a lexer produces it
+//==============================================================================
+struct token_t {
+  int kind = LEX_EOF;
+  stream_pos_t pos = {0, 0};
+  /// Points into the stream, empty unless has_text(kind)
+  std::string_view text;
+};
+
 //==============================================================================
-/// The lexer return datatype
+/// Token positions in four bytes each, rather than a stream_pos_t.  A token
+/// keeps its length and its offset from the first token of its 64 in one
+/// word.  One that is too long, or too far from the first, is kept whole on
+/// the side, and its word is all ones.
+//==============================================================================
+struct compact_positions_t {
+  static constexpr int length_bits = 8;
+  static constexpr size_t max_length = (size_t(1) << length_bits) - 1;
+  static constexpr size_t max_offset = (size_t(1) << (32 - length_bits)) - 1;
+  static constexpr uint32_t escape = ~uint32_t(0);
+
+  std::pmr::vector<uint32_t> words;
+  std::pmr::vector<size_t> bases;
+  std::pmr::vector<std::pair<size_t, stream_pos_t>> escapes;
+
+  compact_positions_t() = default;
+  explicit compact_positions_t(std::pmr::memory_resource * resource) :
+    words(resource), bases(resource), escapes(resource)
+  {}
+
+  size_t size() const { return words.size(); }
+  size_t bytes() const
+  {
+    return words.size()*sizeof(uint32_t) + bases.size()*sizeof(size_t) +
+      escapes.size()*sizeof(escapes[0]);
+  }
+
+  void push_back(stream_pos_t pos)
+  {
+    auto i = words.size();
+    if ((i & 63) == 0) bases.push_back(pos.begin);
+    auto offset = pos.begin - bases.back();
+    auto length = pos.end - pos.begin;
+    if (offset < max_offset && length <= max_length)
+      words.push_back(uint32_t(offset << length_bits | length));
+    else {
+      words.push_back(escape);
+      escapes.emplace_back(i, pos);
+    }
+  }
+
+  stream_pos_t operator[](size_t i) const
+  {
+    auto w = words[i];
+    if (w == escape)
+      return std::lower_bound(escapes.begin(), escapes.end(), i,
+        [](const auto & e, size_t i) { return e.first < i; })->second;
+    auto begin = bases[i >> 6] + (w >> length_bits);
+    return {begin, begin + (w & max_length)};
+  }
+
+  void reserve(size_t n)
+  {
+    words.reserve(n);
+    bases.reserve(n/64 + 1);
+  }
+
+  void clear()
+  {
+    words.clear();
+    bases.clear();
+    escapes.clear();
+  }
+};
+
+/// The average bytes of input per token, to reserve for the tokens of an
+/// input before lexing it
+constexpr size_t lex_bytes_per_token = 6;
+
+//==============================================================================
+/// The lexer return datatype.  Everything is allocated from one memory
+/// resource, the default heap unless another is given, such as an arena.
 //==============================================================================
 struct lexed_t {
-  std::vector<int> tokens;
-  std::vector<stream_pos_t> token_pos;
+  std::pmr::vector<int> tokens;
+  std::pmr::vector<stream_pos_t> token_pos;
+
+  /// When compact, the positions are kept in compact_pos instead of
+  /// token_pos, and read with tokenPos()
+  bool compact = false;
+  compact_positions_t compact_pos;
+
+  std::pmr::string identifier_data;
+  std::pmr::vector<int> identifier_offsets;
+  std::pmr::vector<int> identifier_tokens;
+
+  /// One bit per token, set if it carries an identifier, and the number of
+  /// identifiers before each 64-bit word.  A token finds its identifier by
+  /// counting the bits before it.
+  std::pmr::vector<uint64_t> identifier_bits;
+  std::pmr::vector<int> identifier_rank;
+
+  /// When interning, each distinct string is stored once in identifier_data
+  /// and numbered by symbol.  identifier_symbols holds the symbol of each
+  /// entry in identifier_tokens.
+  bool intern = false;
+  std::pmr::vector<int> identifier_symbols;
+  std::pmr::vector<size_t> symbol_hashes;
+  std::pmr::vector<int> symbol_slots;
+
+  /// When decoding, the value of each entry of identifier_tokens that is a
+  /// number (zero for the others), and whether it overflowed
+  bool decode = false;
+  std::pmr::vector<number_value_t> identifier_values;
+  std::pmr::vector<bool> identifier_overflow;
 
-  std::string identifier_data;
-  std::vector<int> identifier_offsets;
-  std::vector<int> identifier_tokens;
+  /// The errors lexing found, if held for the caller
+  diagnostics_t diagnostics;
 
-  void add(int tok, stream_pos_t pos, const std::string & str = "");
+  lexed_t() = default;
+  explicit lexed_t(std::pmr::memory_resource * resource);
+
+  /// Make room for the tokens of an input of the given size, as estimated
+  /// from lex_bytes_per_token.  The arrays still grow if it is short.
+  void reserve(size_t bytes);
+
+  /// Drop the tokens, identifiers and errors, keeping the memory for the next
+  /// input
+  void reset();
+
+  void add(int tok, stream_pos_t pos, std::string_view str = {});
+  void add(const token_t & tok) { add(tok.kind, tok.pos, tok.text); }
+
+  /// As a token sink
+  void on_token(int kind, stream_pos_t pos, std::string_view text)
+  { add(kind, pos, text); }
+  void append(const lexed_t & other);
+
+  /// Replace the tokens in [first, last) with those of other, whose
+  /// positions are already in place, and move the positions of the tokens
+  /// after them by moved bytes
+  void splice(
+    size_t first,
+    size_t last,
+    const lexed_t & other,
+    std::ptrdiff_t moved = 0);
 
   size_t numTokens() const { return tokens.size(); }
-  size_t numIdentifiers() const { return identifier_offsets.size(); }
+  size_t numIdentifiers() const { return identifier_tokens.size(); }
+
+  stream_pos_t tokenPos(size_t tok) const
+  { return compact ? compact_pos[tok] : token_pos[tok]; }
+  size_t numSymbols() const { return identifier_offsets.size(); }
+
+  /// Does a token carry an identifier
+  bool hasIdentifier(int tok) const
+  {
+    auto word = size_t(tok) >> 6;
+    return word < identifier_bits.size() &&
+      (identifier_bits[word] >> (tok & 63) & 1);
+  }
+
+  /// The identifier id of a token (its symbol when interning), or -1
+  int findIdentifier(int tok) const
+  {
+    if (!hasIdentifier(tok)) return -1;
+    auto word = tok >> 6;
+    auto below = identifier_bits[word] & ((uint64_t(1) << (tok & 63)) - 1);
+    auto i = identifier_rank[word] + __builtin_popcountll(below);
+    return intern ? identifier_symbols[i] : i;
+  }
 
-  int findIdentifier(int tok) const;
   std::string_view getIdentifierString(int i) const;
+
+  /// The decoded value of a number token, or null
+  const number_value_t * findValue(int tok) const
+  {
+    if (!decode || !hasIdentifier(tok) || !is_number(tokens[tok])) return nullptr;
+    auto word = tok >> 6;
+    auto below = identifier_bits[word] & ((uint64_t(1) << (tok & 63)) - 1);
+    return &identifier_values[identifier_rank[word] + __builtin_popcountll(below)];
+  }
+
+  /// Did the value of a number token not fit
+  bool valueOverflowed(int tok) const
+  {
+    auto v = findValue(tok);
+    return v && identifier_overflow[v - identifier_values.data()];
+  }
+
+  /// Find or insert a string in the symbol table
+  int internSymbol(std::string_view str, size_t hash);
+
+  /// Rebuild the symbol table from the interned strings
+  void rehashSymbols();
 };
 
 //==============================================================================
@@ -107,19 +340,525 @@ struct machine_t {
 };
 
 
-/// Main lexer function
-int hand_lex(stream_t & stream, lexed_t & lx);
+//==============================================================================
+/// Pulls the tokens that start in [first, last) out of a stream one at a
+/// time.  Nothing is allocated per token, and errors are counted in err and
+/// kept in diagnostics, or reported as they are found if it is not set.  Each
+/// lexer has its own next_token().
+//==============================================================================
+struct cursor_t {
+  stream_t & stream;
+  size_t pos;
+  size_t last;
+  int err = 0;
+  diagnostics_t * diagnostics = nullptr;
+
+  cursor_t(stream_t & strm, size_t first, size_t last) :
+    stream(strm), pos(first), last(std::min(last, strm.buffer.size()))
+  {}
+
+  /// Where the lexer stopped, for lexing the rest of the stream later
+  size_t stop() const { return pos; }
+};
+
+//==============================================================================
+/// Where a lexer call keeps its errors: in lx when it holds them for the
+/// caller, otherwise aside until the call returns and they are reported
+//==============================================================================
+struct error_sink_t {
+  stream_t & stream;
+  diagnostics_t local;
+  diagnostics_t * diagnostics;
+
+  error_sink_t(stream_t & strm, diagnostics_t & held) : stream(strm)
+  {
+    local.limit = held.limit;
+    diagnostics = held.hold ? &held : &local;
+  }
+  error_sink_t(stream_t & strm, lexed_t & lx) : error_sink_t(strm, lx.diagnostics) {}
+  ~error_sink_t() { report_errors(stream, local); }
+
+  error_sink_t(const error_sink_t &) = delete;
+  error_sink_t & operator=(const error_sink_t &) = delete;
+};
+
+//==============================================================================
+/// Token sinks.  The lexers are templates on where their tokens go: anything
+/// with an on_token(kind, pos, text) that they call from their inner loop,
+/// and a diagnostics_t that errors go to as they would for a lexed_t.  The
+/// library is built for each of FOR_LEX_SINKS; any other sink includes
+/// hand_lex.hpp or fsm_lex.hpp, where the bodies of the lexers are.
+//==============================================================================
+
+/// Counts the tokens of each kind and keeps nothing
+struct count_sink_t {
+  size_t tokens = 0;
+  size_t text_bytes = 0;
+  std::array<size_t, _LEX_STATE_END_> kinds{};
+  diagnostics_t diagnostics;
+
+  void on_token(int kind, stream_pos_t, std::string_view text)
+  {
+    tokens++;
+    kinds[kind]++;
+    text_bytes += text.size();
+  }
+};
+
+/// Passes the tokens of some kinds on to a lexed_t
+struct filter_sink_t {
+  lexed_t & out;
+  std::bitset<_LEX_STATE_END_> keep;
+  diagnostics_t & diagnostics;
+
+  filter_sink_t(lexed_t & out, std::bitset<_LEX_STATE_END_> keep) :
+    out(out), keep(keep), diagnostics(out.diagnostics)
+  {}
+
+  void on_token(int kind, stream_pos_t pos, std::string_view text)
+  { if (keep[kind]) out.add(kind, pos, text); }
+};
+
+#define FOR_LEX_SINKS(DO) \
+  DO(lexed_t) \
+  DO(count_sink_t) \
+  DO(filter_sink_t)
+
+/// Drain a cursor into a sink, returning the number of errors
+template<typename Cursor, typename Sink>
+int lex_all(Cursor & cursor, Sink & out, size_t & stop)
+{
+  error_sink_t sink(cursor.stream, out.diagnostics);
+  cursor.diagnostics = sink.diagnostics;
+  token_t tok;
+  while (cursor.next_token(tok)) out.on_token(tok.kind, tok.pos, tok.text);
+  stop = cursor.stop();
+  return cursor.err;
+}
+
+struct hand_cursor_t : cursor_t {
+  hand_cursor_t(stream_t & strm, size_t first = 0, size_t last = -1) :
+    cursor_t(strm, first, last)
+  {}
+  bool next_token(token_t & tok);
+};
+
+struct hand_simd_cursor_t : cursor_t {
+  hand_simd_cursor_t(stream_t & strm, size_t first = 0, size_t last = -1);
+  bool next_token(token_t & tok) { return next(*this, tok); }
+  /// The kernels are picked at runtime
+  bool (*next)(cursor_t &, token_t &);
+};
+
+/// Uses the compile-time tables
+struct fsm_cursor_t : cursor_t {
+  int state;
+  size_t next;
+  fsm_cursor_t(stream_t & strm, size_t first = 0, size_t last = -1);
+  bool next_token(token_t & tok);
+};
+
+/// Runs the same machine as code generated from the tables by fsm_gen
+struct fsm_gen_cursor_t : fsm_cursor_t {
+  using fsm_cursor_t::fsm_cursor_t;
+  bool next_token(token_t & tok);
+};
+
+struct re2c_cursor_t : cursor_t {
+  re2c_cursor_t(stream_t & strm, size_t first = 0, size_t last = -1) :
+    cursor_t(strm, first, last)
+  {}
+  bool next_token(token_t & tok);
+};
+
+struct thread_pool_t;
+
+/// Lex the tokens starting in [first, last) into a sink, stop is set to
+/// where it ended
+template<typename Sink>
+int hand_lex(
+  stream_t & stream,
+  Sink & sink,
+  size_t first,
+  size_t last,
+  size_t & stop);
 
 /// Main lexer function
+template<typename Sink>
+int hand_lex(stream_t & stream, Sink & sink)
+{
+  size_t stop;
+  return hand_lex(stream, sink, 0, stream.buffer.size(), stop);
+}
+
+/// Lex the tokens starting in [first, last) into a sink, stop is set to
+/// where it ended
+template<typename Sink>
+int hand_simd_lex(
+  stream_t & stream,
+  Sink & sink,
+  size_t first,
+  size_t last,
+  size_t & stop);
+
+/// Hand lexer using vector kernels (picked at runtime) for character runs
+template<typename Sink>
+int hand_simd_lex(stream_t & stream, Sink & sink)
+{
+  size_t stop;
+  return hand_simd_lex(stream, sink, 0, stream.buffer.size(), stop);
+}
+
+/// Lex the tokens starting in [first, last) into a sink, stop is set to
+/// where it ended
+template<typename Sink>
+int fsm_lex(
+  stream_t & stream,
+  Sink & sink,
+  size_t first,
+  size_t last,
+  size_t & stop);
+
+/// FSM lexer function using the compile-time tables
+template<typename Sink>
+int fsm_lex(stream_t & stream, Sink & sink)
+{
+  size_t stop;
+  return fsm_lex(stream, sink, 0, stream.buffer.size(), stop);
+}
+
+/// Lex the tokens starting in [first, last) into a sink, stop is set to
+/// where it ended
+template<typename Sink>
+int fsm_gen_lex(
+  stream_t & stream,
+  Sink & sink,
+  size_t first,
+  size_t last,
+  size_t & stop);
+
+/// FSM lexer function using the scanner generated from the tables
+template<typename Sink>
+int fsm_gen_lex(stream_t & stream, Sink & sink)
+{
+  size_t stop;
+  return fsm_gen_lex(stream, sink, 0, stream.buffer.size(), stop);
+}
+
+/// Built in the library, so only other sinks are instantiated where the
+/// bodies are included
+#define LEX_EXTERN_SINK(Sink) \
+  extern template int hand_lex(stream_t &, Sink &, size_t, size_t, size_t &); \
+  extern template int hand_simd_lex(stream_t &, Sink &, size_t, size_t, size_t &); \
+  extern template int fsm_lex(stream_t &, Sink &, size_t, size_t, size_t &); \
+  extern template int fsm_gen_lex(stream_t &, Sink &, size_t, size_t, size_t &);
+FOR_LEX_SINKS(LEX_EXTERN_SINK)
+#undef LEX_EXTERN_SINK
+
+/// FSM lexer running blocks of the stream at once, on the pool if there is
+/// one, from every state each block can start in
+int fsm_enum_lex(stream_t & stream, lexed_t & lx, thread_pool_t * pool = nullptr);
+
+/// Lex the tokens starting in [first, last), stop is set to where it ended.
+/// The blocks are about block_size bytes, or sized for the pool if it is 0.
+int fsm_enum_lex(
+  stream_t & stream,
+  lexed_t & lx,
+  size_t first,
+  size_t last,
+  size_t & stop,
+  thread_pool_t * pool = nullptr,
+  size_t block_size = 0);
+
+/// Build the same transition table at runtime
 machine_t make_fsm_table();
+
+/// The character class of a byte, a column of the FSM tables
+int char_to_class(char c);
 int fsm_lex(stream_t & stream, const machine_t & table, lexed_t & lx);
 
+/// Lex the tokens starting in [first, last), stop is set to where it ended
+int fsm_lex(
+  stream_t & stream,
+  const machine_t & table,
+  lexed_t & lx,
+  size_t first,
+  size_t last,
+  size_t & stop);
+
+/// Lex the tokens starting in [first, last) into a sink, stop is set to
+/// where it ended
+template<typename Sink>
+int re2c_lex(
+  stream_t & stream,
+  Sink & sink,
+  size_t first,
+  size_t last,
+  size_t & stop)
+{
+  re2c_cursor_t cursor(stream, first, last);
+  return lex_all(cursor, sink, stop);
+}
+
 /// re2c lexer function
-int re2c_lex(stream_t & stream, lexed_t & lx);
+template<typename Sink>
+int re2c_lex(stream_t & stream, Sink & sink)
+{
+  size_t stop;
+  return re2c_lex(stream, sink, 0, stream.buffer.size(), stop);
+}
+
+/// Any of the lexers restricted to a range
+using range_lexer_t = std::function<
+  int(stream_t &, lexed_t &, size_t first, size_t last, size_t & stop)>;
+
+/// Picks the lexer for a whole stream, which then lexes every range of it
+using file_lexer_t = std::function<range_lexer_t(stream_t &)>;
 
+/// Lex newline aligned chunks of the stream on a pool of threads
+int parallel_lex(
+  stream_t & stream,
+  lexed_t & lx,
+  const range_lexer_t & lexer,
+  thread_pool_t & pool);
+
+/// Called from a worker once a stream lexed in chunks has been stitched
+/// together, with the number of errors and their messages (none if lx holds
+/// its errors, they are in lx.diagnostics instead)
+using parallel_done_t = std::function<void(int err, const std::string & errors)>;
+
+/// Queue the chunks of the stream on the pool without waiting.  The stream
+/// and lx must outlive the call to done.
+void parallel_lex(
+  stream_t & stream,
+  lexed_t & lx,
+  const range_lexer_t & lexer,
+  thread_pool_t & pool,
+  size_t chunk_size,
+  parallel_done_t done);
+
+//==============================================================================
+/// Batches of files.  Small files are lexed together, in tasks of about
+/// batch_task_size bytes, and files that would otherwise hold up the end of
+/// the batch are split into chunks of that size.
+//==============================================================================
+constexpr size_t batch_task_size = 1 << 20;
+
+/// One file of a batch, and what lexing it found
+struct batch_file_t {
+  std::string name;
+  size_t bytes = 0;
+  size_t tokens = 0;
+  size_t lines = 0;
+  int err = 0;
+  /// From starting to read the file to having all of its tokens
+  double ms = 0;
+  /// The tokens came from the cache
+  bool cached = false;
+};
+
+/// Expand files, directories and @lists (a file naming one path per line)
+/// into the files to lex.  Returns the number of paths that were not found,
+/// or whose size could not be read.
+int list_inputs(
+  const std::vector<std::string> & paths,
+  std::vector<batch_file_t> & files);
+
+struct token_cache_t;
+
+/// Lex every file on the pool, writing their errors in order, at most
+/// error_limit of them for each file.  Files whose tokens are in the cache
+/// are not lexed, and the others are added to it.  The lexer is picked once
+/// for each file, when it is loaded, and lexes all the chunks of one split.
+int batch_lex(
+  std::vector<batch_file_t> & files,
+  const file_lexer_t & pick_lexer,
+  thread_pool_t & pool,
+  bool use_mmap = false,
+  bool intern = false,
+  size_t task_size = batch_task_size,
+  const token_cache_t * cache = nullptr,
+  size_t error_limit = no_error_limit);
+
+/// The same lexer for every file
+inline int batch_lex(
+  std::vector<batch_file_t> & files,
+  const range_lexer_t & lexer,
+  thread_pool_t & pool,
+  bool use_mmap = false,
+  bool intern = false,
+  size_t task_size = batch_task_size,
+  const token_cache_t * cache = nullptr,
+  size_t error_limit = no_error_limit)
+{
+  auto pick_lexer = [&lexer](stream_t &) { return lexer; };
+  return batch_lex(files, pick_lexer, pool, use_mmap, intern,
+    task_size, cache, error_limit);
+}
+
+/// Size of the window that stream_lex refills
+constexpr size_t stream_window_size = 1 << 20;
+
+/// Called with each window of a streamed input and the tokens lexed from it,
+/// whose positions are offsets into the whole input
+using window_consumer_t = std::function<void(stream_t &, lexed_t &)>;
+
+/// Lex an input of any length, such as a pipe, through a window of fixed size.
+/// Errors are reported window by window, since the text they quote does not
+/// stay in memory.
+int stream_lex(
+  std::istream & in,
+  const std::string & name,
+  const range_lexer_t & lexer,
+  const window_consumer_t & consume,
+  size_t window_size = stream_window_size,
+  size_t error_limit = no_error_limit);
+
+/// Lex an input of any length, appending all of the tokens to lx, with at
+/// most lx.diagnostics.limit errors reported
+int stream_lex(
+  std::istream & in,
+  const std::string & name,
+  lexed_t & lx,
+  const range_lexer_t & lexer,
+  size_t window_size = stream_window_size);
+
+//==============================================================================
+/// Incremental lexing.  Tokens ending at least relex_lookahead bytes before
+/// an edit are kept, since no lexer looks further past the end of a token.
+/// Lexing restarts at the end of the last of them and stops at the first new
+/// token that ends where an old one did after the edit; from there on the
+/// lexers would produce the same tokens again.
+//==============================================================================
+constexpr size_t relex_lookahead = 4;
+
+/// The first token to lex again, and where to start
+std::pair<size_t, size_t> relex_start(const lexed_t & lx, const edit_t & edit);
+
+/// The old token that ends at pos, if it lies after the edit, or -1
+long relex_match(
+  const lexed_t & lx,
+  const edit_t & edit,
+  size_t first_tok,
+  size_t pos);
+
+/// Splice the new tokens in place of [first, last) and move the rest
+void relex_finish(
+  lexed_t & lx,
+  const edit_t & edit,
+  size_t first,
+  size_t last,
+  const lexed_t & fresh);
+
+/// Apply an edit to a stream and to the tokens lexed from it with Cursor
+template<typename Cursor>
+int relex(stream_t & stream, lexed_t & lx, const edit_t & edit)
+{
+  auto [first_tok, first] = relex_start(lx, edit);
+  auto resume = edit.begin + edit.text.size();
+  auto last_tok = lx.numTokens();
+
+  edit_stream(stream, edit);
+
+  Cursor cursor(stream, first);
+  lexed_t fresh;
+  token_t tok;
+
+  while (cursor.next_token(tok)) {
+    fresh.add(tok);
+    if (tok.pos.end < resume) continue;
+    auto old = relex_match(lx, edit, first_tok, tok.pos.end - resume + edit.end);
+    if (old >= 0) {
+      last_tok = old + 1;
+      break;
+    }
+  }
+
+  relex_finish(lx, edit, first_tok, last_tok, fresh);
+  return cursor.err;
+}
+
+//==============================================================================
+/// A buffer under edit, held as pieces of about edit_piece_size bytes.  Each
+/// piece starts a line and has its own stream and tokens, placed relative to
+/// it, so an edit copies, lexes and splices only the pieces it touches, and
+/// what it costs follows the size of the edit rather than of the buffer.  A
+/// piece ends on a newline that no token spans; when an edit leaves a token
+/// running past the end of a piece, the next one is joined to it.
+//==============================================================================
+constexpr size_t edit_piece_size = 1 << 16;
+
+/// relex<Cursor> for any of the cursors
+using relexer_t = std::function<int(stream_t &, lexed_t &, const edit_t &)>;
+
+struct edit_piece_t {
+  /// Where the piece starts in the buffer
+  size_t begin = 0;
+  stream_t stream;
+  lexed_t lexed;
+};
+
+struct edit_buffer_t {
+  relexer_t relexer;
+  size_t piece_size;
+  std::vector<edit_piece_t> pieces;
+
+  /// Cut a stream and its tokens, lexed with the cursor of relexer, into
+  /// pieces.  The pieces keep the options of lx, such as intern or compact.
+  edit_buffer_t(
+    const stream_t & stream,
+    const lexed_t & lx,
+    relexer_t relexer,
+    size_t piece_size = edit_piece_size);
+
+  /// Apply an edit, returning the number of errors in what was lexed again
+  int edit(const edit_t & edit);
+
+  size_t size() const
+  { return pieces.back().begin + pieces.back().stream.buffer.size(); }
+  size_t numTokens() const;
+
+  /// The whole text, and all of its tokens placed in it
+  std::string text() const;
+  void flatten(lexed_t & lx) const;
+
+private:
+  size_t pieceAt(size_t pos) const;
+  int join(size_t p);
+  void split(size_t p);
+  void place(size_t p);
+};
   
+//==============================================================================
+/// Output.  The table is the padded one that print() always wrote; the others
+/// have one line per token with its kind, position and identifier.
+//==============================================================================
+#define FOR_OUTPUT_FORMATS(DO) \
+  DO( FORMAT_TABLE, "table") \
+  DO( FORMAT_JSONL, "jsonl") \
+  DO( FORMAT_CSV,   "csv") \
+  DO( FORMAT_TSV,   "tsv")
+
+enum OutputFormats {
+#define DEFINE_FORMATS(name, str) name,
+  FOR_OUTPUT_FORMATS(DEFINE_FORMATS)
+#undef DEFINE_FORMATS
+};
+
+/// The format with this name, or -1
+int str_to_format(const std::string & str);
+
 /// Dump lexer results
-void print(std::ostream& os, const lexed_t & res);
+void print(std::ostream& os, const lexed_t & res, int format = FORMAT_TABLE);
+
+/// Write the results to a file descriptor in large writes, formatting
+/// chunks of tokens on the pool if there is one.  Returns false if a write
+/// failed.
+bool write_tokens(
+  int fd,
+  const lexed_t & res,
+  int format = FORMAT_TABLE,
+  thread_pool_t * pool = nullptr);
 
 } // namespace
 
@@ -0,0 +1,436 @@
+#include "cache.hpp"
+#include "lex.hpp"
+#include "thread_pool.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+namespace lex {
+
+/// Tokens formatted by one task, and the size of the writes
+constexpr size_t output_chunk_tokens = 64 * 1024;
+constexpr size_t output_write_size = 1 << 20;
+
+int str_to_format(const std::string & str)
+{
+#define FORMAT_TEST(name, s) if (str == s) return name;
+  FOR_OUTPUT_FORMATS(FORMAT_TEST)
+#undef FORMAT_TEST
+  return -1;
+}
+
+//==============================================================================
+/// Appends text and numbers to a string with no stream state to keep up.  The
+/// string grows in large steps and is cut back to what was written when the
+/// buffer goes out of scope.
+//==============================================================================
+struct text_buffer_t {
+  std::string & data;
+  size_t len;
+
+  explicit text_buffer_t(std::string & data) : data(data), len(data.size()) {}
+  ~text_buffer_t() { data.resize(len); }
+
+  text_buffer_t(const text_buffer_t &) = delete;
+  text_buffer_t & operator=(const text_buffer_t &) = delete;
+
+  /// Room for n more characters
+  char * room(size_t n)
+  {
+    if (len + n > data.size())
+      data.resize(std::max(2*data.size(), len + n + 4096));
+    return &data[len];
+  }
+
+  void put(std::string_view str)
+  {
+    std::memcpy(room(str.size()), str.data(), str.size());
+    len += str.size();
+  }
+
+  void put(char c)
+  {
+    *room(1) = c;
+    len++;
+  }
+
+  void pad(size_t n, char c = ' ')
+  {
+    std::memset(room(n), c, n);
+    len += n;
+  }
+
+  void number(long long value)
+  {
+    auto p = room(24);
+    len = std::to_chars(p, p + 24, value).ptr - data.data();
+  }
+
+  void right(size_t width, std::string_view str)
+  {
+    if (str.size() < width) pad(width - str.size());
+    put(str);
+  }
+
+  void right(size_t width, long long value)
+  {
+    char tmp[24];
+    auto res = std::to_chars(tmp, tmp + sizeof(tmp), value);
+    right(width, std::string_view(tmp, res.ptr - tmp));
+  }
+
+  void left(size_t width, std::string_view str)
+  {
+    put(str);
+    if (str.size() < width) pad(width - str.size());
+  }
+};
+
+//==============================================================================
+// Escaping
+//==============================================================================
+static void put_json(text_buffer_t & out, std::string_view str)
+{
+  static const char hex[] = "0123456789abcdef";
+  out.put('"');
+  for (unsigned char c : str) {
+    switch (c) {
+    case '"':  out.put("\\\""); break;
+    case '\\': out.put("\\\\"); break;
+    case '\n': out.put("\\n"); break;
+    case '\r': out.put("\\r"); break;
+    case '\t': out.put("\\t"); break;
+    default:
+      if (c < 0x20) {
+        out.put("\\u00");
+        out.put(hex[c >> 4]);
+        out.put(hex[c & 15]);
+      }
+      else
+        out.put(char(c));
+    }
+  }
+  out.put('"');
+}
+
+static void put_csv(text_buffer_t & out, std::string_view str)
+{
+  if (str.find_first_of(",\"\r\n") == std::string_view::npos) {
+    out.put(str);
+    return;
+  }
+  out.put('"');
+  for (auto c : str) {
+    if (c == '"') out.put('"');
+    out.put(c);
+  }
+  out.put('"');
+}
+
+static void put_tsv(text_buffer_t & out, std::string_view str)
+{
+  for (auto c : str) {
+    switch (c) {
+    case '\\': out.put("\\\\"); break;
+    case '\t': out.put("\\t"); break;
+    case '\n': out.put("\\n"); break;
+    case '\r': out.put("\\r"); break;
+    default:   out.put(c);
+    }
+  }
+}
+
+static void put_escaped(text_buffer_t & out, int format, std::string_view str)
+{
+  switch (format) {
+  case FORMAT_JSONL: put_json(out, str); break;
+  case FORMAT_CSV:   put_csv(out, str); break;
+  case FORMAT_TSV:   put_tsv(out, str); break;
+  default:           out.put(str);
+  }
+}
+
+//==============================================================================
+/// The name of every token kind, escaped once for each format
+//==============================================================================
+static const std::string & kind_name(int format, int kind)
+{
+  static const auto names = []() {
+    std::vector<std::vector<std::string>> names;
+    int nformats = 0;
+#define COUNT_FORMATS(name, str) nformats++;
+    FOR_OUTPUT_FORMATS(COUNT_FORMATS)
+#undef COUNT_FORMATS
+    for (int f=0; f<nformats; ++f) {
+      names.emplace_back();
+      for (int k=0; k<=_LEX_STATE_END_; ++k) {
+        std::string str;
+        {
+          text_buffer_t out(str);
+          put_escaped(out, f, lex_to_str(k < _LEX_STATE_END_ ? k : -1));
+        }
+        names.back().emplace_back(std::move(str));
+      }
+    }
+    return names;
+  }();
+
+  auto & of = names[format];
+  return (kind >= 0 && kind < _LEX_STATE_END_) ? of[kind] : of.back();
+}
+
+//==============================================================================
+/// The column widths of the table grow with the number of tokens
+//==============================================================================
+struct table_widths_t {
+  size_t aw, bw, cw, dw, ew;
+
+  explicit table_widths_t(size_t n)
+  {
+    int digits = count_digits(n);
+    aw = std::max(digits+1, 7);
+    bw = 6;
+    cw = 14;
+    dw = std::max<size_t>(bw, 8);
+    ew = 4*aw;
+  }
+};
+
+//==============================================================================
+/// The header of each format
+//==============================================================================
+template<typename Lexed>
+static void format_header(std::string & str, const Lexed & res, int format)
+{
+  text_buffer_t out(str);
+
+  if (format == FORMAT_TABLE) {
+    table_widths_t w(res.numTokens());
+    out.right(w.aw, "TokenId");
+    out.pad(2);
+    out.right(w.bw, "TypeId");
+    out.pad(2);
+    out.right(w.cw, "TypeString");
+    out.pad(2);
+    out.right(w.dw, "IndentId");
+    out.pad(2);
+    out.left(w.ew, "IdentString");
+    out.put('\n');
+
+    out.pad(w.aw, '-');
+    out.pad(2);
+    out.pad(w.bw, '-');
+    out.pad(2);
+    out.pad(w.cw, '-');
+    out.pad(2);
+    out.pad(w.dw, '-');
+    out.pad(2);
+    out.pad(w.ew, '-');
+    out.put('\n');
+  }
+  else if (format == FORMAT_CSV) {
+    out.put("id,type,kind,begin,end,ident,text\n");
+  }
+  else if (format == FORMAT_TSV) {
+    out.put("id\ttype\tkind\tbegin\tend\tident\ttext\n");
+  }
+}
+
+//==============================================================================
+/// The rows of the tokens in [first, last)
+//==============================================================================
+template<typename Lexed>
+static void format_rows(
+  std::string & str,
+  const Lexed & res,
+  int format,
+  size_t first,
+  size_t last)
+{
+  text_buffer_t out(str);
+  table_widths_t w(res.numTokens());
+
+  for (auto i=first; i<last; ++i) {
+    auto id = res.findIdentifier(i);
+    auto tyid = res.tokens[i];
+    auto & tystr = kind_name(format, tyid);
+    auto pos = res.tokenPos(i);
+
+    switch (format) {
+
+    case FORMAT_TABLE:
+      out.right(w.aw, i);
+      out.pad(2);
+      out.right(w.bw, tyid);
+      out.pad(2);
+      out.right(w.cw, tystr);
+      out.pad(2);
+      if (id >= 0)
+        out.right(w.dw, id);
+      else
+        out.pad(w.dw);
+      out.pad(2);
+      if (id >= 0) {
+        auto ident = res.getIdentifierString(id);
+        out.put('"');
+        out.put(ident);
+        out.put('"');
+        if (ident.size() + 2 < w.ew) out.pad(w.ew - ident.size() - 2);
+      }
+      else
+        out.pad(w.ew);
+      out.put('\n');
+      break;
+
+    case FORMAT_JSONL:
+      out.put("{\"id\":");
+      out.number(i);
+      out.put(",\"type\":");
+      out.number(tyid);
+      out.put(",\"kind\":");
+      out.put(tystr);
+      out.put(",\"begin\":");
+      out.number(pos.begin);
+      out.put(",\"end\":");
+      out.number(pos.end);
+      if (id >= 0) {
+        out.put(",\"ident\":");
+        out.number(id);
+        out.put(",\"text\":");
+        put_json(out, res.getIdentifierString(id));
+      }
+      out.put("}\n");
+      break;
+
+    default: {
+      auto sep = (format == FORMAT_CSV) ? ',' : '\t';
+      out.number(i);
+      out.put(sep);
+      out.number(tyid);
+      out.put(sep);
+      out.put(tystr);
+      out.put(sep);
+      out.number(pos.begin);
+      out.put(sep);
+      out.number(pos.end);
+      out.put(sep);
+      if (id >= 0) {
+        out.number(id);
+        out.put(sep);
+        put_escaped(out, format, res.getIdentifierString(id));
+      }
+      else
+        out.put(sep);
+      out.put('\n');
+    }
+
+    }
+  }
+}
+
+//==============================================================================
+/// Write all of a buffer, however many calls it takes
+//==============================================================================
+static bool write_fully(int fd, std::string_view data)
+{
+  while (data.size()) {
+    auto n = ::write(fd, data.data(), data.size());
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data.remove_prefix(n);
+  }
+  return true;
+}
+
+//==============================================================================
+/// Format the tokens a chunk at a time, handing each full buffer to flush.
+/// With a pool, a round of chunks is formatted at once and flushed in order.
+//==============================================================================
+template<typename Lexed, typename Flush>
+static bool format_all(
+  const Lexed & res,
+  int format,
+  thread_pool_t * pool,
+  Flush && flush)
+{
+  auto n = res.numTokens();
+  std::string buf;
+  buf.reserve(output_write_size + output_write_size/4);
+  format_header(buf, res, format);
+
+  if (!pool || pool->size() < 2 || n <= output_chunk_tokens) {
+    for (size_t first=0; first<n; ) {
+      auto last = std::min(n, first + output_chunk_tokens/16);
+      format_rows(buf, res, format, first, last);
+      first = last;
+      if (buf.size() >= output_write_size) {
+        if (!flush(buf)) return false;
+        buf.clear();
+      }
+    }
+    return flush(buf);
+  }
+
+  if (!flush(buf)) return false;
+
+  std::vector<std::string> chunks(2*pool->size());
+  for (size_t first=0; first<n; ) {
+    size_t used = 0;
+    for (auto & chunk : chunks) {
+      if (first >= n) break;
+      auto last = std::min(n, first + output_chunk_tokens);
+      pool->submit([&res, &chunk, format, first, last]() {
+        chunk.clear();
+        format_rows(chunk, res, format, first, last);
+      });
+      first = last;
+      used++;
+    }
+    pool->wait();
+    for (size_t k=0; k<used; ++k)
+      if (!flush(chunks[k])) return false;
+  }
+  return true;
+}
+
+//==============================================================================
+// Lexer output operator
+//==============================================================================
+template<typename Lexed>
+static void print_lexed(std::ostream & os, const Lexed & res, int format)
+{
+  format_all(res, format, nullptr, [&os](const std::string & buf) {
+    os.write(buf.data(), buf.size());
+    return true;
+  });
+}
+
+template<typename Lexed>
+static bool write_lexed_tokens(int fd, const Lexed & res, int format, thread_pool_t * pool)
+{
+  return format_all(res, format, pool,
+    [fd](const std::string & buf) { return write_fully(fd, buf); });
+}
+
+void print(std::ostream & os, const lexed_t & res, int format)
+{ print_lexed(os, res, format); }
+
+void print(std::ostream & os, const lexed_view_t & res, int format)
+{ print_lexed(os, res, format); }
+
+bool write_tokens(int fd, const lexed_t & res, int format, thread_pool_t * pool)
+{ return write_lexed_tokens(fd, res, format, pool); }
+
+bool write_tokens(int fd, const lexed_view_t & res, int format, thread_pool_t * pool)
+{ return write_lexed_tokens(fd, res, format, pool); }
+
+} // namespace
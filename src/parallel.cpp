@@ -0,0 +1,229 @@
+#include "errors.hpp"
+#include "lex.hpp"
+#include "stream.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+
+namespace lex {
+
+/// Chunks smaller than this are not worth a task
+constexpr size_t min_chunk_size = 64 * 1024;
+
+/// The result of lexing a chunk from an assumed starting position
+struct speculation_t {
+  bool valid = false;
+  size_t start = 0;
+  size_t stop = 0;
+  int err = 0;
+  lexed_t lexed;
+};
+
+/// A newline aligned piece of the stream.  Comments end at a newline, so the
+/// only state a chunk can start in, other than between tokens, is inside a
+/// multi-line quoted literal.  Both are tried, the second one resuming after
+/// the first quote of the chunk.
+struct chunk_t {
+  size_t begin = 0, end = 0;
+  speculation_t outside, inside;
+};
+
+/// One stream being lexed in chunks, shared by the tasks lexing them.  The
+/// last one to finish stitches the chunks together.
+struct parallel_job_t {
+  stream_t & stream;
+  lexed_t & lx;
+  range_lexer_t lexer;
+  parallel_done_t done;
+  std::vector<chunk_t> chunks;
+  std::atomic<size_t> remaining = 0;
+
+  parallel_job_t(
+    stream_t & stream,
+    lexed_t & lx,
+    const range_lexer_t & lexer,
+    parallel_done_t done) :
+    stream(stream), lx(lx), lexer(lexer), done(std::move(done))
+  {}
+};
+
+//==============================================================================
+/// Whitespace that all of the lexers skip
+//==============================================================================
+static bool is_blank(char c)
+{ return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v'; }
+
+//==============================================================================
+/// Starting to lex at either position gives the same tokens if only
+/// whitespace lies between them
+//==============================================================================
+static bool same_start(const char * buffer, size_t a, size_t b)
+{
+  if (a > b) std::swap(a, b);
+  for (; a<b; ++a)
+    if (!is_blank(buffer[a])) return false;
+  return true;
+}
+
+//==============================================================================
+/// Lex a chunk from an assumed start, its errors held with its tokens
+//==============================================================================
+static void speculate(
+  stream_t & stream,
+  const range_lexer_t & lexer,
+  size_t first,
+  size_t last,
+  speculation_t & spec)
+{
+  spec.start = first;
+  spec.err = lexer(stream, spec.lexed, first, last, spec.stop);
+  spec.valid = true;
+}
+
+//==============================================================================
+/// Stitch the chunks together in order, keeping whichever guess of the
+/// starting state agrees with where the previous chunk stopped and lexing a
+/// chunk again if neither does.  The result is identical to a serial run.
+/// The errors of the chunks kept are held in lx.
+//==============================================================================
+static int stitch(parallel_job_t & job)
+{
+  auto buffer = job.stream.buffer;
+  auto & lx = job.lx;
+  size_t stop = 0;
+  int err = 0;
+
+  for (auto & c : job.chunks) {
+    speculation_t * keep = nullptr;
+    for (auto spec : {&c.outside, &c.inside})
+      if (spec->valid && same_start(buffer.data(), stop, spec->start)) {
+        keep = spec;
+        break;
+      }
+
+    if (keep) {
+      lx.append(keep->lexed);
+      err += keep->err;
+      stop = keep->stop;
+    }
+    else if (stop < c.end) {
+      err += job.lexer(job.stream, lx, stop, c.end, stop);
+    }
+
+    c.outside = speculation_t();
+    c.inside = speculation_t();
+  }
+
+  return err;
+}
+
+//==============================================================================
+/// Lex one guess of a chunk, stitching them all together if it was the last
+//==============================================================================
+static void run_speculation(
+  const std::shared_ptr<parallel_job_t> & job,
+  size_t first,
+  size_t last,
+  speculation_t & spec)
+{
+  speculate(job->stream, job->lexer, first, last, spec);
+  if (--job->remaining) return;
+
+  // the errors stay in lx if the caller holds them, or become messages
+  auto & diag = job->lx.diagnostics;
+  auto hold = diag.hold;
+  diag.hold = true;
+  auto err = stitch(*job);
+  diag.hold = hold;
+
+  std::string errors;
+  if (!hold) {
+    errors = render_errors(job->stream, diag);
+    diag.clear();
+  }
+  job->done(err, errors);
+}
+
+//==============================================================================
+/// Split the stream at newlines and queue both guesses of every chunk
+//==============================================================================
+void parallel_lex(
+  stream_t & stream,
+  lexed_t & lx,
+  const range_lexer_t & lexer,
+  thread_pool_t & pool,
+  size_t chunk_size,
+  parallel_done_t done)
+{
+  auto job = std::make_shared<parallel_job_t>(stream, lx, lexer, std::move(done));
+  auto & chunks = job->chunks;
+  auto buffer = stream.buffer;
+  auto size = buffer.size();
+  chunk_size = std::max<size_t>(chunk_size, 1);
+
+  // split at newlines
+  size_t begin = 0;
+  do {
+    auto end = buffer.find('\n', begin + chunk_size);
+    end = (end == std::string_view::npos) ? size : end+1;
+    chunks.emplace_back();
+    chunks.back().begin = begin;
+    chunks.back().end = end;
+    for (auto spec : {&chunks.back().outside, &chunks.back().inside}) {
+      spec->lexed.intern = lx.intern;
+      spec->lexed.decode = lx.decode;
+      spec->lexed.diagnostics.limit = lx.diagnostics.limit;
+      spec->lexed.diagnostics.hold = true;
+    }
+    begin = end;
+  } while (begin < size);
+
+  // the first chunk can only start outside of a token
+  struct guess_t { size_t first, last; speculation_t * spec; };
+  std::vector<guess_t> guesses;
+  for (size_t k=0; k<chunks.size(); ++k) {
+    auto & c = chunks[k];
+    guesses.push_back({c.begin, c.end, &c.outside});
+    if (k == 0) continue;
+    auto quote = buffer.substr(0, c.end).find('\"', c.begin);
+    if (quote != std::string_view::npos)
+      guesses.push_back({quote+1, c.end, &c.inside});
+  }
+
+  // lex every chunk both ways
+  job->remaining = guesses.size();
+  for (auto g : guesses)
+    pool.submit([job, g]() { run_speculation(job, g.first, g.last, *g.spec); });
+}
+
+//==============================================================================
+/// Lex newline aligned chunks of the stream on a pool of threads and wait
+/// for the result
+//==============================================================================
+int parallel_lex(
+  stream_t & stream,
+  lexed_t & lx,
+  const range_lexer_t & lexer,
+  thread_pool_t & pool)
+{
+  auto size = stream.buffer.size();
+  size_t stop = 0;
+
+  auto chunk_size = std::max(size / (4*pool.size()), min_chunk_size);
+  if (pool.size() < 2 || size <= chunk_size)
+    return lexer(stream, lx, 0, size, stop);
+
+  int err = 0;
+  std::string errors;
+  parallel_lex(stream, lx, lexer, pool, chunk_size,
+    [&](int e, const std::string & s) { err = e; errors = s; });
+  pool.wait();
+
+  error_output() << errors;
+  return err;
+}
+
+} // namespace
@@ -0,0 +1,119 @@
+#include "perf.hpp"
+
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace lex {
+
+std::string perf_to_str(int counter)
+{
+  switch (counter) {
+#define TOKS_CASE(name, str) case name: return str;
+  FOR_PERF_COUNTERS(TOKS_CASE)
+#undef TOKS_CASE
+  default: return "Error";
+  };
+}
+
+#ifdef __linux__
+
+//==============================================================================
+/// The event behind each counter
+//==============================================================================
+static void set_event(int counter, perf_event_attr & attr)
+{
+  auto cache = [&](uint64_t which) {
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = which |
+      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+  };
+
+  attr.type = PERF_TYPE_HARDWARE;
+  switch (counter) {
+  case PERF_CYCLES:        attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+  case PERF_INSTRUCTIONS:  attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+  case PERF_BRANCH_MISSES: attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+  case PERF_L1D_MISSES:    cache(PERF_COUNT_HW_CACHE_L1D); break;
+  case PERF_LLC_MISSES:    cache(PERF_COUNT_HW_CACHE_LL); break;
+  }
+}
+
+perf_counters_t::perf_counters_t()
+{
+  for (int c=0; c<PERF_NUM_COUNTERS; ++c) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // count the threads started later too, like those of a pool
+    attr.inherit = 1;
+    attr.read_format =
+      PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    set_event(c, attr);
+
+    fds[c] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (fds[c] < 0 && why.empty())
+      why = perf_to_str(c) + ": " + std::strerror(errno);
+  }
+}
+
+perf_counters_t::~perf_counters_t()
+{
+  for (auto fd : fds)
+    if (fd >= 0) close(fd);
+}
+
+void perf_counters_t::start()
+{
+  for (auto fd : fds) {
+    if (fd < 0) continue;
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+}
+
+void perf_counters_t::stop()
+{
+  for (auto fd : fds)
+    if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+  for (int c=0; c<PERF_NUM_COUNTERS; ++c) {
+    if (fds[c] < 0) continue;
+    // value, time enabled, time running
+    uint64_t data[3];
+    if (read(fds[c], data, sizeof(data)) != sizeof(data) || !data[2])
+      continue;
+    counts[c] += (data[1] == data[2]) ? data[0] :
+      static_cast<uint64_t>(double(data[0]) * data[1] / data[2]);
+  }
+}
+
+#else
+
+perf_counters_t::perf_counters_t() : why("not supported on this platform")
+{ fds.fill(-1); }
+
+perf_counters_t::~perf_counters_t() {}
+void perf_counters_t::start() {}
+void perf_counters_t::stop() {}
+
+#endif
+
+bool perf_counters_t::available() const
+{
+  for (int c=0; c<PERF_NUM_COUNTERS; ++c)
+    if (has(c)) return true;
+  return false;
+}
+
+} // namespace
@@ -0,0 +1,61 @@
+#ifndef CONTRA_PERF_HPP
+#define CONTRA_PERF_HPP
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#define FOR_PERF_COUNTERS(DO) \
+  DO( PERF_CYCLES,        "cycles"       ) \
+  DO( PERF_INSTRUCTIONS,  "instructions" ) \
+  DO( PERF_BRANCH_MISSES, "branch-misses") \
+  DO( PERF_L1D_MISSES,    "L1D-misses"   ) \
+  DO( PERF_LLC_MISSES,    "LLC-misses"   )
+
+namespace lex {
+
+enum PerfCounters {
+#define DEFINE_TOKS(name, str) name,
+  FOR_PERF_COUNTERS(DEFINE_TOKS)
+#undef DEFINE_TOKS
+  PERF_NUM_COUNTERS
+};
+
+std::string perf_to_str(int counter);
+
+//==============================================================================
+/// Hardware counters of the calling thread, and of any threads it starts
+/// afterwards, read with perf_event_open.
+/// Each counter is opened on its own, so some can be missing while the rest
+/// still work.  Counts accumulate over every start()/stop() pair.
+//==============================================================================
+struct perf_counters_t {
+
+  perf_counters_t();
+  ~perf_counters_t();
+
+  perf_counters_t(const perf_counters_t &) = delete;
+  perf_counters_t & operator=(const perf_counters_t &) = delete;
+
+  void start();
+  void stop();
+
+  /// Was the counter opened
+  bool has(int counter) const { return fds[counter] >= 0; }
+
+  /// Was any counter opened, otherwise why not
+  bool available() const;
+  const std::string & reason() const { return why; }
+
+  /// Counts so far, scaled up if the counter was multiplexed
+  std::array<uint64_t, PERF_NUM_COUNTERS> counts = {};
+
+private:
+
+  std::array<int, PERF_NUM_COUNTERS> fds;
+  std::string why;
+};
+
+} // namespace
+
+#endif // CONTRA_PERF_HPP
@@ -0,0 +1,261 @@
+#include "lex.hpp"
+#include "stream.hpp"
+
+#include <algorithm>
+#include <cctype>
+
+namespace lex {
+
+/// The first token in [first, last) for which pred is false, the tokens
+/// being partitioned by it
+template<typename Pred>
+static size_t partition_tokens(const lexed_t & lx, size_t first, size_t last, Pred pred)
+{
+  while (first < last) {
+    auto mid = first + (last - first) / 2;
+    if (pred(lx.tokenPos(mid)))
+      first = mid + 1;
+    else
+      last = mid;
+  }
+  return first;
+}
+
+//==============================================================================
+/// Keep the tokens that end far enough before the edit
+//==============================================================================
+std::pair<size_t, size_t> relex_start(const lexed_t & lx, const edit_t & edit)
+{
+  size_t first_tok = partition_tokens(lx, 0, lx.numTokens(),
+    [&](const auto & p) { return p.end + relex_lookahead <= edit.begin; });
+  return {first_tok, first_tok ? lx.tokenPos(first_tok-1).end : 0};
+}
+
+//==============================================================================
+/// Look for an old token, after the edit, that ended at the same place
+//==============================================================================
+long relex_match(
+  const lexed_t & lx,
+  const edit_t & edit,
+  size_t first_tok,
+  size_t pos)
+{
+  if (pos < edit.end) return -1;
+  auto tok = partition_tokens(lx, first_tok, lx.numTokens(),
+    [&](const auto & p) { return p.end < pos; });
+  if (tok == lx.numTokens() || lx.tokenPos(tok).end != pos) return -1;
+  return tok;
+}
+
+//==============================================================================
+/// Splice in the new tokens, moving the ones after them in the same pass
+//==============================================================================
+void relex_finish(
+  lexed_t & lx,
+  const edit_t & edit,
+  size_t first,
+  size_t last,
+  const lexed_t & fresh)
+{
+  auto moved = std::ptrdiff_t(edit.text.size()) - std::ptrdiff_t(edit.end - edit.begin);
+  lx.splice(first, last, fresh, moved);
+}
+
+/// Copy the tokens [first, last) of one lexed_t to the end of another,
+/// moving their positions by moved bytes
+static void copy_tokens(
+  const lexed_t & from,
+  size_t first,
+  size_t last,
+  std::ptrdiff_t moved,
+  lexed_t & to)
+{
+  for (auto t=first; t<last; ++t) {
+    auto pos = from.tokenPos(t);
+    auto id = from.findIdentifier(t);
+    to.add(from.tokens[t], {pos.begin + moved, pos.end + moved},
+      id < 0 ? std::string_view() : from.getIdentifierString(id));
+  }
+}
+
+/// Is there nothing but white space in text[first, last)
+static bool blank(std::string_view text, size_t first, size_t last)
+{
+  for (auto i=first; i<last; ++i)
+    if (!std::isspace(uint8_t(text[i]))) return false;
+  return true;
+}
+
+/// An empty lexed_t with the same options
+static lexed_t options_of(const lexed_t & lx)
+{
+  lexed_t out;
+  out.intern = lx.intern;
+  out.decode = lx.decode;
+  out.compact = lx.compact;
+  return out;
+}
+
+//==============================================================================
+/// Cut a stream and its tokens into pieces of at least piece_size bytes, each
+/// but the last ending on a newline that no token spans.  Nothing but white
+/// space may come between it and the token before, either, since some lexers
+/// drop an unterminated quote rather than make a token of it.
+//==============================================================================
+static void cut(
+  const stream_t & stream,
+  const lexed_t & lx,
+  size_t piece_size,
+  std::vector<edit_piece_t> & pieces)
+{
+  auto text = stream.buffer;
+  auto ntoks = lx.numTokens();
+  size_t begin = 0, first = 0;
+
+  while (true) {
+    size_t end = text.size(), last = ntoks;
+    auto nl = text.find('\n', begin + std::max<size_t>(piece_size, 1) - 1);
+    while (nl != std::string_view::npos) {
+      auto tok = partition_tokens(lx, first, ntoks,
+        [&](const auto & p) { return p.end <= nl; });
+      auto after = tok > first ? lx.tokenPos(tok-1).end : begin;
+      auto spanned = tok < ntoks && lx.tokenPos(tok).begin <= nl;
+      if (!spanned && blank(text, after, nl)) {
+        end = nl + 1;
+        last = tok;
+        break;
+      }
+      // neither can any newline before the end of the next token
+      nl = tok < ntoks ? text.find('\n', lx.tokenPos(tok).end) : text.npos;
+    }
+
+    edit_piece_t piece;
+    piece.begin = begin;
+    piece.stream = make_stream(text.substr(begin, end - begin), stream.name);
+    piece.lexed = options_of(lx);
+    copy_tokens(lx, first, last, -std::ptrdiff_t(begin), piece.lexed);
+    pieces.push_back(std::move(piece));
+
+    if (end == text.size()) break;
+    begin = end;
+    first = last;
+  }
+}
+
+//==============================================================================
+/// Cut a stream into pieces
+//==============================================================================
+edit_buffer_t::edit_buffer_t(
+  const stream_t & stream,
+  const lexed_t & lx,
+  relexer_t relexer,
+  size_t piece_size) :
+  relexer(std::move(relexer)), piece_size(piece_size)
+{
+  cut(stream, lx, piece_size, pieces);
+  pieces[0].stream.first_line = stream.first_line;
+  place(0);
+}
+
+//==============================================================================
+/// Apply an edit to the pieces it touches
+//==============================================================================
+int edit_buffer_t::edit(const edit_t & edit)
+{
+  auto end = std::min(edit.end, size());
+  auto begin = std::min(edit.begin, end);
+  auto p = pieceAt(begin);
+  auto q = end > begin ? pieceAt(end - 1) : p;
+
+  int err = 0;
+  for (; q > p; --q) err += join(p);
+
+  auto & piece = pieces[p];
+  err += relexer(piece.stream, piece.lexed,
+    {begin - piece.begin, end - piece.begin, edit.text});
+
+  // a token left running to the end of the piece goes on into the next, and
+  // a piece that has become small is joined to the next one anyway
+  auto ends_clean = [&]() {
+    auto & lx = pieces[p].lexed;
+    auto text = pieces[p].stream.buffer;
+    auto after = lx.numTokens() ? lx.tokenPos(lx.numTokens()-1).end : 0;
+    return text.size() >= piece_size/4 && after < text.size() &&
+      text.back() == '\n' && blank(text, after, text.size());
+  };
+  while (p+1 < pieces.size() && !ends_clean()) err += join(p);
+
+  if (pieces[p].stream.buffer.size() > 2*piece_size) split(p);
+  place(p);
+  return err;
+}
+
+/// The last piece that starts at or before pos
+size_t edit_buffer_t::pieceAt(size_t pos) const
+{
+  auto it = std::upper_bound(pieces.begin(), pieces.end(), pos,
+    [](size_t pos, const auto & piece) { return pos < piece.begin; });
+  return it - pieces.begin() - 1;
+}
+
+/// Append the next piece to piece p, and lex again across the seam
+int edit_buffer_t::join(size_t p)
+{
+  auto & piece = pieces[p];
+  auto & next = pieces[p+1];
+  auto size = piece.stream.buffer.size();
+
+  edit_stream(piece.stream, {size, size, next.stream.buffer});
+  copy_tokens(next.lexed, 0, next.lexed.numTokens(), size, piece.lexed);
+  pieces.erase(pieces.begin() + p + 1);
+
+  return relexer(piece.stream, piece.lexed, {size, size, {}});
+}
+
+/// Cut piece p, which has grown too large, into several
+void edit_buffer_t::split(size_t p)
+{
+  std::vector<edit_piece_t> parts;
+  cut(pieces[p].stream, pieces[p].lexed, piece_size, parts);
+  parts[0].stream.first_line = pieces[p].stream.first_line;
+  parts[0].begin = pieces[p].begin;
+
+  pieces[p] = std::move(parts[0]);
+  pieces.insert(pieces.begin() + p + 1,
+    std::make_move_iterator(parts.begin() + 1),
+    std::make_move_iterator(parts.end()));
+}
+
+/// Place the pieces after p from its size and lines on
+void edit_buffer_t::place(size_t p)
+{
+  for (auto i=p+1; i<pieces.size(); ++i) {
+    auto & prev = pieces[i-1];
+    pieces[i].begin = prev.begin + prev.stream.buffer.size();
+    pieces[i].stream.first_line = prev.stream.first_line + prev.stream.newlines.size();
+  }
+}
+
+size_t edit_buffer_t::numTokens() const
+{
+  size_t n = 0;
+  for (auto & piece : pieces) n += piece.lexed.numTokens();
+  return n;
+}
+
+std::string edit_buffer_t::text() const
+{
+  std::string out;
+  out.reserve(size());
+  for (auto & piece : pieces) out += piece.stream.buffer;
+  return out;
+}
+
+/// All of the tokens, placed in the whole buffer
+void edit_buffer_t::flatten(lexed_t & lx) const
+{
+  for (auto & piece : pieces)
+    copy_tokens(piece.lexed, 0, piece.lexed.numTokens(), piece.begin, lx);
+}
+
+} // namespace
@@ -0,0 +1,229 @@
+#include "simd.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#endif
+
+namespace lex {
+
+//==============================================================================
+/// Pick the best kernels for this cpu
+//==============================================================================
+simd_level_t detect_simd()
+{
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))   return simd_level_t::avx2;
+  if (__builtin_cpu_supports("sse4.2")) return simd_level_t::sse42;
+  if (__builtin_cpu_supports("sse2"))   return simd_level_t::sse2;
+#endif
+  return simd_level_t::scalar;
+}
+
+const char * simd_name(simd_level_t level)
+{
+  switch (level) {
+  case simd_level_t::avx2:  return "AVX2";
+  case simd_level_t::sse42: return "SSE4.2";
+  case simd_level_t::sse2:  return "SSE2";
+  default:                  return "scalar";
+  }
+}
+
+//==============================================================================
+// Newlines, a byte at a time with memchr
+//==============================================================================
+size_t ascii_newlines_t::count(const char * p, size_t n)
+{
+  size_t count = 0;
+  for (size_t i=0; i<n; ++i) count += (p[i] == '\n');
+  return count;
+}
+
+size_t ascii_newlines_t::find(const char * p, size_t n, std::vector<size_t> & out)
+{
+  auto start = out.size();
+  auto end = p + n;
+  for (auto q = p; (q = static_cast<const char*>(std::memchr(q, '\n', end - q))); ++q)
+    out.push_back(q - p);
+  return out.size() - start;
+}
+
+#ifdef HAVE_X86_SIMD
+
+//==============================================================================
+// SSE4.2: the string instructions match against a set of byte ranges and
+// return the index of the first byte outside of them (16 if none)
+//==============================================================================
+
+#define SSE42 __attribute__((target("sse4.2")))
+
+SSE42 static size_t sse42_run(const char * p, const char * ranges, int len)
+{
+  constexpr int mode =
+    _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_NEGATIVE_POLARITY |
+    _SIDD_LEAST_SIGNIFICANT;
+  auto set = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ranges));
+  size_t n = 0;
+  while (true) {
+    auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + n));
+    auto i = _mm_cmpestri(set, len, block, 16, mode);
+    n += i;
+    if (i < 16) return n;
+  }
+}
+
+// pairs of inclusive bounds, padded to the 16 bytes that are loaded
+alignas(16) static const char space_ranges[16] = "\t\r  ";
+alignas(16) static const char alnum_ranges[16] = "azAZ09__";
+alignas(16) static const char digit_ranges[16] = "09";
+
+SSE42 size_t sse42_scan_t::space(const char * p)
+{ return sse42_run(p, space_ranges, 4); }
+
+SSE42 size_t sse42_scan_t::alnum(const char * p)
+{ return sse42_run(p, alnum_ranges, 8); }
+
+SSE42 size_t sse42_scan_t::digits(const char * p)
+{ return sse42_run(p, digit_ranges, 2); }
+
+//==============================================================================
+// AVX2: classify 32 bytes with compares and find the first miss
+//==============================================================================
+
+#define AVX2 __attribute__((target("avx2,bmi")))
+
+/// Bytes with lo <= c <= hi, compared unsigned
+AVX2 static inline __m256i in_range(__m256i c, char lo, char hi)
+{
+  auto d = _mm256_sub_epi8(c, _mm256_set1_epi8(lo));
+  auto w = _mm256_set1_epi8(hi - lo);
+  return _mm256_cmpeq_epi8(_mm256_min_epu8(d, w), d);
+}
+
+AVX2 static inline __m256i space_mask(__m256i c)
+{
+  return _mm256_or_si256(
+    in_range(c, '\t', '\r'),
+    _mm256_cmpeq_epi8(c, _mm256_set1_epi8(' ')));
+}
+
+AVX2 static inline __m256i alnum_mask(__m256i c)
+{
+  auto lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+  return _mm256_or_si256(
+    _mm256_or_si256(in_range(lower, 'a', 'z'), in_range(c, '0', '9')),
+    _mm256_cmpeq_epi8(c, _mm256_set1_epi8('_')));
+}
+
+AVX2 static inline __m256i digit_mask(__m256i c)
+{ return in_range(c, '0', '9'); }
+
+template<__m256i (*Classify)(__m256i)>
+AVX2 static inline size_t avx2_run(const char * p)
+{
+  size_t n = 0;
+  while (true) {
+    auto c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + n));
+    uint32_t miss = ~_mm256_movemask_epi8(Classify(c));
+    if (miss) return n + _tzcnt_u32(miss);
+    n += 32;
+  }
+}
+
+AVX2 size_t avx2_scan_t::space(const char * p)
+{ return avx2_run<space_mask>(p); }
+
+AVX2 size_t avx2_scan_t::alnum(const char * p)
+{ return avx2_run<alnum_mask>(p); }
+
+AVX2 size_t avx2_scan_t::digits(const char * p)
+{ return avx2_run<digit_mask>(p); }
+
+//==============================================================================
+// Newlines a block at a time: the compare mask of each block is counted, or
+// walked bit by bit.  The tail is left to the scalar kernel.
+//==============================================================================
+
+AVX2 size_t avx2_newlines_t::count(const char * p, size_t n)
+{
+  auto nl = _mm256_set1_epi8('\n');
+  size_t count = 0, i = 0;
+  for (; i + 32 <= n; i += 32) {
+    auto c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+    uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, nl));
+    count += __builtin_popcount(mask);
+  }
+  return count + ascii_newlines_t::count(p + i, n - i);
+}
+
+AVX2 size_t avx2_newlines_t::find(const char * p, size_t n, std::vector<size_t> & out)
+{
+  auto nl = _mm256_set1_epi8('\n');
+  auto start = out.size();
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    auto c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+    uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(c, nl));
+    for (; mask; mask &= mask - 1) out.push_back(i + _tzcnt_u32(mask));
+  }
+  auto tail = out.size();
+  ascii_newlines_t::find(p + i, n - i, out);
+  for (auto k=tail; k<out.size(); ++k) out[k] += i;
+  return out.size() - start;
+}
+
+size_t sse2_newlines_t::count(const char * p, size_t n)
+{
+  auto nl = _mm_set1_epi8('\n');
+  size_t count = 0, i = 0;
+  for (; i + 16 <= n; i += 16) {
+    auto c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(c, nl)));
+  }
+  return count + ascii_newlines_t::count(p + i, n - i);
+}
+
+size_t sse2_newlines_t::find(const char * p, size_t n, std::vector<size_t> & out)
+{
+  auto nl = _mm_set1_epi8('\n');
+  auto start = out.size();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    auto c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+    uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(c, nl));
+    for (; mask; mask &= mask - 1) out.push_back(i + __builtin_ctz(mask));
+  }
+  auto tail = out.size();
+  ascii_newlines_t::find(p + i, n - i, out);
+  for (auto k=tail; k<out.size(); ++k) out[k] += i;
+  return out.size() - start;
+}
+
+#else
+
+// never selected without x86 vector units, but still linked
+
+size_t sse42_scan_t::space(const char * p)  { return ascii_scan_t::space(p); }
+size_t sse42_scan_t::alnum(const char * p)  { return ascii_scan_t::alnum(p); }
+size_t sse42_scan_t::digits(const char * p) { return ascii_scan_t::digits(p); }
+size_t avx2_scan_t::space(const char * p)   { return ascii_scan_t::space(p); }
+size_t avx2_scan_t::alnum(const char * p)   { return ascii_scan_t::alnum(p); }
+size_t avx2_scan_t::digits(const char * p)  { return ascii_scan_t::digits(p); }
+
+size_t sse2_newlines_t::count(const char * p, size_t n)
+{ return ascii_newlines_t::count(p, n); }
+size_t sse2_newlines_t::find(const char * p, size_t n, std::vector<size_t> & out)
+{ return ascii_newlines_t::find(p, n, out); }
+size_t avx2_newlines_t::count(const char * p, size_t n)
+{ return ascii_newlines_t::count(p, n); }
+size_t avx2_newlines_t::find(const char * p, size_t n, std::vector<size_t> & out)
+{ return ascii_newlines_t::find(p, n, out); }
+
+#endif
+
+} // namespace
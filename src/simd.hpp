@@ -0,0 +1,94 @@
+#ifndef CONTRA_SIMD_HPP
+#define CONTRA_SIMD_HPP
+
+#include <cstddef>
+#include <vector>
+
+namespace lex {
+
+/// The vector instructions available on the running cpu
+enum class simd_level_t { scalar, sse2, sse42, avx2 };
+
+simd_level_t detect_simd();
+const char * simd_name(simd_level_t level);
+
+//==============================================================================
+/// ASCII character tests, independent of the locale.  They agree with the
+/// <cctype> functions in the default "C" locale.
+//==============================================================================
+struct ascii_t {
+  static bool is_alpha(char c)
+  { return static_cast<unsigned char>((c | 0x20) - 'a') < 26; }
+  static bool is_digit(char c)
+  { return static_cast<unsigned char>(c - '0') < 10; }
+};
+
+//==============================================================================
+/// The scalar fallback for the kernels below
+//==============================================================================
+struct ascii_scan_t : ascii_t {
+  static bool is_space(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+  static bool is_alnum(char c) { return is_alpha(c) || is_digit(c) || c == '_'; }
+
+  static size_t space(const char * p)
+  {
+    size_t n = 0;
+    while (is_space(p[n])) n++;
+    return n;
+  }
+  static size_t alnum(const char * p)
+  {
+    size_t n = 0;
+    while (is_alnum(p[n])) n++;
+    return n;
+  }
+  static size_t digits(const char * p)
+  {
+    size_t n = 0;
+    while (is_digit(p[n])) n++;
+    return n;
+  }
+};
+
+//==============================================================================
+/// Vector kernels measuring the length of the run of characters of one
+/// class starting at p: whitespace, [a-zA-Z0-9_] and [0-9].  They read whole
+/// 16 or 32 byte blocks, and only move on to the next block when every byte
+/// matched.  As NUL never matches, they read at most 31 bytes past the end of
+/// the buffer, which the stream padding provides for.
+//==============================================================================
+struct sse42_scan_t : ascii_t {
+  static size_t space(const char * p);
+  static size_t alnum(const char * p);
+  static size_t digits(const char * p);
+};
+
+struct avx2_scan_t : ascii_t {
+  static size_t space(const char * p);
+  static size_t alnum(const char * p);
+  static size_t digits(const char * p);
+};
+
+//==============================================================================
+/// Newline kernels: count() counts the newlines in [p, p+n) and find() appends
+/// the offset of each one to out, returning how many it added.  Unlike the
+/// scans above they never read past the n bytes.
+//==============================================================================
+struct ascii_newlines_t {
+  static size_t count(const char * p, size_t n);
+  static size_t find(const char * p, size_t n, std::vector<size_t> & out);
+};
+
+struct sse2_newlines_t {
+  static size_t count(const char * p, size_t n);
+  static size_t find(const char * p, size_t n, std::vector<size_t> & out);
+};
+
+struct avx2_newlines_t {
+  static size_t count(const char * p, size_t n);
+  static size_t find(const char * p, size_t n, std::vector<size_t> & out);
+};
+
+} // namespace
+
+#endif // CONTRA_SIMD_HPP
@@ -1,8 +1,32 @@
 #include "stream.hpp"
 #include "utils.hpp"
 
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace lex {
 
+//==============================================================================
+/// Allocate a heap buffer with a zeroed tail
+//==============================================================================
+static char * allocate(stream_t & strm, size_t size)
+{
+  auto data = new char[size + stream_padding];
+  std::memset(data + size, 0, stream_padding);
+  strm.storage = std::shared_ptr<const char>(data, std::default_delete<char[]>());
+  strm.buffer = std::string_view(data, size);
+  return data;
+}
+
+//==============================================================================
+/// Copy a stream into memory
+//==============================================================================
 stream_t make_stream(std::istream & in, const std::string & name)
 {
   stream_t strm;
@@ -12,11 +36,109 @@ stream_t make_stream(std::istream & in, const std::string & name)
   auto size = in.tellg();
   in.seekg(0, std::ios::beg);
 
-  strm.buffer.resize(size);
-  if (in.read(strm.buffer.data(), size))
+  if (size < 0) size = 0;
+
+  auto data = allocate(strm, size);
+  if (in.read(data, size))
     strm.newlines = newline_positions(strm.buffer);
 
   return strm;
 }
 
+//==============================================================================
+/// Copy text into a stream
+//==============================================================================
+stream_t make_stream(std::string_view text, const std::string & name)
+{
+  stream_t strm;
+  strm.name = name;
+  auto data = allocate(strm, text.size());
+  if (text.size()) std::memcpy(data, text.data(), text.size());
+  strm.newlines = newline_positions(strm.buffer);
+  return strm;
+}
+
+//==============================================================================
+/// Replace part of a stream
+//==============================================================================
+void edit_stream(stream_t & strm, const edit_t & edit)
+{
+  auto prev = strm.storage;
+  auto old = strm.buffer;
+  auto end = std::min(edit.end, old.size());
+  auto begin = std::min(edit.begin, end);
+  auto & text = edit.text;
+
+  auto data = allocate(strm, old.size() - (end - begin) + text.size());
+  std::memcpy(data, old.data(), begin);
+  std::memcpy(data + begin, text.data(), text.size());
+  std::memcpy(data + begin + text.size(), old.data() + end, old.size() - end);
+
+  auto & lines = strm.newlines;
+  auto lo = std::lower_bound(lines.begin(), lines.end(), begin);
+  auto hi = std::lower_bound(lo, lines.end(), end);
+  for (auto it=hi; it!=lines.end(); ++it)
+    *it = *it - end + begin + text.size();
+
+  auto added = newline_positions(text);
+  for (auto & pos : added) pos += begin;
+  lo = lines.erase(lo, hi);
+  lines.insert(lo, added.begin(), added.end());
+}
+
+//==============================================================================
+/// Map a file into memory.
+///
+/// An anonymous mapping of the file size plus padding is reserved first and
+/// the file is mapped over the front of it.  The bytes past the end of the
+/// file are therefore zero, even when the size is a multiple of the page size.
+//==============================================================================
+stream_t map_stream(const std::string & filename)
+{
+  auto fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    stream_t strm;
+    strm.name = filename;
+    allocate(strm, 0);
+    return strm;
+  }
+
+  struct stat st;
+  auto is_file = (fstat(fd, &st) == 0) && S_ISREG(st.st_mode);
+  size_t size = is_file ? st.st_size : 0;
+
+  // nothing to map, copy it instead
+  if (size == 0) {
+    close(fd);
+    std::ifstream in(filename);
+    return make_stream(in, filename);
+  }
+
+  size_t page = sysconf(_SC_PAGESIZE);
+  auto maplen = (size + stream_padding + page - 1) / page * page;
+
+  auto base = mmap(nullptr, maplen, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  auto data = (base != MAP_FAILED) ?
+    mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) : MAP_FAILED;
+  close(fd);
+
+  if (data == MAP_FAILED) {
+    if (base != MAP_FAILED) munmap(base, maplen);
+    std::ifstream in(filename);
+    return make_stream(in, filename);
+  }
+
+  madvise(data, size, MADV_SEQUENTIAL);
+
+  stream_t strm;
+  strm.name = filename;
+  strm.storage = std::shared_ptr<const char>(
+    static_cast<const char*>(data),
+    [maplen](const char * p) { munmap(const_cast<char*>(p), maplen); });
+  strm.buffer = std::string_view(strm.storage.get(), size);
+  strm.newlines = newline_positions(strm.buffer);
+
+  return strm;
+}
+
 } // namespace
@@ -2,7 +2,9 @@
 #define CONTRA_STREAM_HPP
 
 #include <istream>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace lex {
@@ -11,17 +13,44 @@ struct stream_pos_t {
   std::size_t begin, end;
 };
 
+/// Number of zeroed bytes guaranteed to follow every stream buffer, so the
+/// lexers can always read past the last character
+constexpr std::size_t stream_padding = 64;
 
 struct stream_t {
 
-  std::string buffer;
+  std::string_view buffer;
   std::string name;
   std::vector<size_t> newlines;
 
+  /// Owns the memory behind buffer (a heap copy or a file mapping)
+  std::shared_ptr<const char> storage;
+
+  /// Where buffer starts when it is a window onto a longer input
+  std::size_t offset = 0;
+  std::size_t first_line = 0;
+
+};
+
+//==============================================================================
+/// A replacement of the bytes in [begin, end) with text
+//==============================================================================
+struct edit_t {
+  std::size_t begin = 0, end = 0;
+  std::string_view text;
 };
 
 stream_t make_stream(std::istream & in, const std::string & name = "");
 
+/// Copy text into a stream
+stream_t make_stream(std::string_view text, const std::string & name = "");
+
+/// Apply an edit, shifting the newlines after it rather than finding them all
+void edit_stream(stream_t & strm, const edit_t & edit);
+
+/// Memory map a file read-only instead of copying it
+stream_t map_stream(const std::string & filename);
+
 } // namespace
 
 #endif
@@ -0,0 +1,166 @@
+#include "errors.hpp"
+#include "lex.hpp"
+#include "stream.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace lex {
+
+//==============================================================================
+/// Lex part of a window, holding any errors until it is known whether the
+/// tokens are kept
+//==============================================================================
+static int lex_window(
+  stream_t & window,
+  const range_lexer_t & lexer,
+  size_t first,
+  size_t last,
+  lexed_t & lx,
+  size_t & stop,
+  size_t error_limit)
+{
+  lx.reset();
+  lx.diagnostics.limit = error_limit;
+  lx.diagnostics.hold = true;
+  return lexer(window, lx, first, last, stop);
+}
+
+//==============================================================================
+/// Refill a window from the input and lex the tokens that start before its
+/// last newline.  A token can still run into the end of the window if it is
+/// a quoted literal or a comment.  When that happens, the window is lexed
+/// again up to that token, and the token is carried over into the next
+/// window.  The window only grows when a single token does not fit in half
+/// of it.  The errors of each window are reported before moving on, up to
+/// error_limit in all.
+//==============================================================================
+int stream_lex(
+  std::istream & in,
+  const std::string & name,
+  const range_lexer_t & lexer,
+  const window_consumer_t & consume,
+  size_t window_size,
+  size_t error_limit)
+{
+  size_t capacity = 0;
+  char * data = nullptr;
+
+  stream_t window;
+  window.name = name;
+
+  size_t filled = 0; // bytes in the window
+  size_t first = 0;  // where lexing resumes in the window
+  bool eof = false;
+  int err = 0;
+
+  lexed_t lexed;
+  size_t shown = 0;
+  diagnostics_t over;
+
+  while (true) {
+
+    // make room, keeping what was carried over
+    if (!data || filled > capacity/2) {
+      auto grown = std::max(window_size, 2*capacity);
+      auto storage = std::shared_ptr<char>(
+        new char[grown + stream_padding], std::default_delete<char[]>());
+      if (filled) std::memcpy(storage.get(), data, filled);
+      window.storage = storage;
+      data = storage.get();
+      capacity = grown;
+    }
+
+    in.read(data + filled, capacity - filled);
+    filled += in.gcount();
+    eof = !in;
+    std::memset(data + filled, 0, stream_padding);
+
+    window.buffer = std::string_view(data, filled);
+    window.newlines = newline_positions(window.buffer);
+
+    // only tokens that start before the last newline are complete, or before
+    // the last blank if the line does not fit
+    auto last = filled;
+    if (!eof) {
+      auto end = window.buffer.rfind('\n');
+      if (end == std::string_view::npos || end < first)
+        end = window.buffer.find_last_of(" \t\n\r\v");
+      last = (end == std::string_view::npos || end < first) ? first : end;
+    }
+
+    size_t stop = first;
+    int nerr = 0;
+    lexed.reset();
+    auto window_limit = error_limit - std::min(shown, error_limit);
+
+    if (last > first || eof) {
+      nerr = lex_window(window, lexer, first, last, lexed, stop, window_limit);
+
+      // something ran into the end of the window, so stop before it
+      if (!eof && stop >= filled) {
+        auto n = lexed.numTokens();
+        while (n && lexed.token_pos[n-1].end >= filled) --n;
+        auto cut = n ? lexed.token_pos[n-1].end : first;
+        stop = first;
+        nerr = 0;
+        lexed.reset();
+        if (cut > first)
+          nerr = lex_window(window, lexer, first, cut, lexed, stop, window_limit);
+      }
+    }
+
+    // what was over the limit is noted once, at the end
+    auto & diag = lexed.diagnostics;
+    err += nerr;
+    shown += diag.items.size();
+    over.dropped += diag.dropped;
+    diag.dropped = 0;
+    report_errors(window, diag);
+
+    for (auto & pos : lexed.token_pos) {
+      pos.begin += window.offset;
+      pos.end += window.offset;
+    }
+    consume(window, lexed);
+
+    if (eof) {
+      report_errors(window, over);
+      break;
+    }
+
+    // carry the rest over, from the start of its line if it is not too long
+    auto & lines = window.newlines;
+    auto line = std::lower_bound(lines.begin(), lines.end(), stop);
+    size_t keep = (line == lines.begin()) ? 0 : *std::prev(line) + 1;
+    if (filled - keep > capacity/2) keep = stop;
+
+    auto kept = std::lower_bound(lines.begin(), lines.end(), keep);
+    window.first_line += std::distance(lines.begin(), kept);
+    window.offset += keep;
+
+    std::memmove(data, data + keep, filled - keep);
+    filled -= keep;
+    first = stop - keep;
+  }
+
+  return err;
+}
+
+//==============================================================================
+/// Lex an input of any length into a single set of tokens
+//==============================================================================
+int stream_lex(
+  std::istream & in,
+  const std::string & name,
+  lexed_t & lx,
+  const range_lexer_t & lexer,
+  size_t window_size)
+{
+  return stream_lex(in, name, lexer,
+    [&lx](auto &, auto & window_lx) { lx.append(window_lx); },
+    window_size, lx.diagnostics.limit);
+}
+
+} // namespace
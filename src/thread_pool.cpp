@@ -0,0 +1,100 @@
+#include "thread_pool.hpp"
+
+namespace lex {
+
+/// The pool and queue of the calling thread, if it is a worker
+static thread_local const thread_pool_t * current_pool = nullptr;
+static thread_local size_t current_queue = 0;
+
+thread_pool_t::thread_pool_t(int nthreads)
+{
+  if (nthreads < 1) nthreads = 1;
+  queues.reserve(nthreads);
+  for (int i=0; i<nthreads; ++i)
+    queues.emplace_back(std::make_unique<queue_t>());
+  workers.reserve(nthreads);
+  for (int i=0; i<nthreads; ++i)
+    workers.emplace_back([this, i]() { run(i); });
+}
+
+thread_pool_t::~thread_pool_t()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  ready.notify_all();
+  for (auto & w : workers) w.join();
+}
+
+void thread_pool_t::submit(std::function<void()> task)
+{
+  size_t id;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    id = (current_pool == this) ? current_queue : next++ % queues.size();
+    pending++;
+  }
+
+  {
+    auto & q = *queues[id];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    q.tasks.emplace_back(std::move(task));
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    queued++;
+  }
+  ready.notify_one();
+}
+
+void thread_pool_t::wait()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  done.wait(lock, [this]() { return pending == 0; });
+}
+
+bool thread_pool_t::take(size_t id, std::function<void()> & task)
+{
+  auto n = queues.size();
+  for (size_t k=0; k<n; ++k) {
+    auto & q = *queues[(id + k) % n];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.tasks.empty()) continue;
+    if (k == 0) {
+      task = std::move(q.tasks.front());
+      q.tasks.pop_front();
+    }
+    else {
+      task = std::move(q.tasks.back());
+      q.tasks.pop_back();
+    }
+    queued--;
+    return true;
+  }
+  return false;
+}
+
+void thread_pool_t::run(size_t id)
+{
+  current_pool = this;
+  current_queue = id;
+
+  while (true) {
+    std::function<void()> task;
+    if (!take(id, task)) {
+      std::unique_lock<std::mutex> lock(mutex);
+      ready.wait(lock, [this]() { return stopping || queued > 0; });
+      if (queued <= 0) return;
+      continue;
+    }
+
+    task();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--pending == 0) done.notify_all();
+  }
+}
+
+} // namespace
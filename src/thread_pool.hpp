@@ -0,0 +1,59 @@
+#ifndef CONTRA_THREAD_POOL_HPP
+#define CONTRA_THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace lex {
+
+//==============================================================================
+/// A fixed set of worker threads, each with its own queue.  Tasks submitted
+/// by a worker go on its own queue and the others are dealt out in turn.  A
+/// worker takes tasks from the front of its queue and, once that is empty,
+/// steals from the back of the others.
+//==============================================================================
+struct thread_pool_t {
+
+  explicit thread_pool_t(int nthreads);
+  ~thread_pool_t();
+
+  thread_pool_t(const thread_pool_t &) = delete;
+  thread_pool_t & operator=(const thread_pool_t &) = delete;
+
+  /// Queue a task
+  void submit(std::function<void()> task);
+
+  /// Block until every queued task has finished.  Not to be called from a
+  /// task.
+  void wait();
+
+  size_t size() const { return workers.size(); }
+
+private:
+
+  struct queue_t {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  void run(size_t id);
+  bool take(size_t id, std::function<void()> & task);
+
+  std::vector<std::thread> workers;
+  std::vector<std::unique_ptr<queue_t>> queues;
+  std::mutex mutex;
+  std::condition_variable ready, done;
+  std::atomic<long> queued = 0;
+  size_t pending = 0, next = 0;
+  bool stopping = false;
+};
+
+} // namespace
+
+#endif // CONTRA_THREAD_POOL_HPP
@@ -1,6 +1,10 @@
+#include "simd.hpp"
+
 #include <algorithm>
 #include <cstddef>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 namespace lex {
@@ -33,25 +37,39 @@ bool differs(const std::string & a, const std::string & b)
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-std::string extract_to_newline(const std::string& input, size_t start) {
+std::string extract_to_newline(std::string_view input, size_t start) {
   size_t end = input.find('\n', start);
   if (end == std::string::npos) {
     // No newline found, extract to end of string
-    return input.substr(start);
+    return std::string(input.substr(start));
   }
-  return input.substr(start, end - start);
+  return std::string(input.substr(start, end - start));
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-std::vector<size_t> newline_positions(const std::string & text)
+/// The newlines are counted first so the vector is reserved once, then found
+/// with the widest kernels the cpu has.  SSE2 is enough for them.
+////////////////////////////////////////////////////////////////////////////////
+std::vector<size_t> newline_positions(std::string_view text)
 {
-  std::vector<size_t> newlines;
-  auto sz = text.size();
+  using count_t = size_t (*)(const char *, size_t);
+  using find_t = size_t (*)(const char *, size_t, std::vector<size_t> &);
 
-  for (size_t i=0; i<sz; ++i)
-    if (text[i] == '\n')
-      newlines.push_back(i);
+  static const auto kernels = []() -> std::pair<count_t, find_t> {
+    switch (detect_simd()) {
+    case simd_level_t::avx2:
+      return {avx2_newlines_t::count, avx2_newlines_t::find};
+    case simd_level_t::sse42:
+    case simd_level_t::sse2:
+      return {sse2_newlines_t::count, sse2_newlines_t::find};
+    default:
+      return {ascii_newlines_t::count, ascii_newlines_t::find};
+    }
+  }();
 
+  std::vector<size_t> newlines;
+  newlines.reserve(kernels.first(text.data(), text.size()));
+  kernels.second(text.data(), text.size(), newlines);
   return newlines;
 }
 
@@ -3,6 +3,7 @@
 
 #include <iomanip>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <vector>
 
@@ -26,9 +27,9 @@ void printRight(std::ostream & os, int width, char sep, const T & val = std::str
   os << std::right << std::setw(width) << std::setfill(sep) << val;
 }
 
-std::string extract_to_newline(const std::string& input, size_t start);
+std::string extract_to_newline(std::string_view input, size_t start);
 
-std::vector<size_t> newline_positions(const std::string & text);
+std::vector<size_t> newline_positions(std::string_view text);
 
 } // namespace
 
@@ -0,0 +1,142 @@
+#include <errors.hpp>
+#include <lex.hpp>
+#include <stream.hpp>
+#include <thread_pool.hpp>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <filesystem>
+
+using namespace lex;
+
+namespace fs = std::filesystem;
+
+//---------------------------------------------------------------------------
+/// A directory of files of very different sizes, with errors and quotes
+/// spanning lines.  The first one is large enough to be split.
+static fs::path make_files()
+{
+  auto dir = fs::temp_directory_path() / "lex_test_batch";
+  fs::remove_all(dir);
+  fs::create_directories(dir / "sub");
+
+  for (int f=0; f<40; ++f) {
+    auto name = (f % 5 ? dir : dir / "sub") / ("f" + std::to_string(f) + ".txt");
+    std::ofstream out(name);
+    auto lines = (f == 0) ? 20000 : (f % 13 == 0) ? 3000 : f;
+    for (int i=0; i<lines; ++i) {
+      out << "a" << i << " = \"x\n" << i << "\n\" # \"\n";
+      if (i % 7 == 0) out << "\"" << std::string(20, '\n') << "\"\n";
+      if (i % 11 == 0) out << " 1.2.3 0x 12";
+    }
+  }
+  return dir;
+}
+
+//---------------------------------------------------------------------------
+static void compare(const range_lexer_t & lexer, int nthreads, size_t task_size)
+{
+  auto dir = make_files();
+  std::vector<batch_file_t> files;
+  ASSERT_EQ(list_inputs({dir.string()}, files), 0);
+  ASSERT_EQ(files.size(), 40);
+
+  // each one on its own
+  std::stringstream serial_errs;
+  int serial_err = 0;
+  std::vector<size_t> serial_toks;
+  {
+    error_redirect_t redirect(serial_errs);
+    for (auto & f : files) {
+      std::ifstream in(f.name);
+      auto is = make_stream(in, f.name);
+      lexed_t lx;
+      size_t stop;
+      serial_err += lexer(is, lx, 0, is.buffer.size(), stop);
+      serial_toks.push_back(lx.numTokens());
+    }
+  }
+
+  std::stringstream batch_errs;
+  int batch_err;
+  {
+    error_redirect_t redirect(batch_errs);
+    thread_pool_t pool(nthreads);
+    batch_err = batch_lex(files, lexer, pool, true, false, task_size);
+  }
+
+  EXPECT_EQ(serial_err, batch_err);
+  EXPECT_EQ(serial_errs.str(), batch_errs.str());
+  for (size_t i=0; i<files.size(); ++i)
+    EXPECT_EQ(serial_toks[i], files[i].tokens) << files[i].name;
+
+  fs::remove_all(dir);
+}
+
+//=============================================================================
+// Individual tests
+//=============================================================================
+
+TEST(batch, hand)
+{
+  auto lexer = [](auto & is, auto & lx, auto first, auto last, auto & stop)
+    { return hand_lex(is, lx, first, last, stop); };
+  compare(lexer, 1, batch_task_size);
+  compare(lexer, 4, 1024);
+}
+
+TEST(batch, fsm)
+{
+  auto lexer = [](auto & is, auto & lx, auto first, auto last, auto & stop)
+    { return fsm_lex(is, lx, first, last, stop); };
+  compare(lexer, 3, 1024);
+  compare(lexer, 4, 64*1024);
+}
+
+TEST(batch, pick)
+{
+  auto dir = make_files();
+  std::vector<batch_file_t> files;
+  ASSERT_EQ(list_inputs({dir.string()}, files), 0);
+
+  // once for each file, the split one included
+  std::atomic<size_t> picks = 0;
+  auto pick_lexer = [&](stream_t &) -> range_lexer_t {
+    picks++;
+    return [](auto & is, auto & lx, auto first, auto last, auto & stop)
+      { return fsm_lex(is, lx, first, last, stop); };
+  };
+
+  std::stringstream errs;
+  error_redirect_t redirect(errs);
+  thread_pool_t pool(4);
+  batch_lex(files, pick_lexer, pool, false, false, 1024);
+  EXPECT_EQ(picks, files.size());
+
+  fs::remove_all(dir);
+}
+
+TEST(batch, list)
+{
+  auto dir = make_files();
+  {
+    std::ofstream list(dir / "list");
+    list << (dir / "f1.txt").string() << "\n\n" << (dir / "sub").string() << "\n";
+    list << (dir / "missing.txt").string() << "\n";
+  }
+
+  std::vector<batch_file_t> files;
+  std::stringstream errs;
+  error_redirect_t redirect(errs);
+  auto missing = list_inputs({"@" + (dir / "list").string(), (dir / "f2.txt").string()}, files);
+
+  EXPECT_EQ(missing, 1);
+  EXPECT_NE(errs.str().find("missing.txt"), std::string::npos);
+  ASSERT_EQ(files.size(), 10);
+  EXPECT_EQ(files.front().name, (dir / "f1.txt").string());
+  EXPECT_EQ(files.back().name, (dir / "f2.txt").string());
+  EXPECT_GT(files.front().bytes, 0);
+
+  fs::remove_all(dir);
+}
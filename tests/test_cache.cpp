@@ -0,0 +1,230 @@
+#include <cache.hpp>
+#include <errors.hpp>
+#include <lex.hpp>
+#include <stream.hpp>
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+
+using namespace lex;
+
+namespace fs = std::filesystem;
+
+//---------------------------------------------------------------------------
+static stream_t fake_10k()
+{
+  auto inname = TEST_DIR "fake_program_10k.txt";
+  std::ifstream infile(inname);
+  return make_stream(infile, inname);
+}
+
+//---------------------------------------------------------------------------
+static std::string printed(const lexed_t & lx)
+{
+  std::stringstream ss;
+  print(ss, lx);
+  return ss.str();
+}
+
+static std::string printed(const lexed_view_t & view)
+{
+  std::stringstream ss;
+  print(ss, view);
+  return ss.str();
+}
+
+//---------------------------------------------------------------------------
+static void compare(const lexed_t & a, const lexed_t & b)
+{
+  EXPECT_EQ(a.tokens, b.tokens);
+  EXPECT_EQ(a.identifier_data, b.identifier_data);
+  EXPECT_EQ(a.identifier_offsets, b.identifier_offsets);
+  EXPECT_EQ(a.identifier_tokens, b.identifier_tokens);
+  EXPECT_EQ(a.identifier_symbols, b.identifier_symbols);
+  EXPECT_EQ(a.identifier_bits, b.identifier_bits);
+  EXPECT_EQ(a.identifier_rank, b.identifier_rank);
+  ASSERT_EQ(a.token_pos.size(), b.token_pos.size());
+  for (size_t i=0; i<a.token_pos.size(); ++i) {
+    EXPECT_EQ(a.token_pos[i].begin, b.token_pos[i].begin);
+    EXPECT_EQ(a.token_pos[i].end, b.token_pos[i].end);
+  }
+}
+
+//---------------------------------------------------------------------------
+static std::string temp_file(const std::string & name)
+{ return (fs::temp_directory_path() / name).string(); }
+
+/// Overwrite a value in a file
+template<typename T>
+static void patch(const std::string & file, size_t offset, T value)
+{
+  std::fstream f(file, std::ios::in | std::ios::out | std::ios::binary);
+  f.seekp(offset);
+  f.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+//=============================================================================
+// Individual tests
+//=============================================================================
+
+TEST(cache, round_trip)
+{
+  auto is = fake_10k();
+  auto file = temp_file("lex_test_cache.lxt");
+
+  for (bool intern : {false, true}) {
+    lexed_t lx;
+    lx.intern = intern;
+    hand_lex(is, lx);
+    ASSERT_TRUE(write_lexed(file, is, lx, 3, "some errors"));
+
+    lexed_view_t view;
+    ASSERT_TRUE(map_lexed(file, view));
+    EXPECT_EQ(view.numTokens(), lx.numTokens());
+    EXPECT_EQ(view.numSymbols(), lx.numSymbols());
+    EXPECT_EQ(view.err, 3);
+    EXPECT_EQ(view.errors, "some errors");
+    EXPECT_EQ(view.name, is.name);
+    EXPECT_EQ(view.header->source_hash, hash_buffer(is.buffer));
+    EXPECT_EQ(printed(view), printed(lx));
+    compare(view.to_lexed(), lx);
+  }
+
+  fs::remove(file);
+}
+
+TEST(cache, append_after_load)
+{
+  // the symbol table is rebuilt, so more can be interned into a copy
+  stream_t first, second;
+  std::stringstream a("a b c a 1.0 \"x\"\n"), b("c d a 2.0 \"x\" e\n");
+  first = make_stream(a);
+  second = make_stream(b);
+
+  lexed_t lx, more, direct;
+  lx.intern = more.intern = direct.intern = true;
+  hand_lex(first, lx);
+  hand_lex(second, more);
+  direct = lx;
+  direct.append(more);
+
+  auto file = temp_file("lex_test_cache_append.lxt");
+  ASSERT_TRUE(write_lexed(file, first, lx));
+  lexed_view_t view;
+  ASSERT_TRUE(map_lexed(file, view));
+  auto loaded = view.to_lexed();
+  loaded.append(more);
+
+  EXPECT_EQ(loaded.identifier_symbols, direct.identifier_symbols);
+  EXPECT_EQ(loaded.identifier_data, direct.identifier_data);
+  fs::remove(file);
+}
+
+TEST(cache, rejects)
+{
+  auto is = fake_10k();
+  lexed_t lx;
+  fsm_lex(is, lx);
+
+  auto file = temp_file("lex_test_cache_bad.lxt");
+  ASSERT_TRUE(write_lexed(file, is, lx));
+  auto size = fs::file_size(file);
+
+  lexed_view_t view;
+  EXPECT_FALSE(map_lexed(temp_file("lex_test_cache_missing.lxt"), view));
+
+  // truncated
+  fs::resize_file(file, size - 8);
+  EXPECT_FALSE(map_lexed(file, view));
+  EXPECT_EQ(view.numTokens(), 0);
+
+  // another version
+  ASSERT_TRUE(write_lexed(file, is, lx));
+  {
+    std::fstream f(file, std::ios::in | std::ios::out | std::ios::binary);
+    f.seekp(offsetof(lexed_file_header_t, version));
+    uint32_t version = lexed_file_version + 1;
+    f.write(reinterpret_cast<const char*>(&version), sizeof(version));
+  }
+  EXPECT_FALSE(map_lexed(file, view));
+
+  // counts so large the layout would wrap around to the size of the file
+  ASSERT_TRUE(write_lexed(file, is, lx));
+  patch(file, offsetof(lexed_file_header_t, ntokens), uint64_t(1) << 62);
+  EXPECT_FALSE(map_lexed(file, view));
+
+  // the right size, but with identifier offsets past the data: the errors
+  // take the 8 bytes the data loses
+  ASSERT_TRUE(write_lexed(file, is, lx, 0, "12345678"));
+  ASSERT_TRUE(map_lexed(file, view));
+  auto ndata = view.header->ndata;
+  view = lexed_view_t();
+  patch(file, offsetof(lexed_file_header_t, ndata), uint64_t(ndata - 8));
+  patch(file, offsetof(lexed_file_header_t, nerrors), uint64_t(16));
+  EXPECT_FALSE(map_lexed(file, view));
+
+  // a token kind, or a symbol id, out of range
+  ASSERT_TRUE(write_lexed(file, is, lx));
+  patch(file, sizeof(lexed_file_header_t), int(-5));
+  EXPECT_FALSE(map_lexed(file, view));
+
+  lexed_t interned;
+  interned.intern = true;
+  fsm_lex(is, interned);
+  ASSERT_TRUE(write_lexed(file, is, interned));
+  auto align = [](size_t n) { return (n + 7) & ~size_t(7); };
+  auto nt = interned.numTokens();
+  auto symbols = sizeof(lexed_file_header_t) + align(nt * sizeof(int)) +
+    align(nt * sizeof(stream_pos_t)) + align(interned.numIdentifiers() * sizeof(int));
+  patch(file, symbols, int(interned.numSymbols()));
+  EXPECT_FALSE(map_lexed(file, view));
+
+  fs::remove(file);
+}
+
+TEST(cache, directory)
+{
+  auto dir = temp_file("lex_test_cache_dir");
+  fs::remove_all(dir);
+  token_cache_t cache(dir, "hand");
+
+  std::stringstream ss("a = 1.2.3\nb = c\n");
+  auto is = make_stream(ss, "one.txt");
+  auto hash = hash_buffer(is.buffer);
+
+  lexed_view_t view;
+  EXPECT_FALSE(cache.find(is, hash, false, view));
+
+  lexed_t lx;
+  std::stringstream errs;
+  int err;
+  {
+    error_redirect_t redirect(errs);
+    err = hand_lex(is, lx);
+  }
+  ASSERT_EQ(err, 1);
+  ASSERT_TRUE(cache.store(is, hash, lx, err, errs.str()));
+
+  ASSERT_TRUE(cache.find(is, hash, false, view));
+  EXPECT_EQ(view.err, 1);
+  EXPECT_EQ(view.errors, errs.str());
+  EXPECT_EQ(printed(view), printed(lx));
+
+  // not for interning, another lexer or error limit, or errors naming
+  // another file
+  EXPECT_FALSE(cache.find(is, hash, true, view));
+  EXPECT_FALSE(token_cache_t(dir, "fsm").find(is, hash, false, view));
+  EXPECT_FALSE(token_cache_t(dir, "hand", 10).find(is, hash, false, view));
+  auto renamed = is;
+  renamed.name = "two.txt";
+  EXPECT_FALSE(cache.find(renamed, hash, false, view));
+
+  // or other contents
+  std::stringstream other_ss("a = 1.2.4\nb = c\n");
+  auto other = make_stream(other_ss, "one.txt");
+  EXPECT_NE(hash_buffer(other.buffer), hash);
+  EXPECT_FALSE(cache.find(other, hash_buffer(other.buffer), false, view));
+
+  fs::remove_all(dir);
+}
@@ -0,0 +1,138 @@
+#include <calibrate.hpp>
+#include <lex.hpp>
+#include <stream.hpp>
+
+#include <cstdio>
+#include <filesystem>
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+using namespace lex;
+namespace fs = std::filesystem;
+
+//---------------------------------------------------------------------------
+static input_profile_t profile_text(const std::string & line, size_t copies)
+{
+  std::string inp;
+  for (size_t i=0; i<copies; ++i) inp += line;
+  std::stringstream ss(inp);
+  auto is = make_stream(ss);
+  return profile_input(is);
+}
+
+//---------------------------------------------------------------------------
+static input_profile_t make_profile(double ident, double number, double length)
+{
+  input_profile_t profile;
+  profile.ident = ident;
+  profile.number = number;
+  profile.token_length = length;
+  return profile;
+}
+
+//=============================================================================
+// Individual tests
+//=============================================================================
+
+TEST(calibrate, profile)
+{
+  // no bigger than a window, so profiled whole
+  auto idents = profile_text("let alpha = beta + gamma\n", 10);
+  EXPECT_EQ(idents.tokens, 60);
+  EXPECT_DOUBLE_EQ(idents.ident, 4./6);
+  EXPECT_DOUBLE_EQ(idents.number, 0);
+  EXPECT_DOUBLE_EQ(idents.token_length, 25./6);
+
+  auto numbers = profile_text("1 2.5 0x1 017\n", 10);
+  EXPECT_DOUBLE_EQ(numbers.number, 1);
+
+  auto comments = profile_text("# a comment\nx\n", 10);
+  EXPECT_DOUBLE_EQ(comments.comment, 0.5);
+  EXPECT_DOUBLE_EQ(comments.ident, 0.5);
+
+  auto quoted = profile_text("\"a string\" x\n", 10);
+  EXPECT_DOUBLE_EQ(quoted.quoted, 0.5);
+
+  // too small to spread the windows over, so only the first is lexed
+  auto first = profile_text("let alpha = beta + gamma\n", 1000);
+  EXPECT_NEAR(first.ident, 4./6, 0.01);
+  EXPECT_GE(first.bytes, profile_window_size);
+  EXPECT_LT(first.bytes, profile_window_size + 25);
+
+  // sampled in windows, each starting after a newline
+  auto sampled = profile_text("let alpha = beta + gamma\n", 100000);
+  EXPECT_NEAR(sampled.ident, 4./6, 0.01);
+  EXPECT_LT(sampled.bytes, 2*profile_windows*profile_window_size);
+  EXPECT_NEAR(sampled.token_length, 25./6, 0.01);
+}
+
+TEST(calibrate, profile_range)
+{
+  std::stringstream ss("1 2 3\nx y z\n");
+  auto is = make_stream(ss);
+  auto profile = profile_input(is, 6, is.buffer.size());
+  EXPECT_EQ(profile.tokens, 3);
+  EXPECT_DOUBLE_EQ(profile.ident, 1);
+
+  EXPECT_EQ(profile_input(is, 6, 6).tokens, 0);
+}
+
+TEST(calibrate, pick)
+{
+  calibration_t table;
+  EXPECT_EQ(table.pick(make_profile(1, 0, 4), "fsm"), "fsm");
+
+  table.engines = {"hand", "fsm", "re2c"};
+  table.rows.push_back({make_profile(0.9, 0.1, 4), {100, 200, 150}});
+  table.rows.push_back({make_profile(0.1, 0.9, 4), {300, 200, 150}});
+  table.rows.push_back({make_profile(0.5, 0, 40), {100, 200, 250}});
+
+  EXPECT_EQ(table.pick(make_profile(0.8, 0.2, 5), "x"), "fsm");
+  EXPECT_EQ(table.pick(make_profile(0.2, 0.7, 3), "x"), "hand");
+  EXPECT_EQ(table.pick(make_profile(0.6, 0.1, 32), "x"), "re2c");
+}
+
+TEST(calibrate, keep_engines)
+{
+  calibration_t table;
+  table.engines = {"hand", "re2c", "fsm"};
+  table.rows.push_back({make_profile(0.9, 0.1, 4), {100, 300, 200}});
+
+  EXPECT_EQ(table.pick(make_profile(0.9, 0.1, 4), "x"), "re2c");
+  EXPECT_EQ(table.keep_engines([](auto & name) { return name != "re2c"; }), 1);
+  EXPECT_EQ(table.engines, std::vector<std::string>({"hand", "fsm"}));
+  EXPECT_EQ(table.rows[0].mbps, std::vector<double>({100, 200}));
+  EXPECT_EQ(table.pick(make_profile(0.9, 0.1, 4), "x"), "fsm");
+
+  // nothing left to pick from
+  EXPECT_EQ(table.keep_engines([](auto &) { return false; }), 2);
+  EXPECT_EQ(table.pick(make_profile(0.9, 0.1, 4), "x"), "x");
+}
+
+TEST(calibrate, round_trip)
+{
+  calibration_t table;
+  table.engines = {"hand", "fsm"};
+  table.rows.push_back({make_profile(0.5, 0.25, 5.5), {123.5, 456.25}});
+  table.rows.back().profile.comment = 0.125;
+  table.rows.back().profile.quoted = 1./3;
+
+  auto file = (fs::temp_directory_path() / "lex_test_calibration").string();
+  ASSERT_TRUE(table.save(file));
+
+  calibration_t loaded;
+  ASSERT_TRUE(loaded.load(file));
+  EXPECT_EQ(loaded.engines, table.engines);
+  ASSERT_EQ(loaded.rows.size(), 1);
+  auto & a = table.rows[0];
+  auto & b = loaded.rows[0];
+#define PROFILE_EQ(name, str) EXPECT_DOUBLE_EQ(a.profile.name, b.profile.name);
+  FOR_PROFILE_DENSITIES(PROFILE_EQ)
+#undef PROFILE_EQ
+  EXPECT_DOUBLE_EQ(a.profile.token_length, b.profile.token_length);
+  EXPECT_EQ(a.mbps, b.mbps);
+  std::remove(file.c_str());
+
+  EXPECT_FALSE(loaded.load(file));
+}
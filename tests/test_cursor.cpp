@@ -0,0 +1,165 @@
+#include <errors.hpp>
+#include <fsm_lex.hpp>
+#include <hand_lex.hpp>
+#include <lex.hpp>
+#include <stream.hpp>
+
+#include <algorithm>
+
+#include <gtest/gtest.h>
+
+using namespace lex;
+
+//---------------------------------------------------------------------------
+template<typename Cursor, typename Lexer>
+static void compare(stream_t & is, Lexer && lexer)
+{
+  lexed_t res;
+  std::stringstream errs;
+  error_redirect_t redirect(errs);
+  auto err = lexer(is, res);
+
+  Cursor cursor(is);
+  token_t tok;
+  size_t n = 0;
+  auto buffer = is.buffer;
+
+  while (cursor.next_token(tok)) {
+    ASSERT_LT(n, res.numTokens());
+    EXPECT_EQ(tok.kind, res.tokens[n]);
+    EXPECT_EQ(tok.pos.begin, res.token_pos[n].begin);
+    EXPECT_EQ(tok.pos.end, res.token_pos[n].end);
+    auto id = res.findIdentifier(n);
+    EXPECT_EQ(tok.text, id < 0 ? "" : res.getIdentifierString(id));
+    // the text is a view of the stream, not a copy
+    if (tok.text.size()) {
+      EXPECT_GE(tok.text.data(), buffer.data());
+      EXPECT_LE(tok.text.data() + tok.text.size(), buffer.data() + buffer.size());
+    }
+    n++;
+  }
+
+  EXPECT_EQ(n, res.numTokens());
+  EXPECT_EQ(cursor.err, err);
+  EXPECT_FALSE(cursor.next_token(tok));
+}
+
+//---------------------------------------------------------------------------
+static void compare(const std::string & inp)
+{
+  std::stringstream ss(inp);
+  auto is = make_stream(ss);
+  compare<hand_cursor_t>(is,
+    [](auto & is, auto & lx) { return hand_lex(is, lx); });
+  compare<hand_simd_cursor_t>(is,
+    [](auto & is, auto & lx) { return hand_simd_lex(is, lx); });
+  compare<fsm_cursor_t>(is,
+    [](auto & is, auto & lx) { return fsm_lex(is, lx); });
+  compare<fsm_gen_cursor_t>(is,
+    [](auto & is, auto & lx) { return fsm_gen_lex(is, lx); });
+}
+
+//=============================================================================
+// Individual tests
+//=============================================================================
+
+TEST(cursor, tokens)
+{
+  compare("fn sum(i64 a, i64 b) return a+b");
+  compare("x = \"quoted\nstring\" # comment\n0x12 0120 1.5 ++ -- != ^=");
+  compare("1.2.3 \"open");
+  compare("");
+}
+
+TEST(cursor, fake_10k)
+{
+  std::ifstream infile(TEST_DIR "fake_program_10k.txt");
+  std::stringstream ss;
+  ss << infile.rdbuf();
+  compare(ss.str());
+}
+
+TEST(cursor, range)
+{
+  std::stringstream ss("a b c\nd e f\n");
+  auto is = make_stream(ss);
+
+  // resume where the first cursor stopped
+  fsm_cursor_t first(is, 0, 6);
+  token_t tok;
+  std::string seen;
+  while (first.next_token(tok)) seen += tok.text;
+
+  fsm_cursor_t second(is, first.stop());
+  while (second.next_token(tok)) seen += tok.text;
+
+  EXPECT_EQ(seen, "abcdef");
+}
+
+//---------------------------------------------------------------------------
+/// A sink the library is not built for, which the included bodies are
+/// instantiated for here
+struct pos_sink_t {
+  std::vector<stream_pos_t> pos;
+  diagnostics_t diagnostics;
+
+  void on_token(int, stream_pos_t p, std::string_view) { pos.push_back(p); }
+};
+
+//---------------------------------------------------------------------------
+template<typename Lexer>
+static void compare_sinks(stream_t & is, Lexer && lexer)
+{
+  std::stringstream errs;
+  error_redirect_t redirect(errs);
+
+  lexed_t all;
+  auto err = lexer(is, all);
+
+  count_sink_t counts;
+  EXPECT_EQ(lexer(is, counts), err);
+  EXPECT_EQ(counts.tokens, all.numTokens());
+  for (int k=0; k<_LEX_STATE_END_; ++k)
+    EXPECT_EQ(counts.kinds[k],
+      size_t(std::count(all.tokens.begin(), all.tokens.end(), k))) << lex_to_str(k);
+
+  // only the identifiers and numbers, with their text
+  std::bitset<_LEX_STATE_END_> keep;
+  keep.set(LEX_IDENT).set(LEX_INT).set(LEX_REAL);
+  lexed_t kept;
+  filter_sink_t filter(kept, keep);
+  EXPECT_EQ(lexer(is, filter), err);
+
+  size_t n = 0;
+  for (size_t i=0; i<all.numTokens(); ++i) {
+    if (!keep[all.tokens[i]]) continue;
+    ASSERT_LT(n, kept.numTokens());
+    EXPECT_EQ(kept.tokens[n], all.tokens[i]);
+    EXPECT_EQ(kept.token_pos[n].begin, all.token_pos[i].begin);
+    EXPECT_EQ(kept.getIdentifierString(kept.findIdentifier(n)),
+      all.getIdentifierString(all.findIdentifier(i)));
+    n++;
+  }
+  EXPECT_EQ(n, kept.numTokens());
+
+  pos_sink_t positions;
+  EXPECT_EQ(lexer(is, positions), err);
+  ASSERT_EQ(positions.pos.size(), all.numTokens());
+  for (size_t i=0; i<all.numTokens(); ++i) {
+    EXPECT_EQ(positions.pos[i].begin, all.token_pos[i].begin);
+    EXPECT_EQ(positions.pos[i].end, all.token_pos[i].end);
+  }
+}
+
+TEST(cursor, sinks)
+{
+  std::ifstream infile(TEST_DIR "fake_program_10k.txt");
+  std::stringstream ss;
+  ss << infile.rdbuf() << "\n1.2.3 \"open";
+  auto is = make_stream(ss);
+
+  compare_sinks(is, [](auto & is, auto & sink) { return hand_lex(is, sink); });
+  compare_sinks(is, [](auto & is, auto & sink) { return hand_simd_lex(is, sink); });
+  compare_sinks(is, [](auto & is, auto & sink) { return fsm_lex(is, sink); });
+  compare_sinks(is, [](auto & is, auto & sink) { return fsm_gen_lex(is, sink); });
+}
@@ -0,0 +1,128 @@
+#include <errors.hpp>
+#include <lex.hpp>
+#include <stream.hpp>
+#include <thread_pool.hpp>
+
+#include <gtest/gtest.h>
+
+using namespace lex;
+
+//---------------------------------------------------------------------------
+/// Lines with a bad real or an unknown string on every one of them
+static std::string bad_input(int lines)
+{
+  std::string inp;
+  for (int i=0; i<lines; ++i)
+    inp += "a" + std::to_string(i) + " = 1.2.3 + 4e @ \"x\"\n";
+  return inp + "b = \"open";
+}
+
+static size_t count(const std::string & str, const std::string & what)
+{
+  size_t n = 0;
+  for (auto p = str.find(what); p != std::string::npos; p = str.find(what, p+1)) n++;
+  return n;
+}
+
+//=============================================================================
+// Individual tests
+//=============================================================================
+
+TEST(errors, held)
+{
+  // reported as they are found, when the call returns, or by the caller
+  std::stringstream ss(bad_input(50));
+  auto is = make_stream(ss, "bad.txt");
+
+  std::stringstream found, returned;
+  lexed_t lx, held;
+  size_t stop;
+  {
+    error_redirect_t redirect(found);
+    hand_cursor_t cursor(is);
+    token_t tok;
+    while (cursor.next_token(tok));
+  }
+  {
+    error_redirect_t redirect(returned);
+    EXPECT_EQ(hand_lex(is, lx), 101);
+    EXPECT_TRUE(lx.diagnostics.empty());
+    held.diagnostics.hold = true;
+    EXPECT_EQ(hand_lex(is, held, 0, is.buffer.size(), stop), 101);
+  }
+
+  EXPECT_EQ(count(found.str(), ": error: "), 101);
+  EXPECT_EQ(found.str(), returned.str());
+  EXPECT_EQ(held.diagnostics.size(), 101);
+  EXPECT_EQ(render_errors(is, held.diagnostics), found.str());
+}
+
+TEST(errors, limit)
+{
+  std::stringstream ss(bad_input(50));
+  auto is = make_stream(ss, "bad.txt");
+
+  using lexer_t = int (*)(stream_t &, lexed_t &);
+  for (lexer_t lexer : {lexer_t(fsm_lex), lexer_t(hand_lex)}) {
+    lexed_t lx;
+    lx.diagnostics.limit = 5;
+    std::stringstream errs;
+    error_redirect_t redirect(errs);
+    EXPECT_GE(lexer(is, lx), 50);
+    EXPECT_EQ(count(errs.str(), ": error: "), 5);
+    EXPECT_NE(errs.str().find("bad.txt: "), std::string::npos);
+    EXPECT_NE(errs.str().find(" more errors not shown\n"), std::string::npos);
+  }
+}
+
+TEST(errors, repeats)
+{
+  std::stringstream ss("x 1.2.3\ny @\n");
+  auto is = make_stream(ss);
+
+  diagnostics_t a, b;
+  a.add({3, 3, ERR_MULTIPLE_DOTS, false});
+  a.add({3, 3, ERR_MULTIPLE_DOTS, false});
+  a.add({10, 11, ERR_UNKNOWN, true});
+  b.add({3, 3, ERR_MULTIPLE_DOTS, false});
+  b.add({10, 11, ERR_UNKNOWN, true});
+  EXPECT_EQ(a.size(), 2);
+
+  // out of order and repeated across calls, rendered in order and once
+  diagnostics_t all;
+  all.append(b);
+  all.append(a);
+  EXPECT_EQ(render_errors(is, all), render_errors(is, a));
+  EXPECT_EQ(render_errors(is, a),
+    "1:3: error: Multiple '.' encountered in real\n"
+    "x 1.2.3\n"
+    "  ^\n"
+    "2:3: error: Unknown string.\n"
+    "y @\n"
+    "  ^\n");
+}
+
+TEST(errors, parallel)
+{
+  auto inp = bad_input(20000);
+  std::stringstream ss(inp);
+  auto is = make_stream(ss, "bad.txt");
+
+  for (size_t limit : {size_t(7), no_error_limit}) {
+    std::stringstream serial_errs, parallel_errs;
+    lexed_t serial, parallel;
+    serial.diagnostics.limit = parallel.diagnostics.limit = limit;
+    {
+      error_redirect_t redirect(serial_errs);
+      EXPECT_EQ(hand_lex(is, serial), 40001);
+    }
+    {
+      error_redirect_t redirect(parallel_errs);
+      thread_pool_t pool(4);
+      auto lexer = [](auto & is, auto & lx, auto first, auto last, auto & stop)
+        { return hand_lex(is, lx, first, last, stop); };
+      EXPECT_EQ(parallel_lex(is, parallel, lexer, pool), 40001);
+    }
+    EXPECT_EQ(serial_errs.str(), parallel_errs.str());
+  }
+}
@@ -1,3 +1,4 @@
+#include <fsm_tables.hpp>
 #include <lex.hpp>
 #include <stream.hpp>
 #include <utils.hpp>
@@ -11,12 +12,10 @@ using testing::ElementsAre;
 //---------------------------------------------------------------------------
 static std::pair<lexed_t,int> test(const std::string & inp)
 {
-  auto table = make_fsm_table();
-
   std::stringstream ss(inp);
   auto is = make_stream(ss);
   lexed_t res;
-  auto err = fsm_lex(is, table, res);
+  auto err = fsm_lex(is, res);
   print(std::cout, res);
 
   return {res, err};
@@ -64,14 +63,12 @@ static void test_file(
 {
   std::cout << "Processing: " << inname << std::endl;
   
-  auto table = make_fsm_table();
-
   std::ifstream infile(inname);
   auto is = make_stream(infile, inname);
   
   auto start = std::chrono::high_resolution_clock::now();
   lexed_t res;
-  auto err = fsm_lex(is, table, res);
+  auto err = fsm_lex(is, res);
   auto end = std::chrono::high_resolution_clock::now();
   std::chrono::duration<double, std::milli> duration = end - start;
 
@@ -158,6 +155,23 @@ TEST(fsm, number)
   test("1x14",    {{LEX_UNK, "1x14"}}, true);
 }
 
+TEST(fsm, decode)
+{
+  std::stringstream ss("0120 0x19 0X9999999999999999 0x10000000000000000 2.5 1.2.3");
+  auto is = make_stream(ss);
+  lexed_t res;
+  res.decode = true;
+  fsm_lex(is, res);
+
+  EXPECT_EQ(res.findValue(0)->i, 80);
+  EXPECT_EQ(res.findValue(1)->i, 25);
+  EXPECT_EQ(res.findValue(2)->i, int64_t(0x9999999999999999));
+  EXPECT_FALSE(res.valueOverflowed(2));
+  EXPECT_TRUE(res.valueOverflowed(3));
+  EXPECT_EQ(res.findValue(4)->d, 2.5);
+  EXPECT_EQ(res.findValue(5), nullptr);
+}
+
 TEST(fsm, ops)
 {
   test("=",  {{'=',        ""}});
@@ -192,7 +206,7 @@ TEST(fsm, function_add)
   auto [res, err] = test("fn  sum(i64 a, i64 b) return a+b");
   
   EXPECT_THAT( res.tokens, ElementsAre(
-    LEX_IDENT,
+    LEX_FN,
     LEX_IDENT,
     '(',
     LEX_IDENT,
@@ -201,23 +215,31 @@ TEST(fsm, function_add)
     LEX_IDENT,
     LEX_IDENT,
     ')',
-    LEX_IDENT,
+    LEX_RETURN,
     LEX_IDENT,
     '+',
     LEX_IDENT));
   ASSERT_FALSE(err);
   
 
-  EXPECT_EQ(res.numIdentifiers(), 9);
-  EXPECT_EQ(res.getIdentifierString(0), "fn");
-  EXPECT_EQ(res.getIdentifierString(1), "sum");
-  EXPECT_EQ(res.getIdentifierString(2), "i64");
-  EXPECT_EQ(res.getIdentifierString(3), "a");
-  EXPECT_EQ(res.getIdentifierString(4), "i64");
-  EXPECT_EQ(res.getIdentifierString(5), "b");
-  EXPECT_EQ(res.getIdentifierString(6), "return");
-  EXPECT_EQ(res.getIdentifierString(7), "a");
-  EXPECT_EQ(res.getIdentifierString(8), "b");
+  EXPECT_EQ(res.numIdentifiers(), 7);
+  EXPECT_EQ(res.getIdentifierString(0), "sum");
+  EXPECT_EQ(res.getIdentifierString(1), "i64");
+  EXPECT_EQ(res.getIdentifierString(2), "a");
+  EXPECT_EQ(res.getIdentifierString(3), "i64");
+  EXPECT_EQ(res.getIdentifierString(4), "b");
+  EXPECT_EQ(res.getIdentifierString(5), "a");
+  EXPECT_EQ(res.getIdentifierString(6), "b");
+}
+
+TEST(fsm, keywords)
+{
+  test("if iff else x while1 return",
+    {{LEX_IF, ""}, {LEX_IDENT, "iff"}, {LEX_ELSE, ""}, {LEX_IDENT, "x"},
+     {LEX_IDENT, "while1"}, {LEX_RETURN, ""}});
+  test("fn(true,false)",
+    {{LEX_FN, ""}, {'(', ""}, {LEX_TRUE, ""}, {',', ""}, {LEX_FALSE, ""},
+     {')', ""}});
 }
 
 TEST(fsm, fake_10k)
@@ -227,3 +249,105 @@ TEST(fsm, fake_10k)
     TEST_DIR "fake_program_10k.toks",
     false);
 }
+
+TEST(fsm, runtime_table)
+{
+  // every byte value, so each character class is exercised
+  std::string inp;
+  for (int i=1; i<256; ++i) inp += static_cast<char>(i);
+  inp += " 0x12 0120 1.5 a+=b != c ^= d # done\n\"str\"";
+
+  for (const auto & txt : {inp, std::string("\"open")}) {
+    std::stringstream ss(txt);
+    auto is = make_stream(ss);
+    lexed_t fixed, runtime;
+    auto fixed_err = fsm_lex(is, fixed);
+    auto runtime_err = fsm_lex(is, make_fsm_table(), runtime);
+    EXPECT_EQ(fixed_err, runtime_err);
+    EXPECT_EQ(fixed.tokens, runtime.tokens);
+    std::ostringstream a, b;
+    print(a, fixed);
+    print(b, runtime);
+    EXPECT_EQ(a.str(), b.str());
+  }
+}
+
+TEST(fsm, generated)
+{
+  // the generated scanner runs the same machine, whatever the bytes
+  std::string inp;
+  for (int i=1; i<256; ++i) inp += static_cast<char>(i);
+  inp += " 0x12 0120 1.5 a+=b != c ^= d # done\n\"str\"";
+
+  std::ifstream infile(TEST_DIR "fake_program_10k.txt");
+  std::stringstream fake;
+  fake << infile.rdbuf();
+
+  for (const auto & txt : {inp, std::string("\"open"), fake.str()}) {
+    std::stringstream ss(txt);
+    auto is = make_stream(ss);
+    lexed_t table, generated;
+    std::stringstream table_errs, generated_errs;
+    int table_err, generated_err;
+    {
+      error_redirect_t redirect(table_errs);
+      table_err = fsm_lex(is, table);
+    }
+    {
+      error_redirect_t redirect(generated_errs);
+      generated_err = fsm_gen_lex(is, generated);
+    }
+    EXPECT_EQ(table_err, generated_err);
+    EXPECT_EQ(table_errs.str(), generated_errs.str());
+    EXPECT_EQ(table.tokens, generated.tokens);
+    std::ostringstream a, b;
+    print(a, table);
+    print(b, generated);
+    EXPECT_EQ(a.str(), b.str());
+  }
+}
+
+TEST(fsm, compiled)
+{
+  std::ifstream infile(TEST_DIR "fake_program_10k.txt");
+  std::stringstream fake;
+  fake << infile.rdbuf();
+
+  auto table = make_fsm_table();
+  auto fsm = compile_fsm(table, fake.str().substr(0, 10000));
+  EXPECT_GT(fsm.num_states, 0);
+  EXPECT_LT(fsm.num_states, table.rows);
+  EXPECT_LT(fsm.num_classes, table.cols);
+  EXPECT_EQ(fsm.compact[fsm.states[0]], 0);
+
+  // every layout holds the same transitions
+  fsm_dense_t<uint8_t> dense(fsm);
+  fsm_comb_t comb(fsm);
+  EXPECT_LT(comb.bytes(), dense.bytes());
+  for (int s=0; s<fsm.num_states; ++s)
+    for (int c=0; c<fsm.num_classes; ++c) {
+      EXPECT_EQ(dense(s, c), fsm(s, c));
+      EXPECT_EQ(comb(s, c), fsm(s, c));
+    }
+
+  std::string inp;
+  for (int i=1; i<256; ++i) inp += static_cast<char>(i);
+  inp += " 0x12 0120 1.5 a+=b != c ^= d # done\n\"str\"";
+
+  for (const auto & txt : {inp, std::string("\"open"), fake.str()}) {
+    std::stringstream ss(txt);
+    auto is = make_stream(ss);
+    std::stringstream errs;
+    error_redirect_t redirect(errs);
+    lexed_t plain, packed, combed;
+    auto err = fsm_lex(is, plain);
+    EXPECT_EQ(fsm_lex(is, fsm, dense, packed), err);
+    EXPECT_EQ(fsm_lex(is, fsm, comb, combed), err);
+    EXPECT_EQ(plain.tokens, packed.tokens);
+    EXPECT_EQ(plain.tokens, combed.tokens);
+    std::ostringstream a, b;
+    print(a, plain);
+    print(b, combed);
+    EXPECT_EQ(a.str(), b.str());
+  }
+}
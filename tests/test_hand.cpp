@@ -3,6 +3,10 @@
 #include <utils.hpp>
 
 #include <chrono>
+#include <fstream>
+#include <map>
+#include <memory_resource>
+#include <regex>
 
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
@@ -116,6 +120,23 @@ TEST(hand, line)
 
 TEST(hand, quote) {
   test("\"Quoted\"", {{LEX_QUOTED, "Quoted"}});
+  test("\"Quo\nted", {{LEX_QUOTED, "Quo\nted"}}, true);
+}
+
+TEST(hand, unterminated) {
+  // the literal ends at the end of the input, not past the padding
+  auto [res, err] = test("a = \"open");
+  EXPECT_TRUE(err);
+  ASSERT_EQ(res.numTokens(), 3);
+  EXPECT_EQ(res.tokens[2], LEX_QUOTED);
+  EXPECT_EQ(res.token_pos[2].begin, 4);
+  EXPECT_EQ(res.token_pos[2].end, 9);
+  EXPECT_EQ(res.getIdentifierString(res.findIdentifier(2)), "open");
+
+  std::tie(res, err) = test("\"");
+  ASSERT_EQ(res.numTokens(), 1);
+  EXPECT_EQ(res.token_pos[0].end, 1);
+  EXPECT_EQ(res.getIdentifierString(res.findIdentifier(0)), "");
 }
 
 TEST(hand, comment) {
@@ -175,7 +196,7 @@ TEST(hand, function_add)
   
   ASSERT_FALSE(err);
   EXPECT_THAT( res.tokens, ElementsAre(
-    LEX_IDENT,
+    LEX_FN,
     LEX_IDENT,
     '(',
     LEX_IDENT,
@@ -184,22 +205,58 @@ TEST(hand, function_add)
     LEX_IDENT,
     LEX_IDENT,
     ')',
-    LEX_IDENT,
+    LEX_RETURN,
     LEX_IDENT,
     '+',
     LEX_IDENT));
   
 
-  EXPECT_EQ(res.numIdentifiers(), 9);
-  EXPECT_EQ(res.getIdentifierString(0), "fn");
-  EXPECT_EQ(res.getIdentifierString(1), "sum");
-  EXPECT_EQ(res.getIdentifierString(2), "i64");
-  EXPECT_EQ(res.getIdentifierString(3), "a");
-  EXPECT_EQ(res.getIdentifierString(4), "i64");
-  EXPECT_EQ(res.getIdentifierString(5), "b");
-  EXPECT_EQ(res.getIdentifierString(6), "return");
-  EXPECT_EQ(res.getIdentifierString(7), "a");
-  EXPECT_EQ(res.getIdentifierString(8), "b");
+  EXPECT_EQ(res.numIdentifiers(), 7);
+  EXPECT_EQ(res.getIdentifierString(0), "sum");
+  EXPECT_EQ(res.getIdentifierString(1), "i64");
+  EXPECT_EQ(res.getIdentifierString(2), "a");
+  EXPECT_EQ(res.getIdentifierString(3), "i64");
+  EXPECT_EQ(res.getIdentifierString(4), "b");
+  EXPECT_EQ(res.getIdentifierString(5), "a");
+  EXPECT_EQ(res.getIdentifierString(6), "b");
+}
+
+TEST(hand, keywords)
+{
+  test("if iff else x while1 return",
+    {{LEX_IF, ""}, {LEX_IDENT, "iff"}, {LEX_ELSE, ""}, {LEX_IDENT, "x"},
+     {LEX_IDENT, "while1"}, {LEX_RETURN, ""}});
+
+  // every keyword is found in the table, and nothing close to one
+#define KEYWORD_TEST(name, str) \
+  test(str, {{name, ""}}); \
+  test(str "0", {{LEX_IDENT, str "0"}}); \
+  test(std::string(str).substr(1), {{LEX_IDENT, std::string(str).substr(1)}});
+  FOR_LEX_KEYWORDS(KEYWORD_TEST)
+#undef KEYWORD_TEST
+}
+
+TEST(hand, re2c_keywords)
+{
+  // re2c matches keywords with literal rules rather than the hash, so they
+  // are checked here against FOR_LEX_KEYWORDS even when re2c is not built
+  std::ifstream infile(TEST_DIR "../src/re2c.re");
+  ASSERT_TRUE(infile.good());
+  std::regex rule(R"re(^\s*"([a-z]+)"\s*\{.*\b(LEX_[A-Z_]+)\s*\};\s*\})re");
+
+  std::map<std::string, std::string> rules;
+  std::string line;
+  while (std::getline(infile, line)) {
+    std::smatch m;
+    if (!std::regex_search(line, m, rule)) continue;
+    EXPECT_TRUE(rules.emplace(m[1], m[2]).second) << "twice: " << m[1];
+  }
+
+  std::map<std::string, std::string> keywords;
+#define KEYWORD_NAME(name, str) keywords.emplace(str, #name);
+  FOR_LEX_KEYWORDS(KEYWORD_NAME)
+#undef KEYWORD_NAME
+  EXPECT_EQ(rules, keywords);
 }
 
 TEST(hand, error)
@@ -215,3 +272,153 @@ TEST(hand, fake_10k)
     TEST_DIR "fake_program_10k.toks",
     false);
 }
+
+TEST(hand, intern)
+{
+  std::stringstream ss("fn  sum(i64 a, i64 b) return a+b");
+  auto is = make_stream(ss);
+  lexed_t res;
+  res.intern = true;
+  ASSERT_FALSE(hand_lex(is, res));
+
+  EXPECT_EQ(res.numIdentifiers(), 7);
+  EXPECT_EQ(res.numSymbols(), 4);
+  EXPECT_THAT( res.identifier_symbols, ElementsAre(0, 1, 2, 1, 3, 2, 3) );
+
+  std::vector<std::string_view> strs;
+  for (size_t i=0; i<res.numTokens(); ++i) {
+    auto id = res.findIdentifier(i);
+    if (id >= 0) strs.emplace_back(res.getIdentifierString(id));
+  }
+  EXPECT_THAT( strs, ElementsAre(
+    "sum", "i64", "a", "i64", "b", "a", "b") );
+}
+
+TEST(hand, decode)
+{
+  std::stringstream ss(
+    "x 7 9223372036854775807 9223372036854775808 1.5 .25e2 1e999 1e-999 \"12\"");
+  auto is = make_stream(ss);
+  lexed_t res;
+  res.decode = true;
+  ASSERT_FALSE(hand_lex(is, res));
+  ASSERT_EQ(res.identifier_values.size(), res.numIdentifiers());
+
+  EXPECT_EQ(res.findValue(0), nullptr);
+  EXPECT_EQ(res.findValue(8), nullptr);
+  EXPECT_EQ(res.findValue(1)->i, 7);
+  EXPECT_EQ(res.findValue(2)->i, INT64_MAX);
+  EXPECT_FALSE(res.valueOverflowed(2));
+  EXPECT_EQ(res.findValue(3)->i, INT64_MAX);
+  EXPECT_TRUE(res.valueOverflowed(3));
+  EXPECT_EQ(res.findValue(4)->d, 1.5);
+  EXPECT_EQ(res.findValue(5)->d, 25.0);
+  EXPECT_TRUE(res.valueOverflowed(6));
+  EXPECT_EQ(res.findValue(7)->d, 0.0);
+  EXPECT_FALSE(res.valueOverflowed(7));
+  EXPECT_EQ(res.findValue(-1), nullptr);
+  EXPECT_EQ(res.findValue(res.numTokens()), nullptr);
+}
+
+TEST(hand, intern_10k)
+{
+  auto inname = TEST_DIR "fake_program_10k.txt";
+  std::ifstream infile(inname);
+  auto is = make_stream(infile, inname);
+
+  lexed_t plain, interned;
+  interned.intern = true;
+  hand_lex(is, plain);
+  hand_lex(is, interned);
+
+  ASSERT_EQ(plain.numIdentifiers(), interned.numIdentifiers());
+  EXPECT_LT(interned.identifier_data.size(), plain.identifier_data.size());
+  for (size_t i=0; i<plain.numTokens(); ++i) {
+    auto a = plain.findIdentifier(i);
+    auto b = interned.findIdentifier(i);
+    ASSERT_EQ(a < 0, b < 0);
+    if (a >= 0) {
+      ASSERT_EQ(plain.getIdentifierString(a), interned.getIdentifierString(b));
+    }
+  }
+}
+
+//---------------------------------------------------------------------------
+struct counting_resource_t : std::pmr::memory_resource {
+  std::pmr::monotonic_buffer_resource arena;
+  size_t allocations = 0;
+
+  void * do_allocate(size_t bytes, size_t align) override
+  {
+    allocations++;
+    return arena.allocate(bytes, align);
+  }
+  void do_deallocate(void *, size_t, size_t) override {}
+  bool do_is_equal(const memory_resource & other) const noexcept override
+  { return this == &other; }
+};
+
+TEST(hand, reset_arena)
+{
+  auto inname = TEST_DIR "fake_program_10k.txt";
+  std::ifstream infile(inname);
+  auto is = make_stream(infile, inname);
+
+  lexed_t fresh;
+  fresh.intern = true;
+  hand_lex(is, fresh);
+
+  // once the arrays have grown, lexing the same input again allocates nothing
+  counting_resource_t arena;
+  lexed_t res(&arena);
+  res.intern = true;
+  res.reserve(is.buffer.size());
+  hand_lex(is, res);
+  EXPECT_GT(arena.allocations, 0);
+
+  for (int i=0; i<2; ++i) {
+    auto before = arena.allocations;
+    res.reset();
+    EXPECT_EQ(res.numTokens(), 0);
+    EXPECT_EQ(res.numSymbols(), 0);
+    hand_lex(is, res);
+    EXPECT_EQ(arena.allocations, before);
+  }
+
+  ASSERT_EQ(fresh.numTokens(), res.numTokens());
+  EXPECT_TRUE(std::equal(fresh.tokens.begin(), fresh.tokens.end(), res.tokens.begin()));
+  EXPECT_EQ(fresh.identifier_data, res.identifier_data);
+  EXPECT_EQ(fresh.identifier_symbols, res.identifier_symbols);
+}
+
+TEST(hand, compact)
+{
+  // the long quote, and both tokens past a gap too wide for an offset, are
+  // kept whole
+  auto inname = TEST_DIR "fake_program_10k.txt";
+  std::ifstream infile(inname);
+  std::stringstream ss;
+  ss << infile.rdbuf() << "\n\"" << std::string(1000, 'q') << "\""
+    << std::string(compact_positions_t::max_offset + 10, ' ') << "a b";
+  auto is = make_stream(ss);
+
+  lexed_t whole, compact;
+  compact.compact = true;
+  hand_lex(is, whole);
+  hand_lex(is, compact);
+
+  ASSERT_EQ(whole.numTokens(), compact.numTokens());
+  EXPECT_TRUE(compact.token_pos.empty());
+  EXPECT_EQ(compact.compact_pos.escapes.size(), 3);
+  for (size_t i=0; i<whole.numTokens(); ++i) {
+    ASSERT_EQ(whole.tokenPos(i).begin, compact.tokenPos(i).begin) << "token " << i;
+    ASSERT_EQ(whole.tokenPos(i).end, compact.tokenPos(i).end) << "token " << i;
+  }
+  EXPECT_LT(2*compact.compact_pos.bytes(), whole.numTokens()*sizeof(stream_pos_t));
+
+  // and read back the same through a lexed_t that is not compact
+  lexed_t appended;
+  appended.append(compact);
+  EXPECT_EQ(appended.token_pos.size(), whole.numTokens());
+  EXPECT_EQ(appended.token_pos.back().begin, whole.token_pos.back().begin);
+}
@@ -0,0 +1,100 @@
+#include <cache.hpp>
+#include <lex.hpp>
+#include <stream.hpp>
+#include <thread_pool.hpp>
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace lex;
+
+//---------------------------------------------------------------------------
+static lexed_t lex_string(const std::string & str)
+{
+  std::stringstream ss(str);
+  auto is = make_stream(ss);
+  lexed_t lx;
+  hand_lex(is, lx);
+  return lx;
+}
+
+//---------------------------------------------------------------------------
+static std::string printed(const lexed_t & lx, int format)
+{
+  std::stringstream ss;
+  print(ss, lx, format);
+  return ss.str();
+}
+
+//---------------------------------------------------------------------------
+static std::string written(const lexed_t & lx, int format, thread_pool_t * pool)
+{
+  auto name = (std::filesystem::temp_directory_path() / "lex_test_output").string();
+  auto fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  EXPECT_GE(fd, 0);
+  EXPECT_TRUE(write_tokens(fd, lx, format, pool));
+  close(fd);
+
+  std::ifstream in(name);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  std::remove(name.c_str());
+  return ss.str();
+}
+
+//=============================================================================
+// Individual tests
+//=============================================================================
+
+TEST(output, names)
+{
+  EXPECT_EQ(str_to_format("table"), FORMAT_TABLE);
+  EXPECT_EQ(str_to_format("jsonl"), FORMAT_JSONL);
+  EXPECT_EQ(str_to_format("csv"), FORMAT_CSV);
+  EXPECT_EQ(str_to_format("tsv"), FORMAT_TSV);
+  EXPECT_EQ(str_to_format("xml"), -1);
+}
+
+TEST(output, formats)
+{
+  // a comma kind, and text with a backslash, tab and newline
+  auto lx = lex_string("a , \"b\\\tc\nd\"\n");
+
+  EXPECT_EQ(printed(lx, FORMAT_JSONL),
+    "{\"id\":0,\"type\":256,\"kind\":\"IDENT\",\"begin\":0,\"end\":1,\"ident\":0,\"text\":\"a\"}\n"
+    "{\"id\":1,\"type\":44,\"kind\":\",\",\"begin\":2,\"end\":3}\n"
+    "{\"id\":2,\"type\":261,\"kind\":\"QUOTED\",\"begin\":4,\"end\":12,\"ident\":1,"
+    "\"text\":\"b\\\\\\tc\\nd\"}\n");
+
+  EXPECT_EQ(printed(lx, FORMAT_CSV),
+    "id,type,kind,begin,end,ident,text\n"
+    "0,256,IDENT,0,1,0,a\n"
+    "1,44,\",\",2,3,,\n"
+    "2,261,QUOTED,4,12,1,\"b\\\tc\nd\"\n");
+
+  EXPECT_EQ(printed(lx, FORMAT_TSV),
+    "id\ttype\tkind\tbegin\tend\tident\ttext\n"
+    "0\t256\tIDENT\t0\t1\t0\ta\n"
+    "1\t44\t,\t2\t3\t\t\n"
+    "2\t261\tQUOTED\t4\t12\t1\tb\\\\\\tc\\nd\n");
+}
+
+TEST(output, parallel)
+{
+  // more tokens than one chunk, formatted on the pool in order
+  std::stringstream ss;
+  for (int i=0; i<40000; ++i) ss << "x" << i << " = \"" << i << "\" + 1.5 # c\n";
+  auto lx = lex_string(ss.str());
+
+  thread_pool_t pool(4);
+  for (int format : {FORMAT_TABLE, FORMAT_JSONL, FORMAT_CSV, FORMAT_TSV}) {
+    auto serial = printed(lx, format);
+    EXPECT_EQ(written(lx, format, nullptr), serial);
+    EXPECT_EQ(written(lx, format, &pool), serial);
+  }
+}
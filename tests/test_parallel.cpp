@@ -0,0 +1,197 @@
+#include <lex.hpp>
+#include <stream.hpp>
+#include <thread_pool.hpp>
+#include <utils.hpp>
+
+#include <gtest/gtest.h>
+
+using namespace lex;
+
+//---------------------------------------------------------------------------
+static void compare(
+  stream_t & is,
+  const range_lexer_t & lexer,
+  int nthreads,
+  bool intern = false)
+{
+  lexed_t serial, parallel;
+  serial.intern = parallel.intern = intern;
+  size_t stop;
+  auto serial_err = lexer(is, serial, 0, is.buffer.size(), stop);
+
+  thread_pool_t pool(nthreads);
+  auto parallel_err = parallel_lex(is, parallel, lexer, pool);
+
+  EXPECT_EQ(serial_err, parallel_err);
+  EXPECT_EQ(serial.tokens, parallel.tokens);
+  EXPECT_EQ(serial.identifier_data, parallel.identifier_data);
+  EXPECT_EQ(serial.identifier_offsets, parallel.identifier_offsets);
+  EXPECT_EQ(serial.identifier_tokens, parallel.identifier_tokens);
+  EXPECT_EQ(serial.identifier_symbols, parallel.identifier_symbols);
+  ASSERT_EQ(serial.token_pos.size(), parallel.token_pos.size());
+  for (size_t i=0; i<serial.token_pos.size(); ++i) {
+    EXPECT_EQ(serial.token_pos[i].begin, parallel.token_pos[i].begin);
+    EXPECT_EQ(serial.token_pos[i].end, parallel.token_pos[i].end);
+  }
+}
+
+//---------------------------------------------------------------------------
+static void compare(stream_t & is, int nthreads)
+{
+  auto table = make_fsm_table();
+  compare(is,
+    [](auto & is, auto & lx, auto first, auto last, auto & stop)
+    { return hand_lex(is, lx, first, last, stop); },
+    nthreads);
+  compare(is,
+    [&](auto & is, auto & lx, auto first, auto last, auto & stop)
+    { return fsm_lex(is, table, lx, first, last, stop); },
+    nthreads);
+}
+
+//=============================================================================
+// Individual tests
+//=============================================================================
+
+TEST(parallel, fake_10k)
+{
+  auto inname = TEST_DIR "fake_program_10k.txt";
+  std::ifstream infile(inname);
+  auto is = make_stream(infile, inname);
+  compare(is, 4);
+}
+
+TEST(parallel, multiline_quotes)
+{
+  // quotes spanning many lines, and quotes hidden in comments, make the
+  // chunks start in either state
+  std::stringstream ss;
+  for (int i=0; i<20000; ++i) {
+    ss << "a" << i << " = \"x\n" << i << "\n\" # \"\n";
+    if (i % 7 == 0) ss << "\"" << std::string(100, '\n') << "\"\n";
+    if (i % 11 == 0) ss << "  \t\n\n";
+  }
+  auto is = make_stream(ss);
+  compare(is, 3);
+}
+
+TEST(parallel, unterminated)
+{
+  // the last chunk starts after a closing quote, so guessing that it starts
+  // between tokens opens a literal that never ends
+  std::stringstream ss;
+  ss << "\"";
+  for (int i=0; i<20000; ++i)
+    ss << "b" << i << " 12 \n";
+  ss << "\"\n";
+  for (int i=0; i<20000; ++i)
+    ss << "c" << i << " 13 \n";
+  auto is = make_stream(ss);
+  compare(is, 2);
+}
+
+TEST(parallel, decode)
+{
+  auto inname = TEST_DIR "fake_program_10k.txt";
+  std::ifstream infile(inname);
+  auto is = make_stream(infile, inname);
+
+  lexed_t serial, parallel;
+  serial.decode = parallel.decode = true;
+  fsm_lex(is, serial);
+  thread_pool_t pool(4);
+  parallel_lex(is, parallel,
+    [](auto & is, auto & lx, auto first, auto last, auto & stop)
+    { return fsm_lex(is, lx, first, last, stop); },
+    pool);
+
+  ASSERT_EQ(serial.identifier_values.size(), parallel.identifier_values.size());
+  for (size_t i=0; i<serial.identifier_values.size(); ++i)
+    ASSERT_EQ(serial.identifier_values[i].i, parallel.identifier_values[i].i);
+  EXPECT_EQ(serial.identifier_overflow, parallel.identifier_overflow);
+}
+
+TEST(parallel, intern)
+{
+  auto inname = TEST_DIR "fake_program_10k.txt";
+  std::ifstream infile(inname);
+  auto is = make_stream(infile, inname);
+  compare(is,
+    [](auto & is, auto & lx, auto first, auto last, auto & stop)
+    { return hand_lex(is, lx, first, last, stop); },
+    4, true);
+}
+
+//---------------------------------------------------------------------------
+static void compare_enum(stream_t & is, size_t block_size)
+{
+  lexed_t serial;
+  serial.diagnostics.hold = true;
+  serial.intern = true;
+  size_t serial_stop;
+  auto serial_err = fsm_lex(is, serial, 0, is.buffer.size(), serial_stop);
+
+  thread_pool_t pool(3);
+  for (auto p : {(thread_pool_t*)nullptr, &pool}) {
+    lexed_t blocks;
+    blocks.diagnostics.hold = true;
+    blocks.intern = true;
+    size_t stop;
+    auto err = fsm_enum_lex(is, blocks, 0, is.buffer.size(), stop, p, block_size);
+
+    EXPECT_EQ(serial_err, err);
+    EXPECT_EQ(serial_stop, stop);
+    EXPECT_EQ(serial.tokens, blocks.tokens);
+    EXPECT_EQ(serial.identifier_data, blocks.identifier_data);
+    EXPECT_EQ(serial.identifier_symbols, blocks.identifier_symbols);
+    EXPECT_EQ(serial.diagnostics.items, blocks.diagnostics.items);
+    ASSERT_EQ(serial.token_pos.size(), blocks.token_pos.size());
+    for (size_t i=0; i<serial.token_pos.size(); ++i) {
+      EXPECT_EQ(serial.token_pos[i].begin, blocks.token_pos[i].begin);
+      EXPECT_EQ(serial.token_pos[i].end, blocks.token_pos[i].end);
+    }
+  }
+}
+
+TEST(parallel, fsm_enum)
+{
+  auto inname = TEST_DIR "fake_program_10k.txt";
+  std::ifstream infile(inname);
+  auto is = make_stream(infile, inname);
+  for (auto size : {7, 64, 4096})
+    compare_enum(is, size);
+}
+
+TEST(parallel, fsm_enum_tricky)
+{
+  // blocks that start inside literals, comments and unknown bytes
+  std::stringstream ss;
+  for (int i=0; i<500; ++i) {
+    ss << "a" << i << " = \"x\n" << i << "\n\" # \"\n";
+    if (i % 7 == 0) ss << "\"" << std::string(30, '\n') << "\"\n";
+    if (i % 11 == 0) ss << "1.5e+3 ?? \x80\xff <= != \n";
+  }
+  ss << "\"open";
+  auto is = make_stream(ss);
+  for (auto size : {1, 3, 64, 1000})
+    compare_enum(is, size);
+}
+
+TEST(parallel, fsm_enum_range)
+{
+  auto inname = TEST_DIR "fake_program_10k.txt";
+  std::ifstream infile(inname);
+  auto is = make_stream(infile, inname);
+
+  auto size = is.buffer.size();
+  for (size_t first : {size_t(0), size_t(17), size/3})
+    for (size_t last : {size/3 + 5, size/2, size - 1}) {
+      lexed_t serial, blocks;
+      serial.diagnostics.hold = blocks.diagnostics.hold = true;
+      size_t serial_stop, stop;
+      fsm_lex(is, serial, first, last, serial_stop);
+      fsm_enum_lex(is, blocks, first, last, stop, nullptr, 101);
+      EXPECT_EQ(serial_stop, stop);
+      EXPECT_EQ(serial.tokens, blocks.tokens);
+    }
+}
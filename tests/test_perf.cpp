@@ -0,0 +1,44 @@
+#include <lex.hpp>
+#include <perf.hpp>
+#include <stream.hpp>
+
+#include <gtest/gtest.h>
+
+using namespace lex;
+
+TEST(perf, names)
+{
+  EXPECT_EQ(perf_to_str(PERF_CYCLES), "cycles");
+  EXPECT_EQ(perf_to_str(PERF_LLC_MISSES), "LLC-misses");
+}
+
+TEST(perf, counters)
+{
+  perf_counters_t perf;
+
+  std::ifstream infile(TEST_DIR "fake_program_10k.txt");
+  auto is = make_stream(infile);
+
+  perf.start();
+  lexed_t res;
+  fsm_lex(is, res);
+  perf.stop();
+
+  // counters that could not be opened stay at zero
+  for (int c=0; c<PERF_NUM_COUNTERS; ++c)
+    if (!perf.has(c)) {
+      EXPECT_EQ(perf.counts[c], 0);
+    }
+
+  if (!perf.available()) {
+    EXPECT_FALSE(perf.reason().empty());
+    GTEST_SKIP() << perf.reason();
+  }
+
+  if (perf.has(PERF_INSTRUCTIONS)) {
+    EXPECT_GT(perf.counts[PERF_INSTRUCTIONS], is.buffer.size());
+  }
+  if (perf.has(PERF_CYCLES)) {
+    EXPECT_GT(perf.counts[PERF_CYCLES], 0);
+  }
+}
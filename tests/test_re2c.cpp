@@ -178,7 +178,7 @@ TEST(re2c, function_add)
   
   ASSERT_FALSE(err);
   EXPECT_THAT( res.tokens, ElementsAre(
-    LEX_IDENT,
+    LEX_FN,
     LEX_IDENT,
     '(',
     LEX_IDENT,
@@ -187,22 +187,20 @@ TEST(re2c, function_add)
     LEX_IDENT,
     LEX_IDENT,
     ')',
-    LEX_IDENT,
+    LEX_RETURN,
     LEX_IDENT,
     '+',
     LEX_IDENT));
   
 
-  EXPECT_EQ(res.numIdentifiers(), 9);
-  EXPECT_EQ(res.getIdentifierString(0), "fn");
-  EXPECT_EQ(res.getIdentifierString(1), "sum");
-  EXPECT_EQ(res.getIdentifierString(2), "i64");
-  EXPECT_EQ(res.getIdentifierString(3), "a");
-  EXPECT_EQ(res.getIdentifierString(4), "i64");
-  EXPECT_EQ(res.getIdentifierString(5), "b");
-  EXPECT_EQ(res.getIdentifierString(6), "return");
-  EXPECT_EQ(res.getIdentifierString(7), "a");
-  EXPECT_EQ(res.getIdentifierString(8), "b");
+  EXPECT_EQ(res.numIdentifiers(), 7);
+  EXPECT_EQ(res.getIdentifierString(0), "sum");
+  EXPECT_EQ(res.getIdentifierString(1), "i64");
+  EXPECT_EQ(res.getIdentifierString(2), "a");
+  EXPECT_EQ(res.getIdentifierString(3), "i64");
+  EXPECT_EQ(res.getIdentifierString(4), "b");
+  EXPECT_EQ(res.getIdentifierString(5), "a");
+  EXPECT_EQ(res.getIdentifierString(6), "b");
 }
 
 TEST(re2c, error)
@@ -220,3 +218,23 @@ TEST(re2c, fake_10k)
     TEST_DIR "fake_program_10k.toks",
     false);
 }
+
+TEST(re2c, cursor)
+{
+  std::stringstream ss("fn sum(i64 a) return \"a\" # done\n");
+  auto is = make_stream(ss);
+  lexed_t res;
+  re2c_lex(is, res);
+
+  re2c_cursor_t cursor(is);
+  token_t tok;
+  size_t n = 0;
+  while (cursor.next_token(tok)) {
+    ASSERT_LT(n, res.numTokens());
+    EXPECT_EQ(tok.kind, res.tokens[n]);
+    auto id = res.findIdentifier(n);
+    EXPECT_EQ(tok.text, id < 0 ? "" : res.getIdentifierString(id));
+    n++;
+  }
+  EXPECT_EQ(n, res.numTokens());
+}
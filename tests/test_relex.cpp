@@ -0,0 +1,264 @@
+#include <errors.hpp>
+#include <lex.hpp>
+#include <stream.hpp>
+
+#include <fstream>
+#include <random>
+
+#include <gtest/gtest.h>
+
+using namespace lex;
+
+//---------------------------------------------------------------------------
+static void expect_same(const lexed_t & a, const lexed_t & b)
+{
+  ASSERT_EQ(a.tokens, b.tokens);
+  for (size_t i=0; i<a.numTokens(); ++i) {
+    ASSERT_EQ(a.tokenPos(i).begin, b.tokenPos(i).begin) << "token " << i;
+    ASSERT_EQ(a.tokenPos(i).end, b.tokenPos(i).end) << "token " << i;
+  }
+  EXPECT_EQ(a.identifier_tokens, b.identifier_tokens);
+  EXPECT_EQ(a.identifier_bits, b.identifier_bits);
+  EXPECT_EQ(a.identifier_rank, b.identifier_rank);
+  for (size_t i=0; i<a.numTokens(); ++i)
+    ASSERT_EQ(
+      a.getIdentifierString(a.findIdentifier(i)),
+      b.getIdentifierString(b.findIdentifier(i))) << "token " << i;
+
+  ASSERT_EQ(a.decode, b.decode);
+  if (!a.decode) return;
+  ASSERT_EQ(a.identifier_values.size(), a.numIdentifiers());
+  EXPECT_EQ(a.identifier_overflow, b.identifier_overflow);
+  for (size_t i=0; i<a.numIdentifiers(); ++i)
+    ASSERT_EQ(a.identifier_values[i].i, b.identifier_values[i].i) << "identifier " << i;
+}
+
+//---------------------------------------------------------------------------
+/// Make random edits, checking each one against lexing from scratch
+template<typename Cursor>
+static void random_edits(
+  const std::string & inp,
+  int nedits,
+  bool intern = false,
+  bool decode = false,
+  bool compact = false)
+{
+  static const char * snippets[] = {
+    "", " ", "\n", "x", "12", ".", "e", "+", "=", "\"", "# ", "abc def",
+    "\"quoted\n text\"", "0x1", "1.2.3", "==", "\n\n#"};
+
+  std::mt19937 gen(nedits);
+  std::stringstream errs;
+  error_redirect_t redirect(errs);
+
+  std::stringstream ss(inp);
+  auto is = make_stream(ss);
+  lexed_t lx;
+  lx.intern = intern;
+  lx.decode = decode;
+  lx.compact = compact;
+  size_t stop;
+  Cursor all(is);
+  lex_all(all, lx, stop);
+
+  for (int n=0; n<nedits; ++n) {
+    auto size = is.buffer.size();
+    auto begin = std::uniform_int_distribution<size_t>(0, size)(gen);
+    auto len = std::uniform_int_distribution<size_t>(0, 8)(gen);
+    auto text = snippets[gen() % std::size(snippets)];
+    edit_t edit{begin, std::min(begin + len, size), text};
+
+    relex<Cursor>(is, lx, edit);
+
+    lexed_t fresh;
+    fresh.intern = intern;
+    fresh.decode = decode;
+    Cursor cursor(is);
+    lex_all(cursor, fresh, stop);
+    expect_same(lx, fresh);
+    if (testing::Test::HasFatalFailure()) return;
+
+    std::stringstream copy{std::string(is.buffer)};
+    EXPECT_EQ(is.newlines, make_stream(copy).newlines);
+  }
+}
+
+//---------------------------------------------------------------------------
+/// The same, to a buffer held in pieces of piece_size bytes
+template<typename Cursor>
+static void random_buffer_edits(
+  const std::string & inp,
+  int nedits,
+  size_t piece_size,
+  bool intern = false,
+  bool compact = false)
+{
+  static const char * snippets[] = {
+    "", " ", "\n", "x", "12", ".", "e", "+", "=", "\"", "# ", "abc def",
+    "\"quoted\n text\"", "0x1", "1.2.3", "==", "\n\n#", "1.2e\n"};
+
+  std::mt19937 gen(nedits);
+  std::stringstream errs;
+  error_redirect_t redirect(errs);
+
+  std::stringstream ss(inp);
+  auto is = make_stream(ss);
+  lexed_t lx;
+  lx.intern = intern;
+  lx.compact = compact;
+  size_t stop;
+  Cursor all(is);
+  lex_all(all, lx, stop);
+  edit_buffer_t buf(is, lx, relex<Cursor>, piece_size);
+
+  for (int n=0; n<nedits; ++n) {
+    auto size = buf.size();
+    auto begin = std::uniform_int_distribution<size_t>(0, size)(gen);
+    auto len = std::uniform_int_distribution<size_t>(0, n % 10 ? 8 : 200)(gen);
+    auto text = snippets[gen() % std::size(snippets)];
+    buf.edit({begin, std::min(begin + len, size), text});
+
+    auto whole = buf.text();
+    std::stringstream copy(whole);
+    auto fresh_is = make_stream(copy);
+    lexed_t fresh;
+    Cursor cursor(fresh_is);
+    lex_all(cursor, fresh, stop);
+
+    lexed_t flat;
+    flat.intern = intern;
+    flat.compact = compact;
+    buf.flatten(flat);
+    expect_same(flat, fresh);
+    if (testing::Test::HasFatalFailure()) return;
+
+    // each piece starts where the last one ended, on the line after it
+    size_t lines = 0;
+    for (auto & piece : buf.pieces) {
+      ASSERT_EQ(whole.substr(piece.begin, piece.stream.buffer.size()), piece.stream.buffer);
+      ASSERT_EQ(piece.stream.first_line, lines);
+      lines += piece.stream.newlines.size();
+    }
+  }
+}
+
+//=============================================================================
+// Individual tests
+//=============================================================================
+
+TEST(relex, stream)
+{
+  std::stringstream ss("ab\ncd\nef\n");
+  auto is = make_stream(ss);
+  edit_stream(is, {3, 6, "x\ny\nz"});
+  EXPECT_EQ(is.buffer, "ab\nx\ny\nzef\n");
+  EXPECT_EQ(is.newlines, (std::vector<size_t>{2, 4, 6, 10}));
+}
+
+TEST(relex, small)
+{
+  std::stringstream ss("abc = 12 + def\n# note\nghi");
+  auto is = make_stream(ss);
+  lexed_t lx;
+  fsm_lex(is, lx);
+
+  // grow an identifier, then a number into a real
+  relex<fsm_cursor_t>(is, lx, {3, 3, "d"});
+  relex<fsm_cursor_t>(is, lx, {9, 9, ".5"});
+  EXPECT_EQ(is.buffer, "abcd = 12.5 + def\n# note\nghi");
+
+  lexed_t fresh;
+  fsm_lex(is, fresh);
+  expect_same(lx, fresh);
+  EXPECT_EQ(lx.tokens[2], LEX_REAL);
+}
+
+TEST(relex, quotes)
+{
+  // opening a quote changes everything after it
+  std::stringstream ss("a b\nc d\ne f");
+  auto is = make_stream(ss);
+  lexed_t lx;
+  hand_lex(is, lx);
+  std::stringstream errs;
+  error_redirect_t redirect(errs);
+  relex<hand_cursor_t>(is, lx, {2, 2, "\""});
+
+  lexed_t fresh;
+  hand_lex(is, fresh);
+  expect_same(lx, fresh);
+  EXPECT_EQ(lx.numTokens(), 2);
+}
+
+TEST(relex, random)
+{
+  std::ifstream infile(TEST_DIR "fake_program_10k.txt");
+  std::stringstream ss;
+  ss << infile.rdbuf();
+  auto inp = ss.str().substr(0, 20000) + "\"multi\nline\" # comment\n x";
+
+  random_edits<hand_cursor_t>(inp, 300);
+  random_edits<hand_simd_cursor_t>(inp, 300);
+  random_edits<fsm_cursor_t>(inp, 300);
+  random_edits<fsm_gen_cursor_t>(inp, 300);
+}
+
+TEST(relex, intern)
+{
+  random_edits<hand_cursor_t>("a b c\nd \"e\" f 12\n", 200, true);
+}
+
+TEST(relex, decode)
+{
+  auto inp = "a 1 2.5\n0x1f 017 \"e\" 9\n1e5 x 99999999999999999999\n";
+  random_edits<hand_cursor_t>(inp, 300, false, true);
+  random_edits<fsm_cursor_t>(inp, 300, true, true);
+}
+
+TEST(relex, compact)
+{
+  // long quotes and comments keep some positions whole
+  std::string inp = "a 1 \"" + std::string(300, 'q') + "\"\nb # c\n";
+  for (int i=0; i<40; ++i) inp += "x" + std::to_string(i) + " = y + 2\n";
+  random_edits<hand_cursor_t>(inp, 300, false, false, true);
+  random_edits<fsm_cursor_t>(inp, 300, true, false, true);
+}
+
+TEST(relex, buffer)
+{
+  std::ifstream infile(TEST_DIR "fake_program_10k.txt");
+  std::stringstream ss;
+  ss << infile.rdbuf();
+  auto inp = ss.str().substr(0, 20000) + "\"multi\nline\" # comment\n x";
+
+  random_buffer_edits<hand_cursor_t>(inp, 300, 256);
+  random_buffer_edits<fsm_cursor_t>(inp, 300, 1024);
+  random_buffer_edits<fsm_gen_cursor_t>(inp, 300, 64, true);
+  random_buffer_edits<hand_simd_cursor_t>(inp, 300, 256, false, true);
+}
+
+TEST(relex, buffer_quotes)
+{
+  std::string inp;
+  for (int i=0; i<100; ++i) inp += "a b\n";
+  std::stringstream ss(inp);
+  auto is = make_stream(ss);
+  lexed_t lx;
+  hand_lex(is, lx);
+  std::stringstream errs;
+  error_redirect_t redirect(errs);
+
+  edit_buffer_t buf(is, lx, relex<hand_cursor_t>, 40);
+  EXPECT_EQ(buf.pieces.size(), 10);
+
+  // opening a quote runs it through every piece, so there is nowhere to cut
+  buf.edit({2, 2, "\""});
+  EXPECT_EQ(buf.pieces.size(), 1);
+  EXPECT_EQ(buf.numTokens(), 2);
+
+  // and closing it again lets the piece be cut up
+  buf.edit({2, 3, ""});
+  EXPECT_GT(buf.pieces.size(), 1);
+  EXPECT_EQ(buf.numTokens(), 200);
+  EXPECT_EQ(buf.text(), inp);
+}
@@ -0,0 +1,127 @@
+#include <lex.hpp>
+#include <simd.hpp>
+#include <stream.hpp>
+#include <utils.hpp>
+
+#include <random>
+
+#include <gtest/gtest.h>
+
+using namespace lex;
+
+//---------------------------------------------------------------------------
+template<typename Scan>
+static void compare_kernels()
+{
+  // random runs of each class with every byte value mixed in, followed by
+  // the zero padding the kernels rely on
+  std::mt19937 gen(1);
+  std::string classes[] = {" \t\n\v\f\r", "azAZ_09", "0123456789"};
+  std::string buf;
+  for (int i=0; i<4000; ++i) {
+    auto & cls = classes[gen() % 3];
+    auto len = gen() % 70;
+    for (size_t j=0; j<len; ++j) buf += cls[gen() % cls.size()];
+    buf += static_cast<char>(gen() % 256);
+  }
+  buf.append(stream_padding, '\0');
+
+  auto n = buf.size() - stream_padding;
+  for (size_t i=0; i<n; ++i) {
+    auto p = buf.data() + i;
+    ASSERT_EQ(Scan::space(p),  ascii_scan_t::space(p))  << "at " << i;
+    ASSERT_EQ(Scan::alnum(p),  ascii_scan_t::alnum(p))  << "at " << i;
+    ASSERT_EQ(Scan::digits(p), ascii_scan_t::digits(p)) << "at " << i;
+  }
+}
+
+//---------------------------------------------------------------------------
+template<typename Newlines>
+static void compare_newlines()
+{
+  // every length and alignment up to a few blocks, with no padding past the
+  // end, so the tails are exercised
+  std::mt19937 gen(2);
+  std::string buf;
+  for (int i=0; i<300; ++i) buf += (gen() % 5) ? char(gen() % 256) : '\n';
+
+  for (size_t first=0; first<40; ++first)
+    for (size_t n=0; first+n<=buf.size(); n+=(n<80 ? 1 : 37)) {
+      std::string part(buf.data() + first, n);
+      std::vector<size_t> expect;
+      for (size_t i=0; i<n; ++i)
+        if (part[i] == '\n') expect.push_back(i);
+
+      ASSERT_EQ(Newlines::count(part.data(), n), expect.size()) << first << " " << n;
+      // appended after what is there
+      std::vector<size_t> found{7};
+      ASSERT_EQ(Newlines::find(part.data(), n, found), expect.size());
+      expect.insert(expect.begin(), 7);
+      ASSERT_EQ(found, expect) << first << " " << n;
+    }
+}
+
+//---------------------------------------------------------------------------
+static void compare_lexers(const std::string & inp)
+{
+  std::stringstream ss(inp);
+  auto is = make_stream(ss);
+  lexed_t a, b;
+  EXPECT_EQ(hand_lex(is, a), hand_simd_lex(is, b));
+  EXPECT_EQ(a.tokens, b.tokens);
+  EXPECT_EQ(a.identifier_data, b.identifier_data);
+  EXPECT_EQ(a.identifier_offsets, b.identifier_offsets);
+  ASSERT_EQ(a.token_pos.size(), b.token_pos.size());
+  for (size_t i=0; i<a.token_pos.size(); ++i) {
+    EXPECT_EQ(a.token_pos[i].begin, b.token_pos[i].begin);
+    EXPECT_EQ(a.token_pos[i].end, b.token_pos[i].end);
+  }
+}
+
+//=============================================================================
+// Individual tests
+//=============================================================================
+
+TEST(simd, ascii)
+{
+  for (int c=-128; c<128; ++c) {
+    EXPECT_EQ(ascii_t::is_alpha(c), bool(std::isalpha(static_cast<unsigned char>(c))));
+    EXPECT_EQ(ascii_t::is_digit(c), bool(std::isdigit(static_cast<unsigned char>(c))));
+    EXPECT_EQ(ascii_scan_t::is_space(c), bool(std::isspace(static_cast<unsigned char>(c))));
+  }
+}
+
+TEST(simd, sse42)
+{
+  if (detect_simd() < simd_level_t::sse42) GTEST_SKIP();
+  compare_kernels<sse42_scan_t>();
+}
+
+TEST(simd, avx2)
+{
+  if (detect_simd() < simd_level_t::avx2) GTEST_SKIP();
+  compare_kernels<avx2_scan_t>();
+}
+
+TEST(simd, newlines)
+{
+  compare_newlines<ascii_newlines_t>();
+  if (detect_simd() >= simd_level_t::sse2) compare_newlines<sse2_newlines_t>();
+  if (detect_simd() >= simd_level_t::avx2) compare_newlines<avx2_newlines_t>();
+  EXPECT_EQ(newline_positions("a\n\nbc\n"), (std::vector<size_t>{1, 2, 5}));
+}
+
+TEST(simd, hand)
+{
+  compare_lexers("fn  sum(i64 a, i64 b) return a+b");
+  compare_lexers(std::string(100, ' ') + std::string(100, 'x') + "1.2.3 1.2e+ .5e7");
+  compare_lexers("ab_c9\f\v\r\n" + std::string(45, '7') + ".." + std::string(40, '0'));
+  compare_lexers("\"unterminated " + std::string(80, 'q'));
+}
+
+TEST(simd, hand_10k)
+{
+  std::ifstream infile(TEST_DIR "fake_program_10k.txt");
+  std::string str(std::istreambuf_iterator<char>(infile), {});
+  compare_lexers(str);
+}
@@ -0,0 +1,86 @@
+#include <lex.hpp>
+#include <stream.hpp>
+#include <utils.hpp>
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+#include <gtest/gtest.h>
+
+using namespace lex;
+
+//---------------------------------------------------------------------------
+static std::string write_file(const std::string & name, const std::string & str)
+{
+  auto fname = (std::filesystem::temp_directory_path() / name).string();
+  std::ofstream out(fname, std::ios::binary);
+  out << str;
+  return fname;
+}
+
+//---------------------------------------------------------------------------
+static void expect_padded(const stream_t & is)
+{
+  auto data = is.buffer.data();
+  auto n = is.buffer.size();
+  for (size_t i=0; i<stream_padding; ++i)
+    EXPECT_EQ(data[n+i], '\0');
+}
+
+//=============================================================================
+// Individual tests
+//=============================================================================
+
+TEST(stream, copy)
+{
+  std::stringstream ss("a b\nc");
+  auto is = make_stream(ss);
+  EXPECT_EQ(is.buffer, "a b\nc");
+  EXPECT_EQ(is.newlines, std::vector<size_t>{3});
+  expect_padded(is);
+}
+
+TEST(stream, mmap)
+{
+  auto inname = TEST_DIR "fake_program_10k.txt";
+  std::ifstream infile(inname);
+  auto copied = make_stream(infile, inname);
+  auto mapped = map_stream(inname);
+
+  EXPECT_EQ(mapped.buffer, copied.buffer);
+  EXPECT_EQ(mapped.newlines, copied.newlines);
+  expect_padded(mapped);
+
+  lexed_t a, b;
+  EXPECT_EQ(hand_lex(copied, a), hand_lex(mapped, b));
+  EXPECT_EQ(a.tokens, b.tokens);
+  EXPECT_EQ(a.identifier_data, b.identifier_data);
+}
+
+TEST(stream, mmap_page_aligned)
+{
+  // the padding must still be readable when the file fills its last page
+  std::string str(4096, 'a');
+  str.back() = '\n';
+  auto fname = write_file("page.tmp", str);
+  auto is = map_stream(fname);
+  std::remove(fname.c_str());
+
+  EXPECT_EQ(is.buffer.size(), str.size());
+  expect_padded(is);
+
+  lexed_t res;
+  EXPECT_EQ(fsm_lex(is, make_fsm_table(), res), 0);
+  EXPECT_EQ(res.numTokens(), 1);
+}
+
+TEST(stream, mmap_empty)
+{
+  auto fname = write_file("empty.tmp", "");
+  auto is = map_stream(fname);
+  std::remove(fname.c_str());
+
+  EXPECT_TRUE(is.buffer.empty());
+  expect_padded(is);
+}
@@ -0,0 +1,118 @@
+#include <errors.hpp>
+#include <lex.hpp>
+#include <stream.hpp>
+
+#include <gtest/gtest.h>
+
+using namespace lex;
+
+//---------------------------------------------------------------------------
+static void compare(
+  const std::string & inp,
+  const range_lexer_t & lexer,
+  size_t window_size)
+{
+  std::stringstream whole_errs, stream_errs;
+  lexed_t whole, streamed;
+  int whole_err, stream_err;
+
+  {
+    error_redirect_t redirect(whole_errs);
+    std::stringstream ss(inp);
+    auto is = make_stream(ss, "inp");
+    size_t stop;
+    whole_err = lexer(is, whole, 0, is.buffer.size(), stop);
+  }
+  {
+    error_redirect_t redirect(stream_errs);
+    std::stringstream ss(inp);
+    stream_err = stream_lex(ss, "inp", streamed, lexer, window_size);
+  }
+
+  EXPECT_EQ(whole_err, stream_err);
+  EXPECT_EQ(whole_errs.str(), stream_errs.str());
+  EXPECT_EQ(whole.tokens, streamed.tokens);
+  EXPECT_EQ(whole.identifier_data, streamed.identifier_data);
+  EXPECT_EQ(whole.identifier_offsets, streamed.identifier_offsets);
+  EXPECT_EQ(whole.identifier_tokens, streamed.identifier_tokens);
+  ASSERT_EQ(whole.token_pos.size(), streamed.token_pos.size());
+  for (size_t i=0; i<whole.token_pos.size(); ++i) {
+    EXPECT_EQ(whole.token_pos[i].begin, streamed.token_pos[i].begin);
+    EXPECT_EQ(whole.token_pos[i].end, streamed.token_pos[i].end);
+  }
+}
+
+//---------------------------------------------------------------------------
+static void compare(const std::string & inp)
+{
+  for (size_t window_size : {16, 100, 4096, 1<<20}) {
+    compare(inp,
+      [](auto & is, auto & lx, auto first, auto last, auto & stop)
+      { return hand_lex(is, lx, first, last, stop); },
+      window_size);
+    compare(inp,
+      [](auto & is, auto & lx, auto first, auto last, auto & stop)
+      { return fsm_lex(is, lx, first, last, stop); },
+      window_size);
+  }
+}
+
+//=============================================================================
+// Individual tests
+//=============================================================================
+
+TEST(streaming, fake_10k)
+{
+  std::ifstream infile(TEST_DIR "fake_program_10k.txt");
+  std::stringstream ss;
+  ss << infile.rdbuf();
+  compare(ss.str());
+}
+
+TEST(streaming, split_tokens)
+{
+  // literals and comments spanning windows, errors on late lines
+  std::stringstream ss;
+  for (int i=0; i<500; ++i) {
+    ss << "a" << i << " = \"x\n" << i << "\n\" # comment \"\n";
+    if (i % 7 == 0) ss << "\"" << std::string(40, '\n') << "\"\n";
+    if (i % 11 == 0) ss << "  1.2.3 \t\n\n";
+  }
+  compare(ss.str());
+}
+
+TEST(streaming, long_tokens)
+{
+  // tokens and lines longer than the window
+  compare(std::string(300, 'x') + " y\n\"" + std::string(300, ' ') + "\" z");
+  compare(std::string(1000, 'w') + " " + std::string(1000, 'v'));
+}
+
+TEST(streaming, unterminated)
+{
+  compare("a b\n\"c d\ne f");
+  compare("a b\n# c d");
+  compare("");
+}
+
+TEST(streaming, consumer)
+{
+  std::stringstream ss;
+  for (int i=0; i<1000; ++i) ss << "line" << i << "\n";
+
+  size_t ntoks = 0, nwindows = 0, lines = 0;
+  auto err = stream_lex(ss, "",
+    [](auto & is, auto & lx, auto first, auto last, auto & stop)
+    { return hand_lex(is, lx, first, last, stop); },
+    [&](auto & window, auto & lx) {
+      ntoks += lx.numTokens();
+      nwindows++;
+      lines = window.first_line + window.newlines.size();
+    },
+    512);
+
+  EXPECT_EQ(err, 0);
+  EXPECT_EQ(ntoks, 1000);
+  EXPECT_EQ(lines, 1000);
+  EXPECT_GT(nwindows, 10);
+}
@@ -1,16 +1,20 @@
 #!/bin/bash
 
+# any arguments are forwarded to lexit, e.g. ./bench.sh --mmap
+args="$@"
+
 lines="10000 100000 1000000 10000000"
 algs="hand fsm re2c"
 
-echo "algorithm, lines, time" > bench.txt
+echo "algorithm, lines, load, time" > bench.txt
 
 for a in $algs; do
   for l in $lines; do
     python3 ../tools/gen_random.py --output fake_program.txt --lines $l
-    out=`$PWD/lexit fake_program.txt $a`
+    out=`$PWD/lexit fake_program.txt $a $args`
     echo $out
+    ld=`echo "$out" | awk -F'Load Elapsed: ' '{print $2}' | awk '{print $1}'`
     t=`echo "$out" | awk -F'Avg Elapsed: ' '{print $2}' | awk '{print $1}'`
-    echo $a, $l, $t >> bench.txt
+    echo $a, $l, $ld, $t >> bench.txt
   done
 done
@@ -0,0 +1,146 @@
+#include <fsm.hpp>
+#include <lex.hpp>
+
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+//==============================================================================
+// Writes the transition table of the FSM lexer out as C++, one label per
+// state and a switch on the byte ranges that leave it.  The scanner runs the
+// same machine as fsm_lex without a table lookup per byte.
+//==============================================================================
+
+using namespace lex;
+
+static const char * state_names[] = {
+#define STATE_NAME(name, ...) #name,
+  FOR_FSM_TRANS_STATES(STATE_NAME)
+  FOR_FSM_FINAL_ID_STATES(STATE_NAME)
+  FOR_FSM_OTHER_FINAL_STATES(STATE_NAME)
+  FOR_FSM_FINAL_OP_STATES(STATE_NAME)
+  FOR_FSM_EXACT_STATES(STATE_NAME)
+  FOR_FSM_DECODE_STATES(STATE_NAME)
+#undef STATE_NAME
+};
+
+static_assert(std::size(state_names) == FSM_NUM_STATES);
+
+/// What a state does on a byte: go on to a state, or reject it and start over
+/// in a state
+using action_t = std::pair<bool, int>;
+
+static std::string byte_literal(int b)
+{
+  if ((b >= '0' && b <= '9') || (b >= 'a' && b <= 'z') || (b >= 'A' && b <= 'Z'))
+    return std::string("'") + char(b) + "'";
+  return std::to_string(b);
+}
+
+static void write_action(std::ostream & os, int s, const action_t & action)
+{
+  auto [accept, target] = action;
+  if (accept)
+    os << "goto L_" << state_names[target] << ";\n";
+  else
+    os << "pos = p; state = " << state_names[target] << "; return "
+       << state_names[s] << ";\n";
+}
+
+//==============================================================================
+/// The cases of one state, with the most common action as the default
+//==============================================================================
+static void write_state(
+  std::ostream & os,
+  const machine_t & table,
+  const std::vector<int> & classes,
+  int s)
+{
+  std::vector<action_t> actions(256);
+  std::map<action_t, int> counts;
+  for (int b=0; b<256; ++b) {
+    auto next = table(s, classes[b]);
+    actions[b] = next != S_REJECT ?
+      action_t{true, next} : action_t{false, table(S_REJECT, classes[b])};
+    counts[actions[b]]++;
+  }
+
+  auto common = counts.begin()->first;
+  for (auto & [action, n] : counts)
+    if (n > counts[common]) common = action;
+
+  os << "L_" << state_names[s] << ":\n";
+  os << "  switch (static_cast<uint8_t>(buffer[p++])) {\n";
+
+  // the byte ranges of each action, in byte order within it
+  std::map<action_t, std::vector<std::pair<int,int>>> ranges;
+  for (int b=0; b<256; ) {
+    auto e = b;
+    while (e+1 < 256 && actions[e+1] == actions[b]) e++;
+    if (actions[b] != common) ranges[actions[b]].emplace_back(b, e);
+    b = e + 1;
+  }
+
+  for (auto & [action, rs] : ranges) {
+    os << " ";
+    for (auto [b, e] : rs) {
+      os << " case " << byte_literal(b);
+      if (e > b) os << " ... " << byte_literal(e);
+      os << ":";
+    }
+    os << "\n    ";
+    write_action(os, s, action);
+  }
+  os << "  default:\n    ";
+  write_action(os, s, common);
+  os << "  }\n\n";
+}
+
+static void write_scanner(std::ostream & os)
+{
+  machine_t table;
+  table.resize(FSM_NUM_STATES, C_SIZE);
+  fill_fsm_table(table);
+
+  std::vector<int> classes(256);
+  for (int b=0; b<256; ++b) classes[b] = classify_char(static_cast<char>(b));
+
+  os << "// Generated by fsm_gen from fill_fsm_table() in fsm.hpp, do not edit.\n"
+     << "\n"
+     << "/// Run the machine from state until it rejects a byte.  pos is left just\n"
+     << "/// past that byte, state is where the machine starts over on it, and the\n"
+     << "/// state it was in before is returned.\n"
+     << "static inline int fsm_gen_scan(const char * buffer, size_t & pos, int & state)\n"
+     << "{\n"
+     << "  auto p = pos;\n"
+     << "  switch (state) {\n";
+  for (int s=0; s<FSM_NUM_STATES; ++s)
+    os << "  case " << state_names[s] << ": goto L_" << state_names[s] << ";\n";
+  os << "  }\n\n";
+
+  for (int s=0; s<FSM_NUM_STATES; ++s)
+    write_state(os, table, classes, s);
+
+  os << "  return S_REJECT;\n"
+     << "}\n";
+}
+
+int main(int argc, char ** argv)
+{
+  if (argc != 2) {
+    std::cerr << "Usage: " << argv[0] << " <output_file>\n";
+    return 1;
+  }
+
+  std::ofstream out(argv[1]);
+  write_scanner(out);
+  if (!out) {
+    std::cerr << "Could not write '" << argv[1] << "'\n";
+    return 1;
+  }
+  return 0;
+}
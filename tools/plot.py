@@ -1,24 +1,65 @@
 import argparse
+import json
 import pandas as pd
 import matplotlib.pyplot as plt
 import seaborn as sns
 
+# milliseconds per unit of google benchmark times
+TIME_UNITS = {'ns': 1e-6, 'us': 1e-3, 'ms': 1.0, 's': 1e3}
+
+LABELS = {
+  'time': 'Time (ms)',
+  'bytes_per_second': 'Bytes/s',
+  'items_per_second': 'Tokens/s',
+}
+
+def read_json(filename):
+    """Read the lex/<algorithm>/<mix>/<lines> runs of lex_bench"""
+    with open(filename) as f:
+        data = json.load(f)
+
+    rows = []
+    for b in data['benchmarks']:
+        parts = b['name'].split('/')
+        if parts[0] != 'lex' or b.get('run_type', 'iteration') != 'iteration':
+            continue
+        rows.append({
+          'algorithm': parts[1],
+          'mix': parts[2],
+          'lines': int(parts[3]),
+          'time': b['real_time'] * TIME_UNITS[b.get('time_unit', 'ns')],
+          'bytes_per_second': b.get('bytes_per_second'),
+          'items_per_second': b.get('items_per_second'),
+        })
+    return pd.DataFrame(rows)
+
 def main():
-    parser = argparse.ArgumentParser(description="Plot CSV with Seaborn")
-    parser.add_argument("--file", required=True, help="Path to CSV file")
+    parser = argparse.ArgumentParser(description="Plot CSV or lex_bench JSON with Seaborn")
+    parser.add_argument("--file", required=True, help="Path to CSV or JSON file")
     parser.add_argument("--output", help="Output figure to file.")
+    parser.add_argument("--mix", help="Only plot this token mix (JSON only)")
+    parser.add_argument("--y", default="time", choices=LABELS.keys(),
+                        help="Quantity to plot (JSON only)")
     args = parser.parse_args()
 
     # Load data
-    df = pd.read_csv(args.file, skipinitialspace=True)
+    if args.file.endswith('.json'):
+        df = read_json(args.file)
+        if args.mix:
+            df = df[df['mix'] == args.mix]
+        style = 'mix' if df['mix'].nunique() > 1 else None
+    else:
+        df = pd.read_csv(args.file, skipinitialspace=True)
+        style = None
 
-    sns.lineplot(data=df, x=df["lines"], y=df["time"], hue="algorithm", marker='o')
+    sns.lineplot(data=df, x=df["lines"], y=df[args.y], hue="algorithm",
+                 style=style, marker='o')
     plt.xscale("log")
     plt.yscale("log")
 
 
     plt.xlabel("Lines")
-    plt.ylabel("Time (ms)")
+    plt.ylabel(LABELS[args.y])
     plt.legend()
     plt.grid(True)
 
@@ -29,5 +70,3 @@ def main():
 
 if __name__ == "__main__":
     main()
-
-